@@ -16,6 +16,10 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#if defined(__x86_64__)
+    #include <immintrin.h>
+#endif
+
 #include "bitboard.h"
 #include "board.h"
 
@@ -37,6 +41,21 @@ static Bitboard RookAttacks[0x19000];
 Magic BishopTable[64];
 Magic RookTable[64];
 
+Bitboard (*BishopAttackBB)(Square sq, Bitboard occupied);
+Bitboard (*RookAttackBB)(Square sq, Bitboard occupied);
+
+#if defined(__x86_64__) && !defined(__POPCNT__)
+static int PopCountSoftware(const Bitboard bb) {
+    return __builtin_popcountll(bb);
+}
+
+__attribute__((target("popcnt"))) static int PopCountHardware(const Bitboard bb) {
+    return __builtin_popcountll(bb);
+}
+
+int (*PopCount)(Bitboard bb) = PopCountSoftware;
+#endif
+
 Bitboard PseudoAttacks[TYPE_NB][64];
 Bitboard PawnAttacks[2][64];
 
@@ -44,6 +63,35 @@ Bitboard PassedMask[2][64];
 Bitboard IsolatedMask[64];
 
 
+// Magic bitboards as explained on
+// https://www.chessprogramming.org/Magic_Bitboards
+static uint64_t MagicIndex(const Magic *m, const Bitboard occupied) {
+    return ((occupied & m->mask) * m->magic) >> m->shift;
+}
+
+static Bitboard BishopAttackMagic(const Square sq, const Bitboard occupied) {
+    return BishopTable[sq].attacks[MagicIndex(&BishopTable[sq], occupied)];
+}
+
+static Bitboard RookAttackMagic(const Square sq, const Bitboard occupied) {
+    return RookTable[sq].attacks[MagicIndex(&RookTable[sq], occupied)];
+}
+
+#if defined(__x86_64__)
+// The bmi2 pext instruction gives a dense index without the multiplication
+__attribute__((target("bmi2"))) static uint64_t PextIndex(const Magic *m, const Bitboard occupied) {
+    return _pext_u64(occupied, m->mask);
+}
+
+__attribute__((target("bmi2"))) static Bitboard BishopAttackPext(const Square sq, const Bitboard occupied) {
+    return BishopTable[sq].attacks[PextIndex(&BishopTable[sq], occupied)];
+}
+
+__attribute__((target("bmi2"))) static Bitboard RookAttackPext(const Square sq, const Bitboard occupied) {
+    return RookTable[sq].attacks[PextIndex(&RookTable[sq], occupied)];
+}
+#endif
+
 // Helper function that returns a bitboard with the landing square of
 // the step, or an empty bitboard if the step would go outside the board
 INLINE Bitboard LandingSquareBB(const Square sq, const int step) {
@@ -93,8 +141,13 @@ static void InitNonSliderAttacks() {
 // Initializes slider attack lookups
 static void InitSliderAttacks(Magic *m, Bitboard *table, const int *steps) {
 
-#ifndef USE_PEXT
     const uint64_t *magics = steps[0] == 8 ? RookMagics : BishopMagics;
+
+    // The tables are laid out for the index the lookups use
+    uint64_t (*AttackIndex)(const Magic *, Bitboard) = MagicIndex;
+#if defined(__x86_64__)
+    if (UsePext)
+        AttackIndex = PextIndex;
 #endif
 
     for (Square sq = A1; sq <= H8; ++sq) {
@@ -107,14 +160,12 @@ static void InitSliderAttacks(Magic *m, Bitboard *table, const int *steps) {
 
         m[sq].mask = MakeSliderAttackBB(sq, 0, steps) & ~edges;
 
-#ifndef USE_PEXT
         m[sq].magic = magics[sq];
         m[sq].shift = 64 - PopCount(m[sq].mask);
-#endif
 
         Bitboard occupied = 0;
         do {
-            m[sq].attacks[AttackIndex(sq, occupied, m)] = MakeSliderAttackBB(sq, occupied, steps);
+            m[sq].attacks[AttackIndex(&m[sq], occupied)] = MakeSliderAttackBB(sq, occupied, steps);
             occupied = (occupied - m[sq].mask) & m[sq].mask; // Carry rippler
             table++;
         } while (occupied);
@@ -137,9 +188,29 @@ static void InitEvalMasks() {
     }
 }
 
+// Points the lookups at the versions for this CPU, as chosen by InitCPU
+static void SelectLookups() {
+
+    BishopAttackBB = BishopAttackMagic;
+    RookAttackBB   = RookAttackMagic;
+
+#if defined(__x86_64__)
+    if (UsePext) {
+        BishopAttackBB = BishopAttackPext;
+        RookAttackBB   = RookAttackPext;
+    }
+#endif
+
+#if defined(__x86_64__) && !defined(__POPCNT__)
+    PopCount = UsePopcnt ? PopCountHardware : PopCountSoftware;
+#endif
+}
+
 // Initializes all bitboard lookups
 CONSTR InitBitMasks() {
 
+    SelectLookups();
+
     for (Square sq = A1; sq <= H8; ++sq)
         SquareBB[sq] = (1ULL << sq);
 
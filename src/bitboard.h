@@ -20,17 +20,9 @@
 
 #include "types.h"
 #include "board.h"
+#include "cpu.h"
 
 
-#ifdef USE_PEXT
-// Uses the bmi2 pext instruction in place of magic bitboards
-#include "x86intrin.h"
-#define AttackIndex(sq, occ, table) (_pext_u64(occ, table[sq].mask))
-
-#else
-// Uses magic bitboards as explained on https://www.chessprogramming.org/Magic_Bitboards
-#define AttackIndex(sq, occ, table) (((occ & table[sq].mask) * table[sq].magic) >> table[sq].shift)
-
 static const uint64_t RookMagics[64] = {
     0xA180022080400230ull, 0x0040100040022000ull, 0x0080088020001002ull, 0x0080080280841000ull,
     0x4200042010460008ull, 0x04800A0003040080ull, 0x0400110082041008ull, 0x008000A041000880ull,
@@ -68,17 +60,13 @@ static const uint64_t BishopMagics[64] = {
     0xFFFFFCFCFD79EDFFull, 0xFC0863FCCB147576ull, 0x040C000022013020ull, 0x2000104000420600ull,
     0x0400000260142410ull, 0x0800633408100500ull, 0xFC087E8E4BB2F736ull, 0x43FF9E4EF4CA2C89ull,
 };
-#endif
 
 typedef struct {
 
     Bitboard *attacks;
     Bitboard mask;
-
-#ifndef USE_PEXT
     uint64_t magic;
     int shift;
-#endif
 
 } Magic;
 
@@ -111,6 +99,17 @@ extern Bitboard BetweenBB[64][64];
 extern Magic BishopTable[64];
 extern Magic RookTable[64];
 
+// Slider attack lookups, pointed at the bmi2 pext versions at startup
+// when the CPU has a fast pext, otherwise at the magic bitboard ones
+extern Bitboard (*BishopAttackBB)(Square sq, Bitboard occupied);
+extern Bitboard (*RookAttackBB)(Square sq, Bitboard occupied);
+
+#if defined(__x86_64__) && !defined(__POPCNT__)
+// Population count, pointed at the popcnt instruction at startup when the CPU
+// has it, as the builtin is a library call unless the compiler targets it
+extern int (*PopCount)(Bitboard bb);
+#endif
+
 extern Bitboard PseudoAttacks[8][64];
 extern Bitboard PawnAttacks[2][64];
 
@@ -140,11 +139,13 @@ INLINE Bitboard AdjacentFilesBB(const Square sq) {
          | ShiftBB(EAST, FileBB[FileOf(sq)]);
 }
 
+#if !defined(__x86_64__) || defined(__POPCNT__)
 // Population count/Hamming weight
 INLINE int PopCount(const Bitboard bb) {
 
     return __builtin_popcountll(bb);
 }
+#endif
 
 // Returns the index of the least significant bit
 INLINE int Lsb(const Bitboard bb) {
@@ -180,8 +181,8 @@ INLINE Bitboard AttackBB(PieceType piecetype, Square sq, Bitboard occupied) {
     assert(piecetype != PAWN);
 
     switch(piecetype) {
-        case BISHOP: return BishopTable[sq].attacks[AttackIndex(sq, occupied, BishopTable)];
-        case ROOK  : return   RookTable[sq].attacks[AttackIndex(sq, occupied, RookTable)];
+        case BISHOP: return BishopAttackBB(sq, occupied);
+        case ROOK  : return   RookAttackBB(sq, occupied);
         case QUEEN : return AttackBB(ROOK, sq, occupied) | AttackBB(BISHOP, sq, occupied);
         default    : return PseudoAttacks[piecetype][sq];
     }
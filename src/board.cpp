@@ -168,10 +168,14 @@ void ParseFen(const char *fen, Position *pos) {
 
     assert(fen != NULL);
 
+#if defined(EVAL_NNUE)
+    // The position keeps using the stack of NNUE states it was given
+    StateInfo *states = pos->states;
     *pos = Position();
-
-    for (int i = 1; i < MAXGAMEMOVES; ++i)
-        pos->gameHistory[i].previous = &pos->gameHistory[i-1];
+    pos->states = states;
+#else
+    *pos = Position();
+#endif
 
 #if defined(EVAL_NNUE)
     // evalList��clear�B���memset�Ń[���N���A�����Ƃ��ɃN���A����Ă��邪�c�B
@@ -268,12 +272,34 @@ void ParseFen(const char *fen, Position *pos) {
     // Generate the position key
     pos->key = GeneratePosKey(pos);
 
+#if defined(EVAL_NNUE)
+    ResetStates(pos);
+#endif
+
     assert(PositionOk(pos));
 #if defined(EVAL_NNUE)
     assert(pos->evalList.is_valid(*pos));
 #endif  // defined(EVAL_NNUE)
 }
 
+#if defined(EVAL_NNUE)
+// Makes the current position the root of its stack of NNUE states
+void ResetStates(Position *pos) {
+
+    assert(pos->states != NULL);
+
+    StateInfo *st = pos->st = pos->states;
+
+    for (int i = 0; i < Eval::NNUE::kNetworkSlots; ++i) {
+        st->accumulators[i].computed_accumulation = false;
+        st->accumulators[i].computed_score = false;
+    }
+    st->dirtyPiece.dirty_num = 0;
+    st->previous = NULL;
+    st->castlingRights = pos->castlingRights;
+}
+#endif
+
 // Translates a move to a string
 char *BoardToFen(const Position *pos) {
 
@@ -427,7 +453,13 @@ void MirrorBoard(Position *pos) {
                | (pos->castlingRights & BLACK_CASTLE) >> 2;
 
     // Clear the position
+#if defined(EVAL_NNUE)
+    StateInfo *states = pos->states;
     *pos = Position();
+    pos->states = states;
+#else
+    *pos = Position();
+#endif
 
     // Fill in the mirrored position info
     for (Square sq = A1; sq <= H8; ++sq)
@@ -443,6 +475,10 @@ void MirrorBoard(Position *pos) {
     // Generate the position key
     pos->key = GeneratePosKey(pos);
 
+#if defined(EVAL_NNUE)
+    ResetStates(pos);
+#endif
+
     assert(PositionOk(pos));
 }
 #endif
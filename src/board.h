@@ -26,7 +26,8 @@
 #include "eval/nnue/nnue_accumulator.h"
 
 
-typedef struct StateInfo {
+// Info needed to take back a move and to detect repetitions
+typedef struct History {
     Key posKey;
     Move move;
     uint8_t epSquare;
@@ -34,23 +35,30 @@ typedef struct StateInfo {
     uint8_t castlingRights;
     uint8_t padding; // not used
     int eval;
-
-    StateInfo *previous;
+} History;
 
 #if defined(EVAL_NNUE)
-    Eval::NNUE::Accumulator accumulator;
+// Room for the root and a state for each search ply
+#define STATE_STACK_SIZE (MAXDEPTH + 1)
+
+// NNUE state of a position searched, kept in a per-thread stack indexed by
+// ply rather than in gameHistory, as only search plies need accumulators
+typedef struct StateInfo {
+    Eval::NNUE::Accumulator accumulators[Eval::NNUE::kNetworkSlots];
 
     // �]���l�̍����v�Z�̊Ǘ��p
     Eval::DirtyPiece dirtyPiece;
-#endif  // defined(EVAL_NNUE)
 
+    StateInfo *previous;
+    uint8_t castlingRights;
 } StateInfo;
+#endif  // defined(EVAL_NNUE)
 
 typedef struct Position {
 
 #if defined(EVAL_NNUE) || defined(EVAL_LEARN)
     // --- StateInfo
-    StateInfo* state() const { return const_cast<StateInfo *>(&gameHistory[histPly]); }
+    StateInfo* state() const { return st; }
     const Eval::EvalList* eval_list() const { return &evalList; }
 #endif  // defined(EVAL_NNUE) || defined(EVAL_LEARN)
 
@@ -85,7 +93,14 @@ typedef struct Position {
 
     Key key;
 
-    StateInfo gameHistory[MAXGAMEMOVES];
+    History gameHistory[MAXGAMEMOVES];
+
+#if defined(EVAL_NNUE)
+    // Current and root entries of a stack of NNUE states, the
+    // owner provides STATE_STACK_SIZE entries before ParseFen
+    StateInfo *st;
+    StateInfo *states;
+#endif
 
 #if defined(EVAL_NNUE) || defined(EVAL_LEARN)
     // �]���֐��ŗp�����̃��X�g
@@ -108,6 +123,9 @@ extern uint64_t SideKey;
 
 void InitDistance();
 void ParseFen(const char *fen, Position *pos);
+#if defined(EVAL_NNUE)
+void ResetStates(Position *pos);
+#endif
 Key KeyAfter(const Position *pos, Move move);
 char *BoardToFen(const Position *pos);
 #ifndef NDEBUG
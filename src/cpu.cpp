@@ -0,0 +1,116 @@
+/*
+  Weiss is a UCI compliant chess engine.
+  Copyright (C) 2020  Terje Kirstihagen
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <cpuid.h>
+#endif
+#include <stdio.h>
+
+#include "cpu.h"
+
+
+CPUFeatures CPU;
+
+int Simd = SIMD_NONE;
+bool UsePopcnt = false;
+bool UsePext = false;
+
+static const char *SimdNames[SIMD_NB] = {
+    "scalar", "sse2", "sse4.1", "avx2", "avx512", "avx512-vnni"
+};
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// Reads the register state the OS saves on context switches,
+// wide registers are only usable when the OS has enabled them
+static uint64_t XGetBV() {
+
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+// Queries the CPU with cpuid for the instruction sets we have kernels for
+static void DetectCPU() {
+
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        return;
+
+    const unsigned maxLeaf = eax;
+    const bool amd = ebx == signature_AMD_ebx;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+
+    const unsigned family = ((eax >> 8) & 0xF) + ((eax >> 20) & 0xFF);
+    const bool sse2  = edx & bit_SSE2;
+    const bool sse41 = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+    const uint64_t xcr0 = (ecx & bit_OSXSAVE) ? XGetBV() : 0;
+    const bool osAVX    = (ecx & bit_AVX) && (xcr0 & 0x06) == 0x06;
+    const bool osAVX512 = osAVX && (xcr0 & 0xE0) == 0xE0;
+
+    CPU.popcnt = ecx & bit_POPCNT;
+
+    bool avx2 = false, avx512 = false, vnni = false;
+
+    if (maxLeaf >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        CPU.bmi2 = ebx & bit_BMI2;
+        avx2   = osAVX && (ebx & bit_AVX2);
+        avx512 = osAVX512 && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW);
+        vnni   = avx512 && (ebx & bit_AVX512VL) && (ecx & bit_AVX512VNNI);
+    }
+
+    // AMD before Zen 3 implements pext in microcode, magics are faster there
+    CPU.fastPext = CPU.bmi2 && !(amd && family < 0x19);
+
+    CPU.simd = vnni   ? SIMD_VNNI
+             : avx512 ? SIMD_AVX512
+             : avx2   ? SIMD_AVX2
+             : sse41  ? SIMD_SSE41
+             : sse2   ? SIMD_SSE2
+                      : SIMD_NONE;
+}
+#endif
+
+// Picks the best path for each family of kernels. Runs before the
+// other constructors, as the slider attack tables are laid out
+// differently for pext and magics.
+__attribute__((constructor(101))) void InitCPU() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    DetectCPU();
+#endif
+
+    Simd      = CPU.simd;
+    UsePopcnt = CPU.popcnt;
+    UsePext   = CPU.fastPext;
+}
+
+const char *SimdName(int level) {
+    return SimdNames[level];
+}
+
+// Reports the paths selected for this CPU
+void PrintCPU() {
+    printf("info string CPU nnue %s, attacks %s, popcount %s\n",
+           SimdName(Simd),
+           UsePext   ? "pext"     : "magic",
+           UsePopcnt ? "hardware" : "software");
+}
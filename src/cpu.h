@@ -0,0 +1,53 @@
+/*
+  Weiss is a UCI compliant chess engine.
+  Copyright (C) 2020  Terje Kirstihagen
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "types.h"
+
+
+// Instruction sets the NNUE kernels are compiled for, from worst to best
+enum SimdLevel {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_VNNI,
+    SIMD_NB
+};
+
+typedef struct CPUFeatures {
+    bool popcnt;
+    bool bmi2;
+    bool fastPext;
+    int simd;
+} CPUFeatures;
+
+
+extern CPUFeatures CPU;
+
+// The paths in use, chosen from CPU at startup
+extern int Simd;
+extern bool UsePopcnt;
+extern bool UsePext;
+
+
+void InitCPU();
+const char *SimdName(int level);
+void PrintCPU();
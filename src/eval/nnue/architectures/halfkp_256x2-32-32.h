@@ -1,5 +1,8 @@
 ﻿// NNUE評価関数で用いる入力特徴量とネットワーク構造の定義
 
+#ifndef _NNUE_ARCHITECTURES_HALFKP_256X2_32_32_H_
+#define _NNUE_ARCHITECTURES_HALFKP_256X2_32_32_H_
+
 #include "../features/feature_set.h"
 #include "../features/half_kp.h"
 
@@ -11,25 +14,32 @@ namespace Eval {
 
 namespace NNUE {
 
-// 評価関数で用いる入力特徴量
-using RawFeatures = Features::FeatureSet<
-    Features::HalfKP<Features::Side::kFriend>>;
+namespace Architectures {
+
+struct HalfKP256 {
+  // 評価関数で用いる入力特徴量
+  using RawFeatures = Features::FeatureSet<
+      Features::HalfKP<Features::Side::kFriend>>;
 
-// 変換後の入力特徴量の次元数
-constexpr IndexType kTransformedFeatureDimensions = 256;
+  // 変換後の入力特徴量の次元数
+  static constexpr IndexType kTransformedFeatureDimensions = 256;
 
-namespace Layers {
+  // 入力特徴量変換器の重みの型
+  using FeatureWeightType = std::int16_t;
 
-// ネットワーク構造の定義
-using InputLayer = InputSlice<kTransformedFeatureDimensions * 2>;
-using HiddenLayer1 = ClippedReLU<AffineTransform<InputLayer, 32>>;
-using HiddenLayer2 = ClippedReLU<AffineTransform<HiddenLayer1, 32>>;
-using OutputLayer = AffineTransform<HiddenLayer2, 1>;
+  // ネットワーク構造の定義
+  using InputLayer = Layers::InputSlice<kTransformedFeatureDimensions * 2>;
+  using HiddenLayer1 = Layers::ClippedReLU<Layers::AffineTransform<InputLayer, 32>>;
+  using HiddenLayer2 = Layers::ClippedReLU<Layers::AffineTransform<HiddenLayer1, 32>>;
+  using OutputLayer = Layers::AffineTransform<HiddenLayer2, 1>;
 
-}  // namespace Layers
+  using Network = OutputLayer;
+};
 
-using Network = Layers::OutputLayer;
+}  // namespace Architectures
 
 }  // namespace NNUE
 
 }  // namespace Eval
+
+#endif
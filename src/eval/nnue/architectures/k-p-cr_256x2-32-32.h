@@ -1,5 +1,8 @@
 // NNUE]֐ŗp͓ʂƃlbg[N\̒`
 
+#ifndef _NNUE_ARCHITECTURES_K_P_CR_256X2_32_32_H_
+#define _NNUE_ARCHITECTURES_K_P_CR_256X2_32_32_H_
+
 #include "../features/feature_set.h"
 #include "../features/k.h"
 #include "../features/p.h"
@@ -11,27 +14,35 @@
 
 namespace Eval {
 
-  namespace NNUE {
+namespace NNUE {
+
+namespace Architectures {
 
-    // ]֐ŗp͓
-    using RawFeatures = Features::FeatureSet<Features::K, Features::P,
+struct KPCr256 {
+  // ]֐ŗp͓
+  using RawFeatures = Features::FeatureSet<
+      Features::K, Features::P,
       Features::CastlingRight>;
 
-    // ϊ͓̓ʂ̎
-    constexpr IndexType kTransformedFeatureDimensions = 256;
+  // ϊ͓̓ʂ̎
+  static constexpr IndexType kTransformedFeatureDimensions = 256;
 
-    namespace Layers {
+  // ͓ʕϊ̏ď݂^
+  using FeatureWeightType = std::int16_t;
 
-      // lbg[N\̒`
-      using InputLayer = InputSlice<kTransformedFeatureDimensions * 2>;
-      using HiddenLayer1 = ClippedReLU<AffineTransform<InputLayer, 32>>;
-      using HiddenLayer2 = ClippedReLU<AffineTransform<HiddenLayer1, 32>>;
-      using OutputLayer = AffineTransform<HiddenLayer2, 1>;
+  // lbg[N\̒`
+  using InputLayer = Layers::InputSlice<kTransformedFeatureDimensions * 2>;
+  using HiddenLayer1 = Layers::ClippedReLU<Layers::AffineTransform<InputLayer, 32>>;
+  using HiddenLayer2 = Layers::ClippedReLU<Layers::AffineTransform<HiddenLayer1, 32>>;
+  using OutputLayer = Layers::AffineTransform<HiddenLayer2, 1>;
 
-    }  // namespace Layers
+  using Network = OutputLayer;
+};
 
-    using Network = Layers::OutputLayer;
+}  // namespace Architectures
 
-  }  // namespace NNUE
+}  // namespace NNUE
 
 }  // namespace Eval
+
+#endif
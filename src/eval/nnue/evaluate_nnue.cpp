@@ -2,73 +2,488 @@
 
 #if defined(EVAL_NNUE)
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "../../evaluate.h"
 #include "../../board.h"
 #include "../../misc.h"
+#include "../../numa.h"
 #include "../../uci.h"
 
 #include "evaluate_nnue.h"
 
+#if defined(EVAL_EMBEDDED)
+// ビルド時に埋め込んだ評価関数ファイル(makeのEVALFILEで指定する)
+// 実行ファイルの読み取り専用領域にそのまま置かれるので、起動時のファイル読み込みが要らない
+#if defined(__APPLE__)
+#define EMBEDDED_SECTION ".const_data"
+#define EMBEDDED_SYMBOL(name) "_" #name
+#elif defined(_WIN32)
+#define EMBEDDED_SECTION ".section .rdata"
+#define EMBEDDED_SYMBOL(name) #name
+#else
+#define EMBEDDED_SECTION ".section .rodata"
+#define EMBEDDED_SYMBOL(name) #name
+#endif
+
+asm(EMBEDDED_SECTION "\n"
+    ".balign 64\n"
+    ".global " EMBEDDED_SYMBOL(EmbeddedNetwork) "\n"
+    EMBEDDED_SYMBOL(EmbeddedNetwork) ":\n"
+    ".incbin \"" EVAL_EMBEDDED "\"\n"
+    ".global " EMBEDDED_SYMBOL(EmbeddedNetworkEnd) "\n"
+    EMBEDDED_SYMBOL(EmbeddedNetworkEnd) ":\n"
+    ".byte 0\n"
+    ".text\n");
+
+extern "C" const char EmbeddedNetwork[];
+extern "C" const char EmbeddedNetworkEnd[];
+#endif
+
 namespace Eval {
 
-namespace NNUE {
+namespace {
 
-// 入力特徴量変換器
-AlignedPtr<FeatureTransformer> feature_transformer;
+// 各スレッドの評価関数ごとの統計。スレッド終了時に全体に加える。
+thread_local EvalStats local_stats[NNUE::kNetworkSlots];
+EvalStats total_stats[NNUE::kNetworkSlots];
+std::mutex stats_mutex;
 
-// 評価関数
-AlignedPtr<Network> network;
+}  // namespace
+
+namespace NNUE {
+
+// 探索に用いている評価関数パラメータ
+ParameterSet parameters;
 
 // 評価関数ファイル名
 const char* const kFileName = "nn.bin";
 
-// 評価関数の構造を表す文字列を取得する
-std::string GetArchitectureString() {
-  return "Features=" + FeatureTransformer::GetStructureString() +
-      ",Network=" + Network::GetStructureString();
-}
+// 小さな評価関数のファイル名
+const char* const kSmallFileName = "nn-small.bin";
+
+// 計算用の配置のまま書き出した評価関数ファイル名
+const char* const kMappedFileName = "nn.map";
 
 namespace {
 
 namespace Detail {
 
-// 評価関数パラメータを初期化する
-template <typename T>
-void Initialize(AlignedPtr<T>& pointer) {
-  pointer.reset(reinterpret_cast<T*>(aligned_malloc(sizeof(T), alignof(T))));
-  std::memset(pointer.get(), 0, sizeof(T));
+// 評価関数パラメータの領域をsize[byte]確保して初期化する
+void Initialize(ParametersPtr& pointer, std::size_t size) {
+  ParametersDeleter deleter;
+  deleter.size = size;
+  void* mem = LargePageAlloc(size, &deleter.kind);
+  if (mem == nullptr) {
+    std::cout << "info string can't allocate memory. size = " << size << std::endl;
+    my_exit();
+  }
+  pointer = ParametersPtr(mem, deleter);
+  std::memset(pointer.get(), 0, size);
 }
 
 // 評価関数パラメータを読み込む
 template <typename T>
-bool ReadParameters(std::istream& stream, const AlignedPtr<T>& pointer) {
+bool ReadParameters(std::istream& stream, const ParametersPtr& pointer) {
   std::uint32_t header;
   stream.read(reinterpret_cast<char*>(&header), sizeof(header));
   if (!stream || header != T::GetHashValue()) return false;
-  return pointer->ReadParameters(stream);
+  return static_cast<T*>(pointer.get())->ReadParameters(stream);
 }
 
 // 評価関数パラメータを書き込む
 template <typename T>
-bool WriteParameters(std::ostream& stream, const AlignedPtr<T>& pointer) {
+bool WriteParameters(std::ostream& stream, const ParametersPtr& pointer) {
   constexpr std::uint32_t header = T::GetHashValue();
   stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
-  return pointer->WriteParameters(stream);
+  return static_cast<const T*>(pointer.get())->WriteParameters(stream);
 }
 
 }  // namespace Detail
 
-// 評価関数パラメータを初期化する
-void Initialize() {
-  Detail::Initialize(feature_transformer);
-  Detail::Initialize(network);
+// NUMAノード毎の評価関数パラメータの複製。architectureは使わない
+ParameterSet replicas[MAX_NUMA_NODES];
+int replica_count = 0;
+
+// このスレッドが評価に用いるパラメータ。nullptrなら共有のものを使う。
+thread_local const void* local_feature_transformer[kNetworkSlots] = {};
+thread_local const void* local_network[kNetworkSlots] = {};
+
+// このスレッドの玉の位置ごとの累積値のキャッシュ。読み込んだアーキテクチャのRefreshCacheとして使う
+alignas(kCacheLineSize) thread_local char refresh_cache[kNetworkSlots][kMaxRefreshCacheSize];
+
+// このスレッドのキャッシュを計算した評価関数パラメータの版
+thread_local std::uint32_t refresh_cache_version[kNetworkSlots] = {};
+
+// 評価関数パラメータを読み込んだ回数。キャッシュが古いパラメータによるものか判定する
+std::uint32_t parameters_version = 0;
+
+// CreateReplica()に渡す、複製元と複製先
+struct ReplicaTask {
+  int node;
+  const ParameterSet* source;
+  ParameterSet* replica;
+};
+
+// そのノードに固定したスレッドで確保・コピーすることで、
+// first touchによりメモリがそのノードに置かれる。
+void* CreateReplica(void* arg) {
+  const ReplicaTask& task = *static_cast<const ReplicaTask*>(arg);
+  BindToNode(task.node);
+  const ParameterSet& source = *task.source;
+  ParameterSet& replica = *task.replica;
+  for (int slot = 0; slot < kNetworkSlots; ++slot) {
+    if (!source.feature_transformer[slot]) continue;
+    const std::size_t feature_transformer_size = source.feature_transformer[slot].get_deleter().size;
+    const std::size_t network_size = source.network[slot].get_deleter().size;
+    Detail::Initialize(replica.feature_transformer[slot], feature_transformer_size);
+    Detail::Initialize(replica.network[slot], network_size);
+    std::memcpy(replica.feature_transformer[slot].get(), source.feature_transformer[slot].get(),
+                feature_transformer_size);
+    std::memcpy(replica.network[slot].get(), source.network[slot].get(), network_size);
+  }
+  return nullptr;
+}
+
+// NUMAノードが複数あれば、sourceの複製をノード毎にtargetに作り、作った数を返す
+int CreateReplicas(const ParameterSet& source, ParameterSet* target) {
+  // ノードが1つなら複製しても意味がない
+  if (!NumaEnabled || NumaNodes() < 2) return 0;
+
+  pthread_t pthreads[MAX_NUMA_NODES];
+  ReplicaTask tasks[MAX_NUMA_NODES];
+  for (int node = 0; node < NumaNodes(); ++node) {
+    tasks[node] = {node, &source, &target[node]};
+    pthread_create(&pthreads[node], NULL, CreateReplica, &tasks[node]);
+  }
+  for (int node = 0; node < NumaNodes(); ++node)
+    pthread_join(pthreads[node], NULL);
+  return NumaNodes();
+}
+
+// 最初の層の入力の疎らさを測る局面。ベンチマークの局面を使う
+const char* const kSparsityFens[] = {
+#include "../../bench.csv"
+};
+
+// 最初の層を疎な入力として計算する、0でない入力の4バイトの塊の割合の上限
+// これより密なネットワークでは、0でない塊を探す分だけ密に計算するより遅くなる
+constexpr double kSparseInputDensity = 0.5;
+
+// アーキテクチャごとの評価関数の計算
+// どのアーキテクチャでも同じ静的関数を持ち、Dispatch()で読み込んだものを選んで呼び出す
+// kSlotの評価関数のパラメータ、キャッシュ、局面ごとの累積値を使う
+template <typename Architecture, NetworkSlot kSlot = kMainNetwork>
+struct Evaluator {
+  using FeatureTransformer = NNUE::FeatureTransformer<Architecture>;
+  using Network = typename Architecture::Network;
+  using RefreshCache = NNUE::RefreshCache<Architecture>;
+
+  // 入力特徴量変換器の重みを8bitに量子化したアーキテクチャの入力特徴量変換器
+  using QuantizedFeatureTransformer =
+      NNUE::FeatureTransformer<Architectures::QuantizedFeatures<Architecture>>;
+
+  static_assert(Network::kOutputDimensions == 1, "");
+  static_assert(std::is_same<typename Network::OutputType, std::int32_t>::value, "");
+  static_assert(sizeof(RefreshCache) <= kMaxRefreshCacheSize, "");
+
+  // 入力特徴量変換器の重みの型
+  using WeightType = typename Architecture::FeatureWeightType;
+
+  // 評価関数の構造のハッシュ値
+  static constexpr std::uint32_t kHashValue = NNUE::kHashValue<Architecture>;
+
+  // 評価関数の構造を表す文字列を取得する
+  static std::string GetArchitectureString() {
+    return "Features=" + FeatureTransformer::GetStructureString() +
+        ",Network=" + Network::GetStructureString();
+  }
+
+  // targetの評価関数パラメータを初期化する
+  static void Initialize(ParameterSet& target) {
+    Detail::Initialize(target.feature_transformer[kSlot], sizeof(FeatureTransformer));
+    Detail::Initialize(target.network[kSlot], sizeof(Network));
+  }
+
+  // ヘッダに続く評価関数パラメータをtargetに読み込む
+  static bool ReadParameters(std::istream& stream, ParameterSet& target) {
+    Initialize(target);
+    if (!Detail::ReadParameters<FeatureTransformer>(stream, target.feature_transformer[kSlot])) return false;
+    if (!Detail::ReadParameters<Network>(stream, target.network[kSlot])) return false;
+    if (!stream || stream.peek() != std::ios::traits_type::eof()) return false;
+    SelectSparseInput(target);
+    return true;
+  }
+
+  // 十分に疎なネットワークなら、最初の層を0でない入力だけで計算する
+  static void SelectSparseInput(ParameterSet& target) {
+    const double density = InputDensity(target);
+    static_cast<Network*>(target.network[kSlot].get())->SetSparseInput(
+        density <= kSparseInputDensity);
+  }
+
+  // ベンチマークの局面で、最初の層の入力のうち0でない4バイトの塊の割合を測る
+  static double InputDensity(const ParameterSet& target) {
+    const auto ft = static_cast<const FeatureTransformer*>(target.feature_transformer[kSlot].get());
+    auto pos = std::make_unique<Position>();
+    auto state = std::make_unique<StateInfo>();
+    std::uint64_t nonzero = 0, chunks = 0;
+    for (const char* fen : kSparsityFens) {
+      pos->states = state.get();
+      ParseFen(fen, pos.get());
+      alignas(kCacheLineSize) TransformedFeatureType features[FeatureTransformer::kBufferSize];
+      ft->Transform(*pos, kSlot, features, true);
+      for (IndexType c = 0; c < FeatureTransformer::kOutputDimensions / 4; ++c) {
+        std::uint32_t chunk;
+        std::memcpy(&chunk, &features[c * 4], sizeof(chunk));
+        nonzero += chunk != 0;
+        ++chunks;
+      }
+    }
+    return static_cast<double>(nonzero) / chunks;
+  }
+
+  // 評価関数パラメータを書き込む
+  static bool WriteParameters(std::ostream& stream) {
+    if (!WriteHeader(stream, kHashValue, GetArchitectureString())) return false;
+    if (!Detail::WriteParameters<FeatureTransformer>(stream, parameters.feature_transformer[kSlot])) return false;
+    if (!Detail::WriteParameters<Network>(stream, parameters.network[kSlot])) return false;
+    return !stream.fail();
+  }
+
+  // 評価に用いる入力特徴量変換器
+  static const FeatureTransformer* CurrentFeatureTransformer() {
+    return static_cast<const FeatureTransformer*>(local_feature_transformer[kSlot]
+        ? local_feature_transformer[kSlot] : parameters.feature_transformer[kSlot].get());
+  }
+
+  // 評価に用いるネットワーク
+  static const Network* CurrentNetwork() {
+    return static_cast<const Network*>(
+        local_network[kSlot] ? local_network[kSlot] : parameters.network[kSlot].get());
+  }
+
+  // このスレッドのキャッシュ。パラメータが読み込み直されていれば初期化する
+  static RefreshCache* CurrentRefreshCache() {
+    RefreshCache* cache = reinterpret_cast<RefreshCache*>(refresh_cache[kSlot]);
+    if (refresh_cache_version[kSlot] != parameters_version) {
+      CurrentFeatureTransformer()->ResetRefreshCache(cache);
+      refresh_cache_version[kSlot] = parameters_version;
+    }
+    return cache;
+  }
+
+  // 差分計算ができるなら進める
+  static void UpdateAccumulatorIfPossible(const Position& pos) {
+    CurrentFeatureTransformer()->UpdateAccumulatorIfPossible(
+        pos, kSlot, CurrentRefreshCache());
+  }
+
+  // 評価値を計算する
+  static Value ComputeScore(const Position& pos, bool refresh = false) {
+    auto& accumulator = pos.state()->accumulators[kSlot];
+    if (!refresh && accumulator.computed_score) {
+      return accumulator.score;
+    }
+
+    ++local_stats[kSlot].compute_calls;
+
+    alignas(kCacheLineSize) TransformedFeatureType
+        transformed_features[FeatureTransformer::kBufferSize];
+    CurrentFeatureTransformer()->Transform(pos, kSlot, transformed_features, refresh,
+                                           CurrentRefreshCache(), &local_stats[kSlot]);
+    alignas(kCacheLineSize) char buffer[Network::kBufferSize];
+    const auto output = CurrentNetwork()->Propagate(transformed_features, buffer);
+
+    accumulator.score = OutputToValue(output[0]);
+    accumulator.computed_score = true;
+    return accumulator.score;
+  }
+
+  // count局面分の変換後の入力特徴量をまとめてネットワークに通す
+  static void PropagateBatch(const TransformedFeatureType* transformed_features,
+                             int count, Value* values) {
+    constexpr IndexType kStride = FeatureTransformer::kBufferSize;
+    constexpr IndexType kOutputStride = Network::OutputStride(kStride);
+    alignas(kCacheLineSize) char buffer[Network::kBufferSize * kMaxBatchSize];
+    for (int begin = 0; begin < count; begin += kMaxBatchSize) {
+      const int size = std::min(count - begin, kMaxBatchSize);
+      const auto output = CurrentNetwork()->PropagateBatch(
+          &transformed_features[begin * kStride], kStride, size, buffer);
+      for (int b = 0; b < size; ++b) {
+        values[begin + b] = OutputToValue(output[b * kOutputStride]);
+      }
+    }
+  }
+
+  // 複数の局面をまとめて評価する。局面ごとの累積値は1局面ずつ求め、
+  // ネットワークだけkMaxBatchSize局面ずつまとめて計算する
+  static void ComputeScores(const Position* const* positions, int count,
+                            Value* values) {
+    constexpr IndexType kStride = FeatureTransformer::kBufferSize;
+    alignas(kCacheLineSize) TransformedFeatureType
+        transformed_features[kStride * kMaxBatchSize];
+    for (int begin = 0; begin < count; begin += kMaxBatchSize) {
+      const int size = std::min(count - begin, kMaxBatchSize);
+      for (int b = 0; b < size; ++b) {
+        CurrentFeatureTransformer()->Transform(
+            *positions[begin + b], kSlot, &transformed_features[b * kStride], false,
+            CurrentRefreshCache(), &local_stats[kSlot]);
+      }
+      PropagateBatch(transformed_features, size, &values[begin]);
+      for (int b = 0; b < size; ++b) {
+        auto& accumulator = positions[begin + b]->state()->accumulators[kSlot];
+        accumulator.score = values[begin + b];
+        accumulator.computed_score = true;
+      }
+      local_stats[kSlot].compute_calls += size;
+    }
+  }
+
+  // ネットワークの出力を評価値にする
+  static Value OutputToValue(std::int32_t output) {
+    // VALUE_MAX_EVALより大きな値が返ってくるとaspiration searchがfail highして
+    // 探索が終わらなくなるのでVALUE_MAX_EVAL以下であることを保証すべき。
+
+    // この現象が起きても、対局時に秒固定などだとそこで探索が打ち切られるので、
+    // 1つ前のiterationのときの最善手がbestmoveとして指されるので見かけ上、
+    // 問題ない。このVALUE_MAX_EVALが返ってくるような状況は、ほぼ詰みの局面であり、
+    // そのような詰みの局面が出現するのは終盤で形勢に大差がついていることが多いので
+    // 勝敗にはあまり影響しない。
+
+    // しかし、教師生成時などdepth固定で探索するときに探索から戻ってこなくなるので
+    // そのスレッドの計算時間を無駄にする。またdepth固定対局でtime-outするようになる。
+
+    auto score = static_cast<Value>(output / FV_SCALE);
+
+    // 1) ここ、下手にclipすると学習時には影響があるような気もするが…。
+    // 2) accumulator.scoreは、差分計算の時に用いないので書き換えて問題ない。
+    return Math::clamp(score , -VALUE_MAX_EVAL , VALUE_MAX_EVAL);
+  }
+};
+
+// AllArchitecturesでindex番目のアーキテクチャの、kSlotのEvaluatorを引数にしてfを呼び出す
+template <NetworkSlot kSlot, std::size_t I = 0, typename Function>
+auto DispatchArchitecture(std::size_t index, Function f) {
+  if constexpr (I + 1 < AllArchitectures::kSize) {
+    if (index != I) {
+      return DispatchArchitecture<kSlot, I + 1>(index, f);
+    }
+  }
+  return f(Evaluator<AllArchitectures::At<I>, kSlot>());
+}
+
+// slotを実行時に選ぶDispatchArchitecture()
+template <typename Function>
+auto DispatchArchitecture(NetworkSlot slot, std::size_t index, Function f) {
+  return slot == kSmallNetwork ? DispatchArchitecture<kSmallNetwork>(index, f)
+                               : DispatchArchitecture<kMainNetwork>(index, f);
+}
+
+// kSlotに読み込んだアーキテクチャのEvaluatorを引数にしてfを呼び出す
+// 分岐はどの局面でも同じ方に進むので予測が外れず、仮想関数のような間接呼び出しも入らない
+template <NetworkSlot kSlot = kMainNetwork, typename Function>
+auto Dispatch(Function f) {
+  return DispatchArchitecture<kSlot>(parameters.architecture[kSlot], f);
+}
+
+// slotを実行時に選ぶDispatch()。局面ごとに呼ぶところでは使わない
+template <typename Function>
+auto Dispatch(NetworkSlot slot, Function f) {
+  return slot == kSmallNetwork ? Dispatch<kSmallNetwork>(f) : Dispatch<kMainNetwork>(f);
+}
+
+// 組み込んだ全てのアーキテクチャについて、Evaluatorと番号を引数にしてfを呼び出す
+template <typename Function, std::size_t... I>
+void ForEachArchitecture(Function f, std::index_sequence<I...>) {
+  (f(Evaluator<AllArchitectures::At<I>>(), I), ...);
+}
+template <typename Function>
+void ForEachArchitecture(Function f) {
+  ForEachArchitecture(f, std::make_index_sequence<AllArchitectures::kSize>());
+}
+
+// targetの主の評価関数のパラメータを、先頭のアーキテクチャで初期化する
+void Initialize(ParameterSet& target) {
+  target.architecture[kMainNetwork] = 0;
+  DispatchArchitecture<kMainNetwork>(0, [&](auto evaluator) {
+    decltype(evaluator)::Initialize(target);
+  });
+}
+
+// 読み込んだ評価関数の入力特徴量変換器の重みを8bitに量子化したものをquantizedに作る
+// 量子化したアーキテクチャの番号を返す。組み込んでいなければ-1を返す
+int QuantizeFeatureTransformer(ParametersPtr& quantized) {
+  return Dispatch([&](auto evaluator) {
+    using E = decltype(evaluator);
+    int found = -1;
+    ForEachArchitecture([&](auto target, std::size_t index) {
+      using T = typename decltype(target)::FeatureTransformer;
+      if constexpr (std::is_same<T, typename E::QuantizedFeatureTransformer>::value) {
+        Detail::Initialize(quantized, sizeof(T));
+        static_cast<T*>(quantized.get())->Quantize(*E::CurrentFeatureTransformer());
+        found = static_cast<int>(index);
+      }
+    });
+    return found;
+  });
 }
 
 }  // namespace
 
+// slotの評価関数の構造を表す文字列を取得する
+std::string GetArchitectureString(NetworkSlot slot) {
+  return Dispatch(slot, [](auto evaluator) {
+    return decltype(evaluator)::GetArchitectureString();
+  });
+}
+
+// 読み込んだアーキテクチャの、1局面分の変換後の入力特徴量のバイト数
+std::size_t GetTransformedFeatureSize() {
+  return Dispatch([](auto evaluator) {
+    return decltype(evaluator)::FeatureTransformer::kBufferSize;
+  });
+}
+
+// 変換後の入力特徴量をまとめてネットワークに通す
+void PropagateBatch(const TransformedFeatureType* features, int count, Value* values) {
+  Dispatch([=](auto evaluator) {
+    decltype(evaluator)::PropagateBatch(features, count, values);
+  });
+}
+
+// 組み込んだアーキテクチャの中から、ハッシュ値と構造を表す文字列が合うものの番号を返す
+// ハッシュ値の合うものが無ければ-1を返す
+int FindArchitecture(std::uint32_t hash_value, const std::string& architecture) {
+  int found = -1;
+  bool exact = false;
+  ForEachArchitecture([&](auto evaluator, std::size_t index) {
+    using E = decltype(evaluator);
+    if (E::kHashValue != hash_value || exact) return;
+    // ハッシュ値が同じものが複数あれば、構造を表す文字列も一致するものを選ぶ
+    exact = E::GetArchitectureString() == architecture;
+    if (found == -1 || exact) found = static_cast<int>(index);
+  });
+  return found;
+}
+
 // ヘッダを読み込む
 bool ReadHeader(std::istream& stream,
   std::uint32_t* hash_value, std::string* architecture) {
@@ -93,163 +508,863 @@ bool WriteHeader(std::ostream& stream,
   return !stream.fail();
 }
 
-// 評価関数パラメータを読み込む
-bool ReadParameters(std::istream& stream) {
+namespace {
+
+// 圧縮していない評価関数パラメータをtargetのslotに読み込む
+// ヘッダのハッシュ値と構造を表す文字列から、組み込んだアーキテクチャを選ぶ
+bool ReadUncompressedParameters(std::istream& stream, NetworkSlot slot, ParameterSet& target) {
   std::uint32_t hash_value;
   std::string architecture;
   if (!ReadHeader(stream, &hash_value, &architecture)) return false;
-  if (hash_value != kHashValue) return false;
-  if (!Detail::ReadParameters(stream, feature_transformer)) return false;
-  if (!Detail::ReadParameters(stream, network)) return false;
-  return stream && stream.peek() == std::ios::traits_type::eof();
+  const int index = FindArchitecture(hash_value, architecture);
+  if (index < 0) return false;
+  target.architecture[slot] = index;
+  return DispatchArchitecture(slot, index, [&](auto evaluator) {
+    return decltype(evaluator)::ReadParameters(stream, target);
+  });
 }
 
-// 評価関数パラメータを書き込む
-bool WriteParameters(std::ostream& stream) {
-  if (!WriteHeader(stream, kHashValue, GetArchitectureString())) return false;
-  if (!Detail::WriteParameters(stream, feature_transformer)) return false;
-  if (!Detail::WriteParameters(stream, network)) return false;
-  return !stream.fail();
+}  // namespace
+
+// 評価関数パラメータをtargetのslotに読み込む
+// 圧縮形式なら、入力特徴量変換器の重みのような大きな読み込みは複数のスレッドで直接復号する
+bool ReadParameters(std::istream& stream, NetworkSlot slot, ParameterSet& target,
+                    int threads, DecompressionStats* stats) {
+  if (!IsCompressed(stream)) return ReadUncompressedParameters(stream, slot, target);
+
+  DecompressingStreamBuf buffer(stream, threads);
+  std::istream decompressed(&buffer);
+  const bool result = ReadUncompressedParameters(decompressed, slot, target) &&
+      !buffer.Failed() && stream.peek() == std::ios::traits_type::eof();
+  if (stats) *stats = buffer.Stats();
+  return result;
 }
 
-// 差分計算ができるなら進める
-static void UpdateAccumulatorIfPossible(const Position& pos) {
-  feature_transformer->UpdateAccumulatorIfPossible(pos);
+// 評価関数パラメータを、探索に用いているもののslotに読み込む
+bool ReadParameters(std::istream& stream, NetworkSlot slot) {
+  return ReadParameters(stream, slot, parameters);
 }
 
-// 評価値を計算する
-static Value ComputeScore(const Position& pos, bool refresh = false) {
-  auto& accumulator = pos.state()->accumulator;
-  if (!refresh && accumulator.computed_score) {
-    return accumulator.score;
+// slotの評価関数パラメータを書き込む
+bool WriteParameters(std::ostream& stream, NetworkSlot slot) {
+  return Dispatch(slot, [&](auto evaluator) {
+    return decltype(evaluator)::WriteParameters(stream);
+  });
+}
+
+// 主の評価関数パラメータを圧縮形式で書き込む
+// 入力特徴量変換器の重みは入力特徴量ごとに出力の数だけ並ぶので、同じ列の1つ前の
+// 入力特徴量の重みとの差分で符号化できるようにする。他はバイト列のまま符号化する
+bool WriteCompressedParameters(std::ostream& stream) {
+  std::ostringstream raw;
+  if (!WriteParameters(raw)) return false;
+  const std::string data = raw.str();
+  return Dispatch([&](auto evaluator) {
+    using E = decltype(evaluator);
+    using FeatureTransformer = typename E::FeatureTransformer;
+    constexpr IndexType kColumns = FeatureTransformer::kOutputDimensions / 2;
+    constexpr std::size_t kWeightsSize =
+        sizeof(typename E::WeightType) * FeatureTransformer::kInputDimensions * kColumns;
+
+    std::ostringstream network;
+    Detail::WriteParameters<typename E::Network>(network, parameters.network[kMainNetwork]);
+    const std::size_t network_size = network.str().size();
+    if (data.size() < kWeightsSize + network_size) return false;
+
+    const std::vector<CompressedSection> sections = {
+      {data.size() - network_size - kWeightsSize, 1, 0},
+      {kWeightsSize, static_cast<int>(sizeof(typename E::WeightType)), kColumns},
+      {network_size, 1, 0},
+    };
+    return WriteCompressed(stream, data, sections);
+  });
+}
+
+namespace {
+
+// 計算用の配置のまま書き出したファイルのヘッダ
+// ファイルにはヘッダ、入力特徴量変換器、ネットワークの順に、それぞれページ境界から並べる
+struct MappedHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t hash_value;
+  std::uint64_t feature_transformer_size;
+  std::uint64_t network_size;
+  // 書き出したときの評価関数ファイルの大きさと更新時刻[ns]
+  std::uint64_t source_size;
+  std::int64_t source_mtime;
+};
+
+constexpr char kMappedMagic[8] = "WeissNN";
+
+// パラメータのメモリ上の配置を変えたら上げる
+constexpr std::uint32_t kMappedVersion = 3;
+
+constexpr std::size_t kPageSize = 4096;
+constexpr std::size_t kMappedFeatureTransformerOffset = kPageSize;
+
+// 大きさがfeature_transformer_size[byte]の入力特徴量変換器に続くネットワークの位置
+constexpr std::size_t MappedNetworkOffset(std::size_t feature_transformer_size) {
+  return kMappedFeatureTransformerOffset +
+      CeilToMultiple(feature_transformer_size, kPageSize);
+}
+
+// 評価関数ファイルの大きさと更新時刻[ns]をヘッダに記録する
+// ファイルが無ければ、代わりに読み込む埋め込みの評価関数の大きさを記録する
+void StampSource(MappedHeader& header, const std::string& source_file_name) {
+  header.source_size = 0;
+  header.source_mtime = 0;
+#if defined(__linux__)
+  struct stat st;
+  if (stat(source_file_name.c_str(), &st) == 0) {
+    header.source_size = st.st_size;
+    header.source_mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return;
+  }
+#else
+  (void)source_file_name;
+#endif
+#if defined(EVAL_EMBEDDED)
+  header.source_size = EmbeddedNetworkEnd - EmbeddedNetwork;
+#endif
+}
+
+// ヘッダが組み込んだアーキテクチャのどれかの、同じ配置のパラメータを表しているか
+// 表していればそのアーキテクチャの番号を、いなければ-1を返す
+int FindMappedArchitecture(const MappedHeader& header, std::size_t file_size) {
+  if (std::memcmp(header.magic, kMappedMagic, sizeof(header.magic)) != 0 ||
+      header.version != kMappedVersion) {
+    return -1;
   }
+  int found = -1;
+  ForEachArchitecture([&](auto evaluator, std::size_t index) {
+    using E = decltype(evaluator);
+    if (header.hash_value == E::kHashValue &&
+        header.feature_transformer_size == sizeof(typename E::FeatureTransformer) &&
+        header.network_size == sizeof(typename E::Network) &&
+        file_size == MappedNetworkOffset(header.feature_transformer_size) +
+                     header.network_size) {
+      found = static_cast<int>(index);
+    }
+  });
+  return found;
+}
 
-  alignas(kCacheLineSize) TransformedFeatureType
-      transformed_features[FeatureTransformer::kBufferSize];
-  feature_transformer->Transform(pos, transformed_features, refresh);
-  alignas(kCacheLineSize) char buffer[Network::kBufferSize];
-  const auto output = network->Propagate(transformed_features, buffer);
+}  // namespace
 
-  // VALUE_MAX_EVALより大きな値が返ってくるとaspiration searchがfail highして
-  // 探索が終わらなくなるのでVALUE_MAX_EVAL以下であることを保証すべき。
+// 評価関数パラメータを計算用の配置のまま書き出す
+bool WriteMappedParameters(const std::string& file_name,
+                           const std::string& source_file_name) {
+  MappedHeader header = {};
+  std::memcpy(header.magic, kMappedMagic, sizeof(header.magic));
+  header.version = kMappedVersion;
+  header.hash_value = Dispatch([](auto evaluator) {
+    return decltype(evaluator)::kHashValue;
+  });
+  header.feature_transformer_size = parameters.feature_transformer[kMainNetwork].get_deleter().size;
+  header.network_size = parameters.network[kMainNetwork].get_deleter().size;
+  StampSource(header, source_file_name);
 
-  // この現象が起きても、対局時に秒固定などだとそこで探索が打ち切られるので、
-  // 1つ前のiterationのときの最善手がbestmoveとして指されるので見かけ上、
-  // 問題ない。このVALUE_MAX_EVALが返ってくるような状況は、ほぼ詰みの局面であり、
-  // そのような詰みの局面が出現するのは終盤で形勢に大差がついていることが多いので
-  // 勝敗にはあまり影響しない。
+  const std::size_t network_offset = MappedNetworkOffset(header.feature_transformer_size);
+  const std::vector<char> padding(kPageSize, 0);
+  std::ofstream stream(file_name, std::ios::binary);
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(padding.data(), kMappedFeatureTransformerOffset - sizeof(header));
+  stream.write(static_cast<const char*>(parameters.feature_transformer[kMainNetwork].get()),
+               header.feature_transformer_size);
+  stream.write(padding.data(), network_offset -
+               kMappedFeatureTransformerOffset - header.feature_transformer_size);
+  stream.write(static_cast<const char*>(parameters.network[kMainNetwork].get()), header.network_size);
+  stream.close();
+  return !stream.fail();
+}
+
+// WriteMappedParameters()で書き出したファイルを読み取り専用でmmapし、
+// targetの主の評価関数のパラメータとしてそのまま使う。
+// ページキャッシュを他のプロセスと共有でき、コピーも要らない
+bool MapParameters(const std::string& file_name, const std::string& source_file_name,
+                   ParameterSet& target) {
+#if defined(__linux__)
+  const int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) return false;
 
-  // しかし、教師生成時などdepth固定で探索するときに探索から戻ってこなくなるので
-  // そのスレッドの計算時間を無駄にする。またdepth固定対局でtime-outするようになる。
+  struct stat st;
+  const std::size_t file_size = fstat(fd, &st) == 0 ? st.st_size : 0;
+  void* map = file_size > kMappedFeatureTransformerOffset
+      ? mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0)
+      : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) return false;
 
-  auto score = static_cast<Value>(output[0] / FV_SCALE);
+  MappedHeader header, source = {};
+  std::memcpy(&header, map, sizeof(header));
+  StampSource(source, source_file_name);
+  const int index = FindMappedArchitecture(header, file_size);
+  if (index < 0 ||
+      header.source_size != source.source_size ||
+      header.source_mtime != source.source_mtime) {
+    munmap(map, file_size);
+    return false;
+  }
 
-  // 1) ここ、下手にclipすると学習時には影響があるような気もするが…。
-  // 2) accumulator.scoreは、差分計算の時に用いないので書き換えて問題ない。
-  score = Math::clamp(score , -VALUE_MAX_EVAL , VALUE_MAX_EVAL);
+  // ヘッダのページはもう使わないので、パラメータの部分だけを残す
+  munmap(map, kMappedFeatureTransformerOffset);
+  char* const base = static_cast<char*>(map);
+  target.architecture[kMainNetwork] = index;
 
-  accumulator.score = score;
-  accumulator.computed_score = true;
-  return accumulator.score;
+  ParametersDeleter feature_transformer_deleter;
+  feature_transformer_deleter.size = header.feature_transformer_size;
+  feature_transformer_deleter.kind = PAGES_MAPPED;
+  target.feature_transformer[kMainNetwork] = ParametersPtr(
+      base + kMappedFeatureTransformerOffset, feature_transformer_deleter);
+
+  ParametersDeleter network_deleter;
+  network_deleter.size = header.network_size;
+  network_deleter.kind = PAGES_MAPPED;
+  target.network[kMainNetwork] = ParametersPtr(
+      base + MappedNetworkOffset(header.feature_transformer_size), network_deleter);
+  return true;
+#else
+  (void)file_name;
+  (void)source_file_name;
+  (void)target;
+  return false;
+#endif
 }
 
 }  // namespace NNUE
 
+// 統計をリセットする
+void reset_eval_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  for (int slot = 0; slot < NNUE::kNetworkSlots; ++slot) {
+    total_stats[slot] = EvalStats();
+    local_stats[slot] = EvalStats();
+  }
+}
+
+// 呼び出したスレッドの統計を全体に加える
+void collect_eval_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  for (int slot = 0; slot < NNUE::kNetworkSlots; ++slot) {
+    total_stats[slot].evaluate_calls += local_stats[slot].evaluate_calls;
+    total_stats[slot].compute_calls += local_stats[slot].compute_calls;
+    total_stats[slot].hash_probes += local_stats[slot].hash_probes;
+    total_stats[slot].hash_hits += local_stats[slot].hash_hits;
+    total_stats[slot].update_calls += local_stats[slot].update_calls;
+    total_stats[slot].update_plies += local_stats[slot].update_plies;
+    total_stats[slot].refresh_calls += local_stats[slot].refresh_calls;
+    local_stats[slot] = EvalStats();
+  }
+}
+
+// 全スレッドの、主の評価関数か小さな評価関数の統計を取得する
+EvalStats eval_stats(bool small) {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  return total_stats[small ? NNUE::kSmallNetwork : NNUE::kMainNetwork];
+}
+
 #if defined(USE_EVAL_HASH)
-// HashTableに評価値を保存するために利用するクラス
-struct alignas(16) ScoreKeyValue {
-#if defined(USE_SSE2)
-  ScoreKeyValue() = default;
-  ScoreKeyValue(const ScoreKeyValue& other) {
-    static_assert(sizeof(ScoreKeyValue) == sizeof(__m128i),
-                  "sizeof(ScoreKeyValue) should be equal to sizeof(__m128i)");
-    _mm_store_si128(&as_m128i, other.as_m128i);
-  }
-  ScoreKeyValue& operator=(const ScoreKeyValue& other) {
-    _mm_store_si128(&as_m128i, other.as_m128i);
-    return *this;
+// evaluate hashのエントリ。
+// 上位32bitに局面のkeyの上位32bit、下位16bitに評価値を詰めて64bitで一度に読み書きするので、
+// 複数スレッドから同時に書き込まれても壊れたエントリを読むことはない。
+// 1つのcache lineに8局面入る。
+typedef std::uint64_t EvalHashEntry;
+
+constexpr std::uint64_t kEvalHashKeyMask = 0xFFFFFFFF00000000ULL;
+
+// 評価関数ごとに局面のkeyに混ぜる値。小さな評価関数の評価値を主の評価関数のものとして引かない
+constexpr Key kEvalHashSlotKeys[NNUE::kNetworkSlots] = {0, 0x9E3779B97F4A7C15ULL};
+
+// 実際に局面のkeyに混ぜる値。評価関数パラメータを差し替えるたびに変える
+// 古いパラメータで計算した評価値を引かなくなるので、差し替えるときにeval hashをクリアしなくてよい
+Key eval_hash_keys[NNUE::kNetworkSlots] = {kEvalHashSlotKeys[0], kEvalHashSlotKeys[1]};
+
+// 実行時に大きさを決めるHashTable。エントリ数は2のべき乗で、0なら使わない。
+struct EvaluateHashTable {
+  EvalHashEntry* operator [] (const Key k) { return entries_ + (static_cast<size_t>(k) & mask_); }
+
+  bool Enabled() const { return entries_ != nullptr; }
+
+  // 大きさをmb[MB]に変更する。2のべき乗に切り下げる。
+  void Resize(size_t mb) {
+    while (mb & (mb - 1)) mb &= mb - 1;
+    if (mb == mb_) return;
+
+    LargePageFree(entries_, mb_ * 1024 * 1024, kind_);
+    entries_ = nullptr;
+    mask_ = 0;
+    mb_ = 0;
+
+    if (mb == 0) {
+      std::cout << "info string EvalHash disabled" << std::endl;
+      return;
+    }
+
+    const size_t size = mb * 1024 * 1024;
+    entries_ = static_cast<EvalHashEntry*>(LargePageAlloc(size, &kind_));
+    if (entries_ == nullptr) {
+      std::cout << "info string can't allocate memory. size = " << size << std::endl;
+      my_exit();
+    }
+    mask_ = size / sizeof(EvalHashEntry) - 1;
+    mb_ = mb;
+    Clear();
+    std::cout << "info string EvalHash " << mb << "MB, " << size / sizeof(EvalHashEntry) << " entries" << std::endl;
+    ReportLargePages("EvalHash", entries_, size, kind_);
+  }
+
+  void Clear() {
+    if (Enabled())
+      std::memset(static_cast<void*>(entries_), 0, mb_ * 1024 * 1024);
   }
+
+ private:
+  EvalHashEntry* entries_ = nullptr;
+  size_t mask_ = 0;
+  size_t mb_ = 0;
+  int kind_ = PAGES_NONE;
+};
+
+// evaluateしたものを保存しておくHashTable(俗にいうehash)
+EvaluateHashTable g_evalTable;
+
+// prefetchする関数も用意しておく。
+void prefetch_evalhash(const Key key) {
+  if (g_evalTable.Enabled())
+    prefetch(g_evalTable[key]);
+}
 #endif
 
-  // evaluate hashでatomicに操作できる必要があるのでそのための操作子
-  void encode() {
-#if defined(USE_SSE2)
-    // ScoreKeyValue は atomic にコピーされるので key が合っていればデータも合っている。
-#else
-    key ^= score;
+namespace {
+
+// kSlotの評価関数について、SIMDの経路で計算した累積値、変換後の入力特徴量、
+// ネットワークの出力がスカラーの経路で一から計算したものと完全に一致するか確かめる
+template <NNUE::NetworkSlot kSlot>
+bool verify_simd_slot(const Position* pos) {
+  return NNUE::Dispatch<kSlot>([pos](auto evaluator) {
+    using namespace NNUE;
+    using E = decltype(evaluator);
+    using FeatureTransformer = typename E::FeatureTransformer;
+    using Network = typename E::Network;
+    const auto ft = E::CurrentFeatureTransformer();
+    const auto net = E::CurrentNetwork();
+
+    alignas(kCacheLineSize) TransformedFeatureType
+        features[FeatureTransformer::kBufferSize];
+    alignas(kCacheLineSize) TransformedFeatureType
+        reference_features[FeatureTransformer::kBufferSize];
+    auto reference_accumulator = std::make_unique<Accumulator>();
+
+    // 累積値は読み込んだアーキテクチャが使う先頭の部分だけを比べる
+    ft->Transform(*pos, kSlot, features, false, E::CurrentRefreshCache());
+    ft->TransformReference(*pos, reference_features, reference_accumulator.get());
+    if (std::memcmp(pos->state()->accumulators[kSlot].accumulation,
+                    reference_accumulator->accumulation,
+                    FeatureTransformer::kAccumulationSize * sizeof(std::int16_t)) != 0 ||
+        std::memcmp(features, reference_features, sizeof(features)) != 0) {
+      return false;
+    }
+
+    alignas(kCacheLineSize) char buffer[Network::kBufferSize];
+    alignas(kCacheLineSize) char reference_buffer[Network::kBufferSize];
+    const auto output = net->Propagate(features, buffer);
+    const auto reference_output = net->PropagateReference(features, reference_buffer);
+    return std::memcmp(output, reference_output,
+                       Network::kOutputDimensions * sizeof(*output)) == 0;
+  });
+}
+
+}  // namespace
+
+// 読み込んだどの評価関数でも、SIMDの経路の計算結果がスカラーの経路のものと一致するか確かめる
+bool verify_simd(const Position* pos) {
+  return verify_simd_slot<NNUE::kMainNetwork>(pos) &&
+      (!NNUE::parameters.feature_transformer[NNUE::kSmallNetwork] ||
+       verify_simd_slot<NNUE::kSmallNetwork>(pos));
+}
+
+namespace {
+
+// メモリ上のバイト列を、コピーせずにそのままistreamとして読むためのバッファ
+struct MemoryStreamBuf : public std::streambuf {
+  MemoryStreamBuf(const char* data, std::size_t size) {
+    char* begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+  }
+
+  // 圧縮形式か調べた後に読み込み位置を戻せるようにする
+  pos_type seekoff(off_type offset, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override {
+    char* const base = dir == std::ios_base::beg ? eback()
+                     : dir == std::ios_base::cur ? gptr() : egptr();
+    if (!(which & std::ios_base::in) || offset < eback() - base || offset > egptr() - base)
+      return pos_type(off_type(-1));
+    setg(eback(), base + offset, egptr());
+    return pos_type(gptr() - eback());
+  }
+
+  pos_type seekpos(pos_type position, std::ios_base::openmode which) override {
+    return seekoff(off_type(position), std::ios_base::beg, which);
+  }
+};
+
+// dir_nameに評価関数ファイルがあればそれを、無ければ埋め込みの評価関数を開いてfに渡す
+// EvalDirは埋め込みの評価関数を上書きするためだけに使う
+template <typename Function>
+auto with_eval_source(const std::string& dir_name, Function f) {
+  const std::string file_name = Path::Combine(dir_name, NNUE::kFileName);
+  std::ifstream file(file_name, std::ios::binary);
+#if defined(EVAL_EMBEDDED)
+  if (!file)
+  {
+    MemoryStreamBuf buffer(EmbeddedNetwork, EmbeddedNetworkEnd - EmbeddedNetwork);
+    std::istream stream(&buffer);
+    return f(stream, std::string("embedded network"));
+  }
 #endif
+  return f(file, file_name);
+}
+
+}  // namespace
+
+// 読み込んだパラメータを書き出し、評価関数ファイルと同じ内容になるか確かめる
+// 重みは計算用の配置に並べ替えて持っているので、元の配置に戻せることを見る
+bool verify_parameters() {
+  std::ostringstream original, written;
+  with_eval_source(EvalDir, [&](std::istream& stream, const std::string&) {
+    // 圧縮形式なら、元の評価関数ファイルに戻したものと比べる
+    if (NNUE::IsCompressed(stream)) {
+      NNUE::DecompressingStreamBuf buffer(stream);
+      original << &buffer;
+    } else {
+      original << stream.rdbuf();
+    }
+  });
+  return NNUE::WriteParameters(written) && written.str() == original.str();
+}
+
+// 直前の局面からの差分計算をrepetitions回繰り返し、かかった時間[ns]を返す
+std::uint64_t time_update(const Position* pos, int repetitions) {
+  return NNUE::Dispatch([=](auto evaluator) {
+    using E = decltype(evaluator);
+    const auto ft = E::CurrentFeatureTransformer();
+    const auto cache = E::CurrentRefreshCache();
+    auto& accumulator = pos->state()->accumulators[NNUE::kMainNetwork];
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+      accumulator.computed_accumulation = false;
+      ft->UpdateAccumulatorIfPossible(*pos, NNUE::kMainNetwork, cache);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  });
+}
+
+// ベンチマークの局面で測った、最初の層の入力のうち0でない4バイトの塊の割合を返す
+double input_density(bool* sparse) {
+  const double density = NNUE::Dispatch([](auto evaluator) {
+    return decltype(evaluator)::InputDensity(NNUE::parameters);
+  });
+  *sparse = density <= NNUE::kSparseInputDensity;
+  return density;
+}
+
+// 累積値が計算済みの局面でネットワークの計算をrepetitions回繰り返し、かかった時間[ns]を返す
+std::uint64_t time_evaluate(const Position* pos, int repetitions) {
+  return NNUE::Dispatch([=](auto evaluator) {
+    auto& accumulator = pos->state()->accumulators[NNUE::kMainNetwork];
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+      accumulator.computed_score = false;
+      decltype(evaluator)::ComputeScore(*pos);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  });
+}
+
+// 差分計算もキャッシュも用いずに累積値を全計算することをrepetitions回繰り返し、かかった時間[ns]を返す
+std::uint64_t time_refresh(const Position* pos, int repetitions) {
+  return NNUE::Dispatch([=](auto evaluator) {
+    const auto ft = decltype(evaluator)::CurrentFeatureTransformer();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+      ft->Refresh(*pos, NNUE::kMainNetwork);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  });
+}
+
+// 累積値が計算済みの局面で入力特徴量の変換だけをrepetitions回繰り返し、かかった時間[ns]を返す
+std::uint64_t time_transform(const Position* pos, int repetitions) {
+  return NNUE::Dispatch([=](auto evaluator) {
+    using E = decltype(evaluator);
+    const auto ft = E::CurrentFeatureTransformer();
+    alignas(NNUE::kCacheLineSize) NNUE::TransformedFeatureType
+        features[E::FeatureTransformer::kBufferSize];
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+      ft->Transform(*pos, NNUE::kMainNetwork, features, false);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  });
+}
+
+// 累積値が計算済みの局面で、変換後の入力特徴量をネットワークに通すことだけを
+// repetitions回繰り返し、かかった時間[ns]を返す
+std::uint64_t time_propagate(const Position* pos, int repetitions) {
+  return NNUE::Dispatch([=](auto evaluator) {
+    using E = decltype(evaluator);
+    const auto net = E::CurrentNetwork();
+    alignas(NNUE::kCacheLineSize) NNUE::TransformedFeatureType
+        features[E::FeatureTransformer::kBufferSize];
+    alignas(NNUE::kCacheLineSize) char buffer[E::Network::kBufferSize];
+    E::CurrentFeatureTransformer()->Transform(*pos, NNUE::kMainNetwork, features, false);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+      net->Propagate(features, buffer);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  });
+}
+
+// 直前の局面からの差分計算を含めてevaluate()をrepetitions回繰り返し、かかった時間[ns]を返す
+// use_hashがfalseならeval hashを引かずに計算する
+std::uint64_t time_evaluate_full(const Position* pos, int repetitions, bool use_hash) {
+  auto& accumulator = pos->state()->accumulators[NNUE::kMainNetwork];
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    accumulator.computed_accumulation = false;
+    accumulator.computed_score = false;
+    if (use_hash) {
+      evaluate(pos);
+    } else {
+      NNUE::Dispatch([pos](auto evaluator) {
+        return decltype(evaluator)::ComputeScore(*pos);
+      });
+    }
   }
-  // decode()はencode()の逆変換だが、xorなので逆変換も同じ変換。
-  void decode() { encode(); }
+  const auto end = std::chrono::steady_clock::now();
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
 
-  union {
-    struct {
-      std::uint64_t key;
-      std::uint64_t score;
-    };
-#if defined(USE_SSE2)
-    __m128i as_m128i;
+// count局面をbatch_size局面ずつまとめて評価することをrepetitions回繰り返し、かかった時間[ns]を返す
+std::uint64_t time_evaluate_batch(const Position* const* positions, int count,
+                                  int batch_size, int repetitions) {
+  std::vector<Value> values(count);
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    for (int begin = 0; begin < count; begin += batch_size) {
+      evaluate_batch(&positions[begin], std::min(batch_size, count - begin), &values[begin]);
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// 指し手を指した直後に、評価で使うメモリを先読みしておく
+// 小さな評価関数を読み込んでいれば、その分も先読みする
+void prefetch_evaluation(const Position* pos) {
+#if !defined(NO_PREFETCH)
+#if defined(USE_EVAL_HASH)
+  prefetch_evalhash(pos->get_key() ^ eval_hash_keys[NNUE::kMainNetwork]);
 #endif
-  };
+  NNUE::Dispatch([pos](auto evaluator) {
+    decltype(evaluator)::CurrentFeatureTransformer()->PrefetchUpdate(*pos, NNUE::kMainNetwork);
+  });
+  if (NNUE::parameters.feature_transformer[NNUE::kSmallNetwork]) {
+#if defined(USE_EVAL_HASH)
+    prefetch_evalhash(pos->get_key() ^ eval_hash_keys[NNUE::kSmallNetwork]);
+#endif
+    NNUE::Dispatch<NNUE::kSmallNetwork>([pos](auto evaluator) {
+      decltype(evaluator)::CurrentFeatureTransformer()->PrefetchUpdate(*pos, NNUE::kSmallNetwork);
+    });
+  }
+#else
+  (void)pos;
+#endif
+}
+
+// eval hashの大きさを変更する
+void resize_eval_hash(size_t mb) {
+#if defined(USE_EVAL_HASH)
+  g_evalTable.Resize(mb);
+#else
+  (void)mb;
+#endif
+}
+
+// eval hashをクリアする
+void clear_eval_hash() {
+#if defined(USE_EVAL_HASH)
+  g_evalTable.Clear();
+#endif
+}
+
+namespace {
+
+// 裏のスレッドで読み込んだ評価関数パラメータ
+struct PendingParameters {
+  NNUE::ParameterSet parameters;
+
+  // NUMAノード毎の複製。replica_countが0なら作っていない
+  NNUE::ParameterSet replicas[MAX_NUMA_NODES];
+  int replica_count = 0;
+
+  // 主の評価関数を読み込めたか
+  bool loaded = false;
+
+  // 読み込み中のメッセージ。探索中に出力しないよう、差し替えるときにまとめて出力する
+  std::string log;
 };
 
-// シンプルなHashTableの実装。
-// Sizeは2のべき乗。
-template <typename T, size_t Size>
-struct HashTable {
-  HashTable() : entries_{} {}
-  T* operator [] (const Key k) { return entries_ + (static_cast<size_t>(k) & (Size - 1)); }
+// 裏で読み込み終えて、まだ差し替えていない評価関数パラメータ
+std::atomic<PendingParameters*> pending_parameters{nullptr};
 
-  // Size が 2のべき乗であることのチェック
-  static_assert((Size & (Size - 1)) == 0, "");
+// 読み込みを始めた回数。読み込み中に次の読み込みが始まれば、古い方の結果は捨てる
+std::uint32_t load_generation = 0;
+std::mutex load_mutex;
 
- private:
-  T entries_[Size];
+// 探索中のスレッド数。0でなければ評価関数パラメータを差し替えない
+std::atomic<int> searching_threads{0};
+
+// 裏のスレッドに渡す、読み込みを始めたときのオプション
+struct LoadRequest {
+  std::string dir_name;
+  bool map;
+  bool small;
+  std::uint32_t generation;
 };
 
-// evaluateしたものを保存しておくHashTable(俗にいうehash)
+// dir_nameの評価関数ファイルをtargetの主の評価関数に読み込む。読み込めなければfalseを返す
+// mapが真なら、計算用の配置のまま書き出したファイルがあれば読み込まずにmmapして使う
+bool load_main_parameters(NNUE::ParameterSet& target, const std::string& dir_name,
+                          bool map, std::ostream& log) {
+  if (map) {
+    const std::string mapped_file_name = Path::Combine(dir_name, NNUE::kMappedFileName);
+    const std::string source_file_name = Path::Combine(dir_name, NNUE::kFileName);
+    if (NNUE::MapParameters(mapped_file_name, source_file_name, target)) {
+      log << "info string mapped " << mapped_file_name << std::endl;
+      return true;
+    }
+    log << "info string failed to map " << mapped_file_name << std::endl;
+  }
 
-#if !defined(USE_LARGE_EVAL_HASH)
-// 134MB(魔女のAVX2以外の時の設定)
-struct EvaluateHashTable : HashTable<ScoreKeyValue, 0x800000> {};
-#else
-// prefetch有りなら大きいほうが良いのでは…。
-// →　あまり変わらないし、メモリもったいないのでデフォルトでは↑の設定で良いか…。
-// 1GB(魔女のAVX2の時の設定)
-struct EvaluateHashTable : HashTable<ScoreKeyValue, 0x4000000> {};
-#endif
+  // 読み込む評価関数のアーキテクチャが決まってから確保する
+  return with_eval_source(dir_name, [&](std::istream& stream, const std::string& file_name) {
+    log << "info string loading " << file_name << std::endl;
+    if (NNUE::ReadParameters(stream, NNUE::kMainNetwork, target)) return true;
+    log << "info string failed to load " << file_name << std::endl;
+    return false;
+  });
+}
 
-EvaluateHashTable g_evalTable;
+// dir_nameの小さな評価関数ファイルをtargetに読み込む
+// 読み込めなければ主の評価関数だけで探索を続ける
+void load_small_parameters(NNUE::ParameterSet& target, const std::string& dir_name,
+                           std::ostream& log) {
+  const std::string file_name = Path::Combine(dir_name, NNUE::kSmallFileName);
+  std::ifstream stream(file_name, std::ios::binary);
+  if (!NNUE::ReadParameters(stream, NNUE::kSmallNetwork, target)) {
+    target.feature_transformer[NNUE::kSmallNetwork].reset();
+    target.network[NNUE::kSmallNetwork].reset();
+    target.architecture[NNUE::kSmallNetwork] = 0;
+    log << "info string failed to load " << file_name
+        << ", using the main network only" << std::endl;
+    return;
+  }
+  log << "info string loaded small network " << file_name << std::endl;
+}
 
-// prefetchする関数も用意しておく。
-void prefetch_evalhash(const Key key) {
-  constexpr auto mask = ~((uint64_t)0x1f);
-  prefetch((void*)((uint64_t)g_evalTable[key] & mask));
+// 探索に用いている評価関数の構造と、ラージページに置けたかを出力する
+void report_parameters() {
+  const auto& parameters = NNUE::parameters;
+  std::cout << "info string network architecture "
+            << NNUE::GetArchitectureString() << std::endl;
+  ReportLargePages("FeatureTransformer", parameters.feature_transformer[NNUE::kMainNetwork].get(),
+                   parameters.feature_transformer[NNUE::kMainNetwork].get_deleter().size,
+                   parameters.feature_transformer[NNUE::kMainNetwork].get_deleter().kind);
+  ReportLargePages("Network", parameters.network[NNUE::kMainNetwork].get(),
+                   parameters.network[NNUE::kMainNetwork].get_deleter().size,
+                   parameters.network[NNUE::kMainNetwork].get_deleter().kind);
+
+  if (!parameters.feature_transformer[NNUE::kSmallNetwork])
+    return;
+
+  std::cout << "info string small network architecture "
+            << NNUE::GetArchitectureString(NNUE::kSmallNetwork) << std::endl;
+  ReportLargePages("SmallFeatureTransformer", parameters.feature_transformer[NNUE::kSmallNetwork].get(),
+                   parameters.feature_transformer[NNUE::kSmallNetwork].get_deleter().size,
+                   parameters.feature_transformer[NNUE::kSmallNetwork].get_deleter().kind);
 }
+
+// loadedを探索に用いるものと入れ替える。古いパラメータはloadedに残る
+void install_parameters(NNUE::ParameterSet& loaded) {
+  std::swap(NNUE::parameters, loaded);
+
+  // 古いパラメータで計算したキャッシュとeval hashのエントリを使わないようにする
+  ++NNUE::parameters_version;
+#if defined(USE_EVAL_HASH)
+  for (int slot = 0; slot < NNUE::kNetworkSlots; ++slot)
+    eval_hash_keys[slot] = kEvalHashSlotKeys[slot] ^ (NNUE::parameters_version * 0x9FB21C651E98DF25ULL);
 #endif
 
+  report_parameters();
+}
+
+// 裏のスレッドで評価関数ファイルを新しい領域に読み込み、NUMAノード毎の複製も作る
+// 探索に用いているパラメータには触らない
+void* load_eval_in_background(void* arg) {
+  std::unique_ptr<LoadRequest> request(static_cast<LoadRequest*>(arg));
+  std::unique_ptr<PendingParameters> pending(new PendingParameters);
+
+  std::ostringstream log;
+  pending->loaded = load_main_parameters(pending->parameters, request->dir_name, request->map, log);
+  if (pending->loaded)
+  {
+    if (request->small)
+      load_small_parameters(pending->parameters, request->dir_name, log);
+    pending->replica_count = NNUE::CreateReplicas(pending->parameters, pending->replicas);
+  }
+  pending->log = log.str();
+
+  // 差し替えられる前に次の読み込み結果が来れば、古い方を捨てる
+  std::lock_guard<std::mutex> lock(load_mutex);
+  if (request->generation == load_generation)
+    delete pending_parameters.exchange(pending.release());
+  return nullptr;
+}
+
+}  // namespace
+
 // 評価関数ファイルを読み込む
 // benchコマンドなどでOptionsを保存して復元するのでこのときEvalDirが変更されたことになって、
 // 評価関数の再読込の必要があるというフラグを立てるため、この関数は2度呼び出されることがある。
 void load_eval() {
-  NNUE::Initialize();
+  // 裏で読み込んでいるものがあれば、もう使わない
+  {
+    std::lock_guard<std::mutex> lock(load_mutex);
+    ++load_generation;
+    delete pending_parameters.exchange(nullptr);
+  }
 
-  if (!SkipLoadingEval)
+  NNUE::ParameterSet loaded;
+  if (SkipLoadingEval)
+    NNUE::Initialize(loaded);
+  else
   {
     const std::string dir_name = EvalDir;
-    const std::string file_name = Path::Combine(dir_name, NNUE::kFileName);
 
-    std::cout << "info string loading " << file_name << std::endl;
+    // 読み込みエラーのとき終了してくれないと困る。
+    if (!load_main_parameters(loaded, dir_name, EvalMap, std::cout))
+      my_exit();
+
+    if (EvalSmallNet)
+      load_small_parameters(loaded, dir_name, std::cout);
+  }
+
+  install_parameters(loaded);
+
+  create_replicas();
+}
+
+// 評価関数ファイルを裏のスレッドで読み込み始める
+// まだ何も読み込んでいなければ、探索に用いるものが無いのでload_eval()で読み込み終えるまで待つ
+void load_eval_async() {
+  if (SkipLoadingEval || !NNUE::parameters.feature_transformer[NNUE::kMainNetwork])
+  {
+    load_eval();
+    return;
+  }
+
+  LoadRequest* request = new LoadRequest{EvalDir, EvalMap, EvalSmallNet, 0};
+  {
+    std::lock_guard<std::mutex> lock(load_mutex);
+    request->generation = ++load_generation;
+  }
+
+  std::cout << "info string loading network in the background" << std::endl;
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, load_eval_in_background, request);
+  pthread_detach(thread);
+}
+
+// 裏で読み込み終えた評価関数パラメータがあり、探索中のスレッドがいなければ差し替える
+bool swap_eval() {
+  // 探索中のスレッドが古いパラメータを参照しているうちは差し替えない
+  if (searching_threads.load() > 0)
+    return false;
 
-    std::ifstream stream(file_name, std::ios::binary);
-    const bool result = NNUE::ReadParameters(stream);
+  std::unique_ptr<PendingParameters> pending(pending_parameters.exchange(nullptr));
+  if (!pending)
+    return false;
 
-	if (!result)
-	{
-		// 読み込みエラーのとき終了してくれないと困る。
-		std::cout << "info string failed to load " << file_name << std::endl;
-		my_exit();
-	}
+  std::cout << pending->log;
+  if (!pending->loaded)
+  {
+    std::cout << "info string keeping the current network" << std::endl;
+    return false;
+  }
+
+  install_parameters(pending->parameters);
+  std::swap(NNUE::replicas, pending->replicas);
+  std::swap(NNUE::replica_count, pending->replica_count);
+
+  // 読み込み中にNUMAの設定が変わっていれば複製を作り直す
+  const int nodes = NumaEnabled && NumaNodes() >= 2 ? NumaNodes() : 0;
+  if (NNUE::replica_count != nodes)
+    create_replicas();
+  else if (NNUE::replica_count)
+    std::cout << "info string network replicated on " << NNUE::replica_count << " NUMA nodes" << std::endl;
+
+  // 古いパラメータと複製はpendingと共にここで解放する。探索中のスレッドはいないので誰も参照していない
+  return true;
+}
+
+// 探索するスレッドが探索を始める
+void enter_search() {
+  ++searching_threads;
+}
+
+// 探索するスレッドが探索を終える
+void leave_search() {
+  --searching_threads;
+}
+// 読み込んだ評価関数パラメータを、計算用の配置のままEvalDirに書き出す
+bool save_eval_map() {
+  const std::string dir_name = EvalDir;
+  return NNUE::WriteMappedParameters(Path::Combine(dir_name, NNUE::kMappedFileName),
+                                     Path::Combine(dir_name, NNUE::kFileName));
+}
+
+// NUMAノード毎に評価関数パラメータの複製を作る
+void create_replicas() {
+  for (int node = 0; node < NNUE::replica_count; ++node)
+    NNUE::replicas[node] = NNUE::ParameterSet();
+  NNUE::replica_count = NNUE::CreateReplicas(NNUE::parameters, NNUE::replicas);
+
+  if (NNUE::replica_count)
+    std::cout << "info string network replicated on " << NNUE::replica_count << " NUMA nodes" << std::endl;
+}
+// 呼び出したスレッドが評価に用いるパラメータを切り替える
+void bind_replica(int node) {
+  const bool replicated = node < NNUE::replica_count;
+  for (int slot = 0; slot < NNUE::kNetworkSlots; ++slot)
+  {
+    NNUE::local_feature_transformer[slot] = replicated ? NNUE::replicas[node].feature_transformer[slot].get() : nullptr;
+    NNUE::local_network[slot] = replicated ? NNUE::replicas[node].network[slot].get() : nullptr;
   }
 }
 
@@ -262,13 +1377,131 @@ void init() {
 // 手番側から見た評価値を返すので注意。(他の評価関数とは設計がこの点において異なる)
 // なので、この関数の最適化は頑張らない。
 Value compute_eval(const Position& pos) {
-  return NNUE::ComputeScore(pos, true);
+  return NNUE::Dispatch([&](auto evaluator) {
+    return decltype(evaluator)::ComputeScore(pos, true);
+  });
 }
 
-// 評価関数
-Value evaluate(const Position *pos) {
+// 読み込んだ評価関数の入力特徴量変換器の重みを8bitに量子化し、評価関数ファイルとしてfile_nameに書き出す
+// 量子化の前後で各局面を全計算した評価値をbefore, afterに書き込む
+bool quantize_eval(const char* file_name, const Position* const* positions,
+                   int count, Value* before, Value* after) {
+  NNUE::ParametersPtr quantized;
+  const int index = NNUE::QuantizeFeatureTransformer(quantized);
+  if (index < 0) return false;
 
-  const auto& accumulator = pos->state()->accumulator;
+  for (int i = 0; i < count; ++i) {
+    before[i] = compute_eval(*positions[i]);
+  }
+
+  // 量子化したものに一時的に差し替える。ネットワークはそのまま使う
+  const std::size_t source_architecture = NNUE::parameters.architecture[NNUE::kMainNetwork];
+  std::swap(NNUE::parameters.feature_transformer[NNUE::kMainNetwork], quantized);
+  NNUE::parameters.architecture[NNUE::kMainNetwork] = index;
+  ++NNUE::parameters_version;
+
+  std::ofstream stream(file_name, std::ios::binary);
+  bool result = NNUE::WriteParameters(stream);
+  stream.close();
+  result = result && !stream.fail();
+
+  for (int i = 0; i < count; ++i) {
+    after[i] = compute_eval(*positions[i]);
+  }
+
+  std::swap(NNUE::parameters.feature_transformer[NNUE::kMainNetwork], quantized);
+  NNUE::parameters.architecture[NNUE::kMainNetwork] = source_architecture;
+  ++NNUE::parameters_version;
+
+  // 量子化したもので計算した累積値を残さない
+  for (int i = 0; i < count; ++i) {
+    auto& accumulator = positions[i]->state()->accumulators[NNUE::kMainNetwork];
+    accumulator.computed_accumulation = false;
+    accumulator.computed_score = false;
+  }
+  return result;
+}
+
+// 読み込んだ評価関数を圧縮形式でfile_nameに、比べるために元の形式でraw_file_nameに書き出す
+bool compress_eval(const char* file_name, const char* raw_file_name) {
+  std::ofstream stream(file_name, std::ios::binary);
+  bool result = NNUE::WriteCompressedParameters(stream);
+  stream.close();
+  std::ofstream raw_stream(raw_file_name, std::ios::binary);
+  result = NNUE::WriteParameters(raw_stream) && result;
+  raw_stream.close();
+  return result && !stream.fail() && !raw_stream.fail();
+}
+
+namespace {
+
+// 読み込んだパラメータが、探索に用いている主の評価関数のものと同じか
+bool same_parameters(const NNUE::ParameterSet& loaded) {
+  const auto same = [](const NNUE::ParametersPtr& a, const NNUE::ParametersPtr& b) {
+    return a && b && a.get_deleter().size == b.get_deleter().size &&
+        std::memcmp(a.get(), b.get(), a.get_deleter().size) == 0;
+  };
+  const auto& parameters = NNUE::parameters;
+  return loaded.architecture[NNUE::kMainNetwork] == parameters.architecture[NNUE::kMainNetwork] &&
+      same(loaded.feature_transformer[NNUE::kMainNetwork], parameters.feature_transformer[NNUE::kMainNetwork]) &&
+      same(loaded.network[NNUE::kMainNetwork], parameters.network[NNUE::kMainNetwork]);
+}
+
+}  // namespace
+
+// file_nameの評価関数を読み込むのにかかる時間の内訳を、repetitions回のうち最も速いもので求める
+// 圧縮形式はthreads個のスレッドで復号する。読み込んだパラメータが今のものと違えばfalseを返す
+bool time_load_eval(const char* file_name, int threads, int repetitions, LoadTimes* times) {
+  const auto elapsed = [](std::chrono::steady_clock::time_point start) {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+  };
+  const auto keep_min = [](std::uint64_t& best, std::uint64_t value, bool first) {
+    best = first ? value : std::min(best, value);
+  };
+
+  bool result = true;
+  for (int i = 0; i < repetitions && result; ++i) {
+    // ファイルをメモリに読み込むだけ
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+    std::string data(file ? static_cast<std::size_t>(file.tellg()) : 0, '\0');
+    file.seekg(0);
+    file.read(&data[0], data.size());
+    keep_min(times->read_ns, elapsed(start), i == 0);
+    if (!file || data.empty()) return false;
+    times->bytes = data.size();
+
+    // メモリ上のファイルからパラメータを読み込むだけ。圧縮形式なら復号も含む
+    NNUE::ParameterSet parsed;
+    NNUE::DecompressionStats stats;
+    MemoryStreamBuf buffer(data.data(), data.size());
+    std::istream stream(&buffer);
+    start = std::chrono::steady_clock::now();
+    result = NNUE::ReadParameters(stream, NNUE::kMainNetwork, parsed, threads, &stats);
+    keep_min(times->parse_ns, elapsed(start), i == 0);
+    keep_min(times->decode_ns, stats.decode_ns, i == 0);
+    result = result && same_parameters(parsed);
+
+    // 実際に評価関数を読み込むときと同じく、ファイルから直接読み込む
+    NNUE::ParameterSet loaded;
+    start = std::chrono::steady_clock::now();
+    std::ifstream direct(file_name, std::ios::binary);
+    result = NNUE::ReadParameters(direct, NNUE::kMainNetwork, loaded, threads) && result;
+    keep_min(times->load_ns, elapsed(start), i == 0);
+  }
+  return result;
+}
+
+namespace {
+
+// kSlotの評価関数で評価する
+template <NNUE::NetworkSlot kSlot>
+Value evaluate_slot(const Position *pos) {
+
+  ++local_stats[kSlot].evaluate_calls;
+
+  const auto& accumulator = pos->state()->accumulators[kSlot];
   if (accumulator.computed_score) {
     return accumulator.score;
   }
@@ -278,36 +1511,91 @@ Value evaluate(const Position *pos) {
   // eval hashへの照会をskipする。
   if (!GlobalOptions.use_eval_hash) {
     ASSERT_LV5(pos.state()->materialValue == Eval::material(pos));
-    return NNUE::ComputeScore(pos);
+    return NNUE::Dispatch<kSlot>([&](auto evaluator) {
+      return decltype(evaluator)::ComputeScore(*pos);
+    });
   }
 #endif
 
 #if defined(USE_EVAL_HASH)
   // evaluate hash tableにはあるかも。
-  const Key key = pos->get_key();
-  ScoreKeyValue entry = *g_evalTable[key];
-  entry.decode();
-  if (entry.key == key) {
-    // あった！
-    return Value(entry.score);
+  const Key key = pos->get_key() ^ eval_hash_keys[kSlot];
+  EvalHashEntry* slot = nullptr;
+  if (g_evalTable.Enabled()) {
+    ++local_stats[kSlot].hash_probes;
+    slot = g_evalTable[key];
+    const EvalHashEntry entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (((entry ^ key) & kEvalHashKeyMask) == 0) {
+      // あった！
+      ++local_stats[kSlot].hash_hits;
+      return Value(static_cast<std::int16_t>(entry));
+    }
   }
 #endif
 
-  Value score = NNUE::ComputeScore(*pos);
+  // 読み込んだアーキテクチャの計算を選ぶのは、局面ごとにここで一度だけ
+  Value score = NNUE::Dispatch<kSlot>([pos](auto evaluator) {
+    return decltype(evaluator)::ComputeScore(*pos);
+  });
 #if defined(USE_EVAL_HASH)
   // せっかく計算したのでevaluate hash tableに保存しておく。
-  entry.key = key;
-  entry.score = score;
-  entry.encode();
-  *g_evalTable[key] = entry;
+  if (slot != nullptr) {
+    const EvalHashEntry entry = (key & kEvalHashKeyMask) | static_cast<std::uint16_t>(score);
+    __atomic_store_n(slot, entry, __ATOMIC_RELAXED);
+  }
 #endif
 
   return score;
 }
 
+}  // namespace
+
+// 評価関数
+Value evaluate(const Position *pos) {
+  return evaluate_slot<NNUE::kMainNetwork>(pos);
+}
+
+// 小さな評価関数を読み込んでいるか
+bool small_network_loaded() {
+  return NNUE::parameters.feature_transformer[NNUE::kSmallNetwork] != nullptr;
+}
+
+// 主の評価関数のパラメータの領域全体から取ったFNV-1aのハッシュ値を返す
+// 領域は0で初期化してから読み込むので、同じ評価関数なら読み込み方によらず同じ値になる
+std::uint64_t network_id() {
+  std::uint64_t hash = 14695981039346656037ULL;
+  const auto mix = [&](const NNUE::ParametersPtr& block) {
+    const auto bytes = static_cast<const unsigned char*>(block.get());
+    for (std::size_t i = 0; i < block.get_deleter().size; ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+  };
+  mix(NNUE::parameters.feature_transformer[NNUE::kMainNetwork]);
+  mix(NNUE::parameters.network[NNUE::kMainNetwork]);
+  return hash;
+}
+
+// 小さな評価関数を読み込んでいればそれで評価する。いなければevaluate()と同じ
+Value evaluate_fast(const Position *pos) {
+  if (!small_network_loaded()) {
+    return evaluate(pos);
+  }
+  return evaluate_slot<NNUE::kSmallNetwork>(pos);
+}
+
+// 複数の局面をまとめて評価する。eval hashは使わない
+void evaluate_batch(const Position* const* positions, int count, Value* values) {
+  local_stats[NNUE::kMainNetwork].evaluate_calls += count;
+  NNUE::Dispatch([=](auto evaluator) {
+    decltype(evaluator)::ComputeScores(positions, count, values);
+  });
+}
+
 // 差分計算ができるなら進める
 void evaluate_with_no_return(const Position& pos) {
-  NNUE::UpdateAccumulatorIfPossible(pos);
+  NNUE::Dispatch([&](auto evaluator) {
+    decltype(evaluator)::UpdateAccumulatorIfPossible(pos);
+  });
 }
 
 // 現在の局面の評価値の内訳を表示する
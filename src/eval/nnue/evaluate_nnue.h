@@ -7,6 +7,8 @@
 
 #include "nnue_feature_transformer.h"
 #include "nnue_architecture.h"
+#include "nnue_compression.h"
+#include "../../largepage.h"
 
 #include <memory>
 
@@ -15,8 +17,10 @@ namespace Eval {
 namespace NNUE {
 
 // 評価関数の構造のハッシュ値
+template <typename Architecture>
 constexpr std::uint32_t kHashValue =
-    FeatureTransformer::GetHashValue() ^ Network::GetHashValue();
+    FeatureTransformer<Architecture>::GetHashValue() ^
+    Architecture::Network::GetHashValue();
 
 // メモリ領域の解放を自動化するためのデリータ
 template <typename T>
@@ -29,17 +33,64 @@ struct AlignedDeleter {
 template <typename T>
 using AlignedPtr = std::unique_ptr<T, AlignedDeleter<T>>;
 
-// 入力特徴量変換器
-extern AlignedPtr<FeatureTransformer> feature_transformer;
+// ラージページで確保した領域の解放を自動化するためのデリータ
+template <typename T>
+struct LargePageDeleter {
+  int kind = PAGES_NONE;
+  void operator()(T* ptr) const {
+    ptr->~T();
+    LargePageFree(ptr, sizeof(T), kind);
+  }
+};
+template <typename T>
+using LargePagePtr = std::unique_ptr<T, LargePageDeleter<T>>;
+
+// 型を消したパラメータの領域の解放を自動化するためのデリータ
+// アーキテクチャによって型も大きさも変わるので、大きさも一緒に持つ
+struct ParametersDeleter {
+  std::size_t size = 0;
+  int kind = PAGES_NONE;
+  void operator()(void* ptr) const {
+    LargePageFree(ptr, size, kind);
+  }
+};
+using ParametersPtr = std::unique_ptr<void, ParametersDeleter>;
+
+// 評価関数パラメータ一式
+// 裏で新しい領域に読み込んでから、探索していないときに探索に用いるものと入れ替える
+struct ParameterSet {
+  // 読み込んだ評価関数のアーキテクチャの、AllArchitecturesでの番号
+  std::size_t architecture[kNetworkSlots] = {};
+
+  // 入力特徴量変換器。FeatureTransformer<読み込んだアーキテクチャ>
+  // 小さな評価関数を読み込んでいなければ、そのslotはnullptrのまま
+  ParametersPtr feature_transformer[kNetworkSlots];
+
+  // 評価関数。読み込んだアーキテクチャのNetwork
+  ParametersPtr network[kNetworkSlots];
+};
 
-// 評価関数
-extern AlignedPtr<Network> network;
+// 探索に用いている評価関数パラメータ
+extern ParameterSet parameters;
 
 // 評価関数ファイル名
 extern const char* const kFileName;
 
-// 評価関数の構造を表す文字列を取得する
-std::string GetArchitectureString();
+// 小さな評価関数のファイル名
+extern const char* const kSmallFileName;
+
+// まとめて評価する局面数の上限。これより多ければ分けて計算する
+constexpr int kMaxBatchSize = 64;
+
+// 計算用の配置のまま書き出した評価関数ファイル名
+extern const char* const kMappedFileName;
+
+// slotの評価関数の構造を表す文字列を取得する
+std::string GetArchitectureString(NetworkSlot slot = kMainNetwork);
+
+// 組み込んだアーキテクチャの中から、ハッシュ値と構造を表す文字列が合うものの番号を返す
+// ハッシュ値の合うものが無ければ-1を返す
+int FindArchitecture(std::uint32_t hash_value, const std::string& architecture);
 
 // ヘッダを読み込む
 bool ReadHeader(std::istream& stream,
@@ -49,11 +100,38 @@ bool ReadHeader(std::istream& stream,
 bool WriteHeader(std::ostream& stream,
     std::uint32_t hash_value, const std::string& architecture);
 
-// 評価関数パラメータを読み込む
-bool ReadParameters(std::istream& stream);
+// 読み込んだアーキテクチャの、1局面分の変換後の入力特徴量のバイト数
+std::size_t GetTransformedFeatureSize();
+
+// count局面分の変換後の入力特徴量をまとめてネットワークに通し、評価値をvaluesに書き込む
+// featuresには局面ごとにGetTransformedFeatureSize()バイトずつ、キャッシュラインに揃えて並べる
+void PropagateBatch(const TransformedFeatureType* features, int count, Value* values);
+
+// 評価関数パラメータをtargetのslotに読み込む
+// 圧縮形式なら最大threads個(0ならコア数)のスレッドで復号しながら読み込み、
+// statsがnullptrでなければ復号にかかった時間を書き込む
+bool ReadParameters(std::istream& stream, NetworkSlot slot, ParameterSet& target,
+                    int threads = 0, DecompressionStats* stats = nullptr);
+
+// 評価関数パラメータを、探索に用いているもののslotに読み込む
+bool ReadParameters(std::istream& stream, NetworkSlot slot = kMainNetwork);
+
+// slotの評価関数パラメータを書き込む
+bool WriteParameters(std::ostream& stream, NetworkSlot slot = kMainNetwork);
+
+// 主の評価関数パラメータを圧縮形式で書き込む
+bool WriteCompressedParameters(std::ostream& stream);
+
+// 評価関数パラメータを計算用の配置のまま書き出す
+// 読み込んだ評価関数ファイルsource_file_nameの大きさと更新時刻も記録する
+bool WriteMappedParameters(const std::string& file_name,
+                           const std::string& source_file_name);
 
-// 評価関数パラメータを書き込む
-bool WriteParameters(std::ostream& stream);
+// WriteMappedParameters()で書き出したファイルを読み取り専用でmmapし、
+// targetの主の評価関数のパラメータとしてそのまま使う。使えなければfalseを返す
+// 書き出した後に評価関数ファイルsource_file_nameが変わっていれば使わない
+bool MapParameters(const std::string& file_name, const std::string& source_file_name,
+                   ParameterSet& target);
 
 }  // namespace NNUE
 
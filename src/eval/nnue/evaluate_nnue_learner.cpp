@@ -44,7 +44,7 @@ uint64_t batch_size;
 std::mt19937 rng;
 
 // 学習器
-std::shared_ptr<Trainer<Network>> trainer;
+std::shared_ptr<Trainer<LearnNetwork>> trainer;
 
 // 学習率のスケール
 double global_learning_rate_scale;
@@ -70,9 +70,13 @@ void InitializeTraining(double eta1, uint64_t eta1_epoch,
   std::cout << "Initializing NN training for "
             << GetArchitectureString() << std::endl;
 
-  assert(feature_transformer);
-  assert(network);
-  trainer = Trainer<Network>::Create(network.get(), feature_transformer.get());
+  // 学習できるのは既定のアーキテクチャのみ
+  assert(parameters.architecture[kMainNetwork] == 0);
+  assert(parameters.feature_transformer[kMainNetwork]);
+  assert(parameters.network[kMainNetwork]);
+  trainer = Trainer<LearnNetwork>::Create(
+      static_cast<LearnNetwork*>(parameters.network[kMainNetwork].get()),
+      static_cast<LearnFeatureTransformer*>(parameters.feature_transformer[kMainNetwork].get()));
 
   if (Options["SkipLoadingEval"]) {
     trainer->Initialize(rng);
@@ -131,8 +135,8 @@ void AddExample(Position& pos, Color rootColor,
   example.weight = weight;
 
   Features::IndexList active_indices[2];
-  for (const auto trigger : kRefreshTriggers) {
-    RawFeatures::AppendActiveIndices(pos, trigger, active_indices);
+  for (const auto trigger : LearnRawFeatures::kRefreshTriggers) {
+    LearnRawFeatures::AppendActiveIndices(pos, trigger, active_indices);
   }
   if (pos.side_to_move() != WHITE) {
     active_indices[0].swap(active_indices[1]);
@@ -140,9 +144,9 @@ void AddExample(Position& pos, Color rootColor,
   for (const auto color : Colors) {
     std::vector<TrainingFeature> training_features;
     for (const auto base_index : active_indices[color]) {
-      static_assert(Features::Factorizer<RawFeatures>::GetDimensions() <
+      static_assert(Features::Factorizer<LearnRawFeatures>::GetDimensions() <
                     (1 << TrainingFeature::kIndexBits), "");
-      Features::Factorizer<RawFeatures>::AppendTrainingFeatures(
+      Features::Factorizer<LearnRawFeatures>::AppendTrainingFeatures(
           base_index, &training_features);
     }
     std::sort(training_features.begin(), training_features.end());
@@ -15,9 +15,9 @@ namespace Eval {
       void CastlingRight::AppendActiveIndices(
         const Position& pos, Color perspective, IndexList* active) {
         // コンパイラの警告を回避するため、配列サイズが小さい場合は何もしない
-        if (RawFeatures::kMaxActiveDimensions < kMaxActiveDimensions) return;
+        if (AllArchitectures::kMaxActiveDimensions < kMaxActiveDimensions) return;
 
-        int castling_rights = pos.state()->castlingRights;
+        int castling_rights = pos.castlingRights;
         int relative_castling_rights;
         if (perspective == WHITE) {
           relative_castling_rights = castling_rights;
@@ -37,11 +37,11 @@ namespace Eval {
 
       // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
       void CastlingRight::AppendChangedIndices(
-        const Position& pos, Color perspective,
+        __attribute__((unused))const Position& pos, const StateInfo* st, Color perspective,
         IndexList* removed, __attribute__((unused))IndexList* added) {
 
-        int previous_castling_rights = pos.state()->previous->castlingRights;
-        int current_castling_rights = pos.state()->castlingRights;
+        int previous_castling_rights = st->previous->castlingRights;
+        int current_castling_rights = st->castlingRights;
         int relative_previous_castling_rights;
         int relative_current_castling_rights;
         if (perspective == WHITE) {
@@ -33,8 +33,8 @@ namespace Eval {
           IndexList* active);
 
         // ʂ̂AOlωCfbNX̃Xg擾
-        static void AppendChangedIndices(const Position& pos, Color perspective,
-          IndexList* removed, IndexList* added);
+        static void AppendChangedIndices(const Position& pos, const StateInfo* st,
+          Color perspective, IndexList* removed, IndexList* added);
       };
 
     }  // namespace Features
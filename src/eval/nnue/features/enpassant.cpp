@@ -15,9 +15,9 @@ namespace Eval {
       void EnPassant::AppendActiveIndices(
         const Position& pos, Color perspective, IndexList* active) {
         // �R���p�C���̌x����������邽�߁A�z��T�C�Y���������ꍇ�͉������Ȃ�
-        if (RawFeatures::kMaxActiveDimensions < kMaxActiveDimensions) return;
+        if (AllArchitectures::kMaxActiveDimensions < kMaxActiveDimensions) return;
 
-        auto epSquare = pos.state()->epSquare;
+        auto epSquare = pos.epSquare;
         if (!epSquare) {
           return;
         }
@@ -32,7 +32,8 @@ namespace Eval {
 
       // �����ʂ̂����A���O����l���ω������C���f�b�N�X�̃��X�g���擾����
       void EnPassant::AppendChangedIndices(
-        __attribute__((unused))const Position& pos, __attribute__((unused))Color perspective,
+        __attribute__((unused))const Position& pos, __attribute__((unused))const StateInfo* st,
+        __attribute__((unused))Color perspective,
         __attribute__((unused))IndexList* removed, __attribute__((unused))IndexList* added) {
         // Not implemented.
         assert(false);
@@ -77,13 +77,27 @@ class FeatureSetBase {
     }
   }
 
-  // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
-  template <typename PositionType, typename IndexListType>
+  // 玉に相対的な特徴量のうち、指定した玉以外の駒に対応するインデックスのリストを取得する
+  template <typename IndexListType>
+  static void AppendPieceIndices(
+      const Position& pos, TriggerEvent trigger, Color perspective,
+      const BonaPiece* pieces, int count, IndexListType* indices) {
+    Derived::CollectPieceIndices(
+        pos, trigger, perspective, pieces, count, indices);
+  }
+
+  // 特徴量のうち、局面stで一手前から値が変化したインデックスのリストを取得する
+  // stは現在の局面かその祖先で、resetされない視点ではstから現在までに玉が動いていないこと
+  template <typename PositionType, typename StateType, typename IndexListType>
   static void AppendChangedIndices(
-      const PositionType& pos, TriggerEvent trigger,
+      const PositionType& pos, const StateType* st, TriggerEvent trigger,
       IndexListType removed[2], IndexListType added[2], bool reset[2]) {
-    const auto& dp = pos.state()->dirtyPiece;
-    if (dp.dirty_num == 0) return;
+    const auto& dp = st->dirtyPiece;
+    // 駒が動いていなくても、常に全計算する特徴量(アンパッサンの筋など)は変わりうる
+    if (dp.dirty_num == 0 && trigger != TriggerEvent::kAnyPieceMoved) {
+      reset[WHITE] = reset[BLACK] = false;
+      return;
+    }
 
     for (const auto perspective : Colors) {
       reset[perspective] = false;
@@ -113,7 +127,7 @@ class FeatureSetBase {
             pos, trigger, perspective, &added[perspective]);
       } else {
         Derived::CollectChangedIndices(
-            pos, trigger, perspective,
+            pos, st, trigger, perspective,
             &removed[perspective], &added[perspective]);
       }
     }
@@ -169,13 +183,14 @@ class FeatureSet<FirstFeatureType, RemainingFeatureTypes...> :
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
   template <typename IndexListType>
   static void CollectChangedIndices(
-      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const Position& pos, const StateInfo* st, const TriggerEvent trigger,
+      const Color perspective,
       IndexListType* const removed, IndexListType* const added) {
-    Tail::CollectChangedIndices(pos, trigger, perspective, removed, added);
+    Tail::CollectChangedIndices(pos, st, trigger, perspective, removed, added);
     if (Head::kRefreshTrigger == trigger) {
       const auto start_removed = removed->size();
       const auto start_added = added->size();
-      Head::AppendChangedIndices(pos, perspective, removed, added);
+      Head::AppendChangedIndices(pos, st, perspective, removed, added);
       for (auto i = start_removed; i < removed->size(); ++i) {
         (*removed)[i] += Tail::kDimensions;
       }
@@ -185,6 +200,23 @@ class FeatureSet<FirstFeatureType, RemainingFeatureTypes...> :
     }
   }
 
+  // 玉に相対的な特徴量のうち、指定した玉以外の駒に対応するインデックスのリストを取得する
+  template <typename IndexListType>
+  static void CollectPieceIndices(
+      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const BonaPiece* pieces, int count, IndexListType* const indices) {
+    Tail::CollectPieceIndices(pos, trigger, perspective, pieces, count, indices);
+    if constexpr (IsKingRelative(Head::kRefreshTrigger)) {
+      if (Head::kRefreshTrigger == trigger) {
+        const auto start = indices->size();
+        Head::AppendPieceIndices(pos, perspective, pieces, count, indices);
+        for (auto i = start; i < indices->size(); ++i) {
+          (*indices)[i] += Tail::kDimensions;
+        }
+      }
+    }
+  }
+
   // 基底クラスと、自身を再帰的に利用するクラステンプレートをfriendにする
   friend class FeatureSetBase<FeatureSet>;
   template <typename... FeatureTypes>
@@ -225,10 +257,22 @@ class FeatureSet<FeatureType> : public FeatureSetBase<FeatureSet<FeatureType>> {
 
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
   static void CollectChangedIndices(
-      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const Position& pos, const StateInfo* st, const TriggerEvent trigger,
+      const Color perspective,
       IndexList* const removed, IndexList* const added) {
     if (FeatureType::kRefreshTrigger == trigger) {
-      FeatureType::AppendChangedIndices(pos, perspective, removed, added);
+      FeatureType::AppendChangedIndices(pos, st, perspective, removed, added);
+    }
+  }
+
+  // 玉に相対的な特徴量のうち、指定した玉以外の駒に対応するインデックスのリストを取得する
+  static void CollectPieceIndices(
+      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const BonaPiece* pieces, int count, IndexList* const indices) {
+    if constexpr (IsKingRelative(FeatureType::kRefreshTrigger)) {
+      if (FeatureType::kRefreshTrigger == trigger) {
+        FeatureType::AppendPieceIndices(pos, perspective, pieces, count, indices);
+      }
     }
   }
 
@@ -30,6 +30,12 @@ enum class TriggerEvent {
   kAnyPieceMoved,    // 常に全計算する
 };
 
+// 玉の位置に対して相対的な特徴量の全計算のタイミングか
+constexpr bool IsKingRelative(TriggerEvent trigger) {
+  return trigger == TriggerEvent::kFriendKingMoved ||
+         trigger == TriggerEvent::kEnemyKingMoved;
+}
+
 // 手番側or相手側
 enum class Side {
   kFriend,  // 手番側
@@ -43,7 +43,7 @@ template <Side AssociatedKing>
 void HalfRelativeKP<AssociatedKing>::AppendActiveIndices(
     const Position& pos, Color perspective, IndexList* active) {
   // コンパイラの警告を回避するため、配列サイズが小さい場合は何もしない
-  if (RawFeatures::kMaxActiveDimensions < kMaxActiveDimensions) return;
+  if (AllArchitectures::kMaxActiveDimensions < kMaxActiveDimensions) return;
 
   BonaPiece* pieces;
   Square sq_target_k;
@@ -60,12 +60,12 @@ void HalfRelativeKP<AssociatedKing>::AppendActiveIndices(
 // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
 template <Side AssociatedKing>
 void HalfRelativeKP<AssociatedKing>::AppendChangedIndices(
-    const Position& pos, Color perspective,
+    const Position& pos, const StateInfo* st, Color perspective,
     IndexList* removed, IndexList* added) {
   BonaPiece* pieces;
   Square sq_target_k;
   GetPieces(pos, perspective, &pieces, &sq_target_k);
-  const auto& dp = pos.state()->dirtyPiece;
+  const auto& dp = st->dirtyPiece;
   for (int i = 0; i < dp.dirty_num; ++i) {
     if (dp.pieceNo[i] >= PIECE_NUMBER_KING) continue;
     const auto old_p = static_cast<BonaPiece>(
@@ -85,6 +85,24 @@ void HalfRelativeKP<AssociatedKing>::AppendChangedIndices(
   }
 }
 
+// 指定した玉以外の駒(BonaPiece)に対応するインデックスのリストを取得する
+template <Side AssociatedKing>
+void HalfRelativeKP<AssociatedKing>::AppendPieceIndices(
+    const Position& pos, Color perspective,
+    const BonaPiece* pieces, int count, IndexList* indices) {
+  // コンパイラの警告を回避するため、配列サイズが小さい場合は何もしない
+  if (AllArchitectures::kMaxActiveDimensions < kMaxActiveDimensions) return;
+
+  BonaPiece* list;
+  Square sq_target_k;
+  GetPieces(pos, perspective, &list, &sq_target_k);
+  for (int i = 0; i < count; ++i) {
+    if (pieces[i] >= fe_hand_end && pieces[i] != Eval::BONA_PIECE_ZERO) {
+      indices->push_back(MakeIndex(sq_target_k, pieces[i]));
+    }
+  }
+}
+
 template class HalfRelativeKP<Side::kFriend>;
 template class HalfRelativeKP<Side::kEnemy>;
 
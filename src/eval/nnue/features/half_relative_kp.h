@@ -45,9 +45,15 @@ class HalfRelativeKP {
                                   IndexList* active);
 
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
-  static void AppendChangedIndices(const Position& pos, Color perspective,
+  static void AppendChangedIndices(const Position& pos, const StateInfo* st,
+                                   Color perspective,
                                    IndexList* removed, IndexList* added);
 
+  // 指定した玉以外の駒(BonaPiece)に対応するインデックスのリストを取得する
+  static void AppendPieceIndices(const Position& pos, Color perspective,
+                                 const BonaPiece* pieces, int count,
+                                 IndexList* indices);
+
   // 玉の位置とBonaPieceから特徴量のインデックスを求める
   static IndexType MakeIndex(Square sq_k, BonaPiece p);
 
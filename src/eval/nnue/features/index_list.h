@@ -41,7 +41,7 @@ class ValueList {
 
 // 特徴量のインデックスリストの型
 class IndexList
-    : public ValueList<IndexType, RawFeatures::kMaxActiveDimensions> {
+    : public ValueList<IndexType, AllArchitectures::kMaxActiveDimensions> {
 };
 
 }  // namespace Features
@@ -33,7 +33,8 @@ class K {
                                   IndexList* active);
 
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
-  static void AppendChangedIndices(const Position& pos, Color perspective,
+  static void AppendChangedIndices(const Position& pos, const StateInfo* st,
+                                   Color perspective,
                                    IndexList* removed, IndexList* added);
 };
 
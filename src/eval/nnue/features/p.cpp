@@ -15,7 +15,7 @@ namespace Features {
 void P::AppendActiveIndices(
     const Position& pos, Color perspective, IndexList* active) {
   // コンパイラの警告を回避するため、配列サイズが小さい場合は何もしない
-  if (RawFeatures::kMaxActiveDimensions < kMaxActiveDimensions) return;
+  if (AllArchitectures::kMaxActiveDimensions < kMaxActiveDimensions) return;
 
   const BonaPiece* pieces = (perspective == BLACK) ?
       pos.eval_list()->piece_list_fb() :
@@ -29,9 +29,9 @@ void P::AppendActiveIndices(
 
 // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
 void P::AppendChangedIndices(
-    const Position& pos, Color perspective,
+    const Position& /*pos*/, const StateInfo* st, Color perspective,
     IndexList* removed, IndexList* added) {
-  const auto& dp = pos.state()->dirtyPiece;
+  const auto& dp = st->dirtyPiece;
   for (int i = 0; i < dp.dirty_num; ++i) {
     if (dp.pieceNo[i] >= PIECE_NUMBER_KING) continue;
     if (dp.changed_piece[i].old_piece.from[perspective] != Eval::BONA_PIECE_ZERO) {
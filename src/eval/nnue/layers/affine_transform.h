@@ -6,6 +6,10 @@
 #if defined(EVAL_NNUE)
 
 #include "../nnue_common.h"
+#include "../nnue_kernels.h"
+#include "input_slice.h"
+
+#include <vector>
 
 namespace Eval {
 
@@ -29,6 +33,11 @@ class AffineTransform {
   static constexpr IndexType kPaddedInputDimensions =
       CeilToMultiple<IndexType>(kInputDimensions, kMaxSimdWidth);
 
+  // 入力特徴量変換器の直後の層は、0でない入力だけを計算できる
+  // 入力がどれだけ疎かはネットワークによるので、読み込んだ後にSetSparseInput()で選ぶ
+  static constexpr bool kSparseInput = IsInputSlice<PreviousLayer>::value &&
+      kInputDimensions % kAvx512Width == 0 && kOutputDimensions % 16 == 0;
+
   // この層で使用する順伝播用バッファのサイズ
   static constexpr std::size_t kSelfBufferSize =
       CeilToMultiple(kOutputDimensions * sizeof(OutputType), kCacheLineSize);
@@ -59,98 +68,134 @@ class AffineTransform {
     if (!previous_layer_.ReadParameters(stream)) return false;
     stream.read(reinterpret_cast<char*>(biases_),
                 kOutputDimensions * sizeof(BiasType));
-    stream.read(reinterpret_cast<char*>(weights_),
+    // ファイルの重みは行ごとに並んでいるので、計算用の配置に並べ替える
+    std::vector<WeightType> weights(kOutputDimensions * kPaddedInputDimensions);
+    stream.read(reinterpret_cast<char*>(weights.data()),
                 kOutputDimensions * kPaddedInputDimensions *
                 sizeof(WeightType));
+    for (IndexType i = 0; i < kOutputDimensions; ++i) {
+      for (IndexType j = 0; j < kPaddedInputDimensions; ++j) {
+        weights_[WeightIndex(i, j)] = weights[i * kPaddedInputDimensions + j];
+      }
+    }
+    UpdateSparseWeights();
     return !stream.fail();
   }
 
+  // 入力特徴量変換器の直後の層を、0でない入力だけを計算するかどうか設定する
+  void SetSparseInput(bool sparse) {
+    if constexpr (kSparseInput) {
+      sparse_input_ = sparse;
+      UpdateSparseWeights();
+    } else {
+      previous_layer_.SetSparseInput(sparse);
+    }
+  }
+
   // パラメータを書き込む
   bool WriteParameters(std::ostream& stream) const {
     if (!previous_layer_.WriteParameters(stream)) return false;
     stream.write(reinterpret_cast<const char*>(biases_),
                  kOutputDimensions * sizeof(BiasType));
-    stream.write(reinterpret_cast<const char*>(weights_),
+    std::vector<WeightType> weights(kOutputDimensions * kPaddedInputDimensions);
+    for (IndexType i = 0; i < kOutputDimensions; ++i) {
+      for (IndexType j = 0; j < kPaddedInputDimensions; ++j) {
+        weights[i * kPaddedInputDimensions + j] = weights_[WeightIndex(i, j)];
+      }
+    }
+    stream.write(reinterpret_cast<const char*>(weights.data()),
                  kOutputDimensions * kPaddedInputDimensions *
                  sizeof(WeightType));
     return !stream.fail();
   }
 
-  // 順伝播
-  const OutputType* Propagate(
+  // SIMDの経路の検証用に、スカラーの経路で順伝播する
+  const OutputType* PropagateReference(
       const TransformedFeatureType* transformed_features, char* buffer) const {
-    const auto input = previous_layer_.Propagate(
+    const auto input = previous_layer_.PropagateReference(
         transformed_features, buffer + kSelfBufferSize);
     const auto output = reinterpret_cast<OutputType*>(buffer);
-#if defined(USE_AVX2)
-    constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-    const __m256i kOnes = _mm256_set1_epi16(1);
-    const auto input_vector = reinterpret_cast<const __m256i*>(input);
-#elif defined(USE_SSE41)
-    constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-    const __m128i kOnes = _mm_set1_epi16(1);
-    const auto input_vector = reinterpret_cast<const __m128i*>(input);
-#elif defined(IS_ARM)
-    constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-    const auto input_vector = reinterpret_cast<const int8x8_t*>(input);
-#endif
     for (IndexType i = 0; i < kOutputDimensions; ++i) {
-      const IndexType offset = i * kPaddedInputDimensions;
-#if defined(USE_AVX2)
-      __m256i sum = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, biases_[i]);
-      const auto row = reinterpret_cast<const __m256i*>(&weights_[offset]);
-      for (IndexType j = 0; j < kNumChunks; ++j) {
-        __m256i product = _mm256_maddubs_epi16(
-#if defined(__MINGW32__) || defined(__MINGW64__)
-          // HACK: Use _mm256_loadu_si256() instead of _mm256_load_si256. Because the binary
-          //       compiled with g++ in MSYS2 crashes here because the output memory is not aligned
-          //       even though alignas is specified.
-          _mm256_loadu_si256
-#else
-          _mm256_load_si256
-#endif
-          (&input_vector[j]), _mm256_load_si256(&row[j]));
-        product = _mm256_madd_epi16(product, kOnes);
-        sum = _mm256_add_epi32(sum, product);
-      }
-      sum = _mm256_hadd_epi32(sum, sum);
-      sum = _mm256_hadd_epi32(sum, sum);
-      const __m128i lo = _mm256_extracti128_si256(sum, 0);
-      const __m128i hi = _mm256_extracti128_si256(sum, 1);
-      output[i] = _mm_cvtsi128_si32(lo) + _mm_cvtsi128_si32(hi);
-#elif defined(USE_SSE41)
-      __m128i sum = _mm_cvtsi32_si128(biases_[i]);
-      const auto row = reinterpret_cast<const __m128i*>(&weights_[offset]);
-      for (IndexType j = 0; j < kNumChunks; ++j) {
-        __m128i product = _mm_maddubs_epi16(
-            _mm_load_si128(&input_vector[j]), _mm_load_si128(&row[j]));
-        product = _mm_madd_epi16(product, kOnes);
-        sum = _mm_add_epi32(sum, product);
-      }
-      sum = _mm_hadd_epi32(sum, sum);
-      sum = _mm_hadd_epi32(sum, sum);
-      output[i] = _mm_cvtsi128_si32(sum);
-#elif defined(IS_ARM)
-      int32x4_t sum = {biases_[i]};
-      const auto row = reinterpret_cast<const int8x8_t*>(&weights_[offset]);
-      for (IndexType j = 0; j < kNumChunks; ++j) {
-        int16x8_t product = vmull_s8(input_vector[j * 2], row[j * 2]);
-        product = vmlal_s8(product, input_vector[j * 2 + 1], row[j * 2 + 1]);
-        sum = vpadalq_s16(sum, product);
-      }
-      output[i] = sum[0] + sum[1] + sum[2] + sum[3];
-#else
       OutputType sum = biases_[i];
       for (IndexType j = 0; j < kInputDimensions; ++j) {
-        sum += weights_[offset + j] * input[j];
+        sum += weights_[WeightIndex(i, j)] * input[j];
       }
       output[i] = sum;
-#endif
     }
     return output;
   }
 
+  // 順伝播
+  const OutputType* Propagate(
+      const TransformedFeatureType* transformed_features, char* buffer) const {
+    const auto input = previous_layer_.Propagate(
+        transformed_features, buffer + kSelfBufferSize);
+    const auto output = reinterpret_cast<OutputType*>(buffer);
+    if constexpr (kSparseInput) {
+      if (sparse_input_) {
+        Kernels::SparseAffine<kInputDimensions, kPaddedInputDimensions,
+                              kOutputDimensions>(
+            output, input, weights_, sparse_weights_, biases_);
+        return output;
+      }
+    }
+    Kernels::Affine<kInputDimensions, kPaddedInputDimensions,
+                    kOutputDimensions>(output, input, weights_, biases_);
+    return output;
+  }
+
+  // 複数局面の順伝播で、局面ごとの出力の間隔
+  static constexpr IndexType OutputStride(IndexType /*transformed_stride*/) {
+    return kSelfBufferSize / sizeof(OutputType);
+  }
+
+  // 複数局面の順伝播。バッファはkBufferSize * batch_sizeバイト使う
+  // 重みを読み込むたびに複数の局面の入力に掛けるので、重みの読み込みが局面数より少なく済む
+  const OutputType* PropagateBatch(
+      const TransformedFeatureType* transformed_features,
+      IndexType transformed_stride, IndexType batch_size, char* buffer) const {
+    const auto input = previous_layer_.PropagateBatch(
+        transformed_features, transformed_stride, batch_size,
+        buffer + kSelfBufferSize * batch_size);
+    const IndexType input_stride = PreviousLayer::OutputStride(transformed_stride);
+    const IndexType output_stride = OutputStride(transformed_stride);
+    const auto output = reinterpret_cast<OutputType*>(buffer);
+    // 1局面だけなら疎な入力の計算の方が速い
+    if constexpr (kSparseInput) {
+      if (sparse_input_ && batch_size == 1) {
+        Kernels::SparseAffine<kInputDimensions, kPaddedInputDimensions,
+                              kOutputDimensions>(
+            output, input, weights_, sparse_weights_, biases_);
+        return output;
+      }
+    }
+    Kernels::AffineBatch<kInputDimensions, kPaddedInputDimensions,
+                         kOutputDimensions>(
+        output, output_stride, input, input_stride, batch_size,
+        weights_, biases_);
+    return output;
+  }
+
  private:
+  // 出力iの入力jに対する重みのweights_での位置
+  static constexpr IndexType WeightIndex(IndexType i, IndexType j) {
+    return Kernels::AffineWeightIndex<kPaddedInputDimensions,
+                                      kOutputDimensions>(i, j);
+  }
+
+  // 疎な入力として計算するなら、重みを疎な入力用の配置に並べ替えた複製を作る
+  void UpdateSparseWeights() {
+    if constexpr (kSparseInput) {
+      if (!sparse_input_) return;
+      for (IndexType i = 0; i < kOutputDimensions; ++i) {
+        for (IndexType j = 0; j < kInputDimensions; ++j) {
+          sparse_weights_[Kernels::SparseWeightIndex<kOutputDimensions>(i, j)] =
+              weights_[WeightIndex(i, j)];
+        }
+      }
+    }
+  }
+
   // パラメータの型
   using BiasType = OutputType;
   using WeightType = std::int8_t;
@@ -165,6 +210,11 @@ class AffineTransform {
   alignas(kCacheLineSize) BiasType biases_[kOutputDimensions];
   alignas(kCacheLineSize)
       WeightType weights_[kOutputDimensions * kPaddedInputDimensions];
+  alignas(kCacheLineSize) WeightType
+      sparse_weights_[kSparseInput ? kOutputDimensions * kInputDimensions : 1];
+
+  // 疎な入力として計算するか。パラメータの領域は0で初期化するので、既定では密に計算する
+  bool sparse_input_;
 };
 
 }  // namespace Layers
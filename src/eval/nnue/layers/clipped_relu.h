@@ -6,6 +6,7 @@
 #if defined(EVAL_NNUE)
 
 #include "../nnue_common.h"
+#include "../nnue_kernels.h"
 
 namespace Eval {
 
@@ -59,92 +60,52 @@ class ClippedReLU {
     return previous_layer_.WriteParameters(stream);
   }
 
+  // 入力特徴量変換器の直後の層を、0でない入力だけを計算するかどうか設定する
+  void SetSparseInput(bool sparse) {
+    previous_layer_.SetSparseInput(sparse);
+  }
+
+  // SIMDの経路の検証用に、スカラーの経路で順伝播する
+  const OutputType* PropagateReference(
+      const TransformedFeatureType* transformed_features, char* buffer) const {
+    const auto input = previous_layer_.PropagateReference(
+        transformed_features, buffer + kSelfBufferSize);
+    const auto output = reinterpret_cast<OutputType*>(buffer);
+    for (IndexType i = 0; i < kInputDimensions; ++i) {
+      output[i] = static_cast<OutputType>(
+          std::max(0, std::min(127, input[i] >> kWeightScaleBits)));
+    }
+    return output;
+  }
+
   // 順伝播
   const OutputType* Propagate(
       const TransformedFeatureType* transformed_features, char* buffer) const {
     const auto input = previous_layer_.Propagate(
         transformed_features, buffer + kSelfBufferSize);
     const auto output = reinterpret_cast<OutputType*>(buffer);
-#if defined(USE_AVX2)
-    constexpr IndexType kNumChunks = kInputDimensions / kSimdWidth;
-    const __m256i kZero = _mm256_setzero_si256();
-    const __m256i kOffsets = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
-    const auto in = reinterpret_cast<const __m256i*>(input);
-    const auto out = reinterpret_cast<__m256i*>(output);
-    for (IndexType i = 0; i < kNumChunks; ++i) {
-      const __m256i words0 = _mm256_srai_epi16(_mm256_packs_epi32(
-#if defined(__MINGW32__) || defined(__MINGW64__)
-        // HACK: Use _mm256_loadu_si256() instead of _mm256_load_si256. Because the binary
-        //       compiled with g++ in MSYS2 crashes here because the output memory is not aligned
-        //       even though alignas is specified.
-        _mm256_loadu_si256
-#else
-        _mm256_load_si256
-#endif
-        (&in[i * 4 + 0]),
-#if defined(__MINGW32__) || defined(__MINGW64__)
-        _mm256_loadu_si256
-#else
-        _mm256_load_si256
-#endif
-        (&in[i * 4 + 1])), kWeightScaleBits);
-      const __m256i words1 = _mm256_srai_epi16(_mm256_packs_epi32(
-#if defined(__MINGW32__) || defined(__MINGW64__)
-        _mm256_loadu_si256
-#else
-        _mm256_load_si256
-#endif
-        (&in[i * 4 + 2]),
-#if defined(__MINGW32__) || defined(__MINGW64__)
-        _mm256_loadu_si256
-#else
-        _mm256_load_si256
-#endif
-        (&in[i * 4 + 3])), kWeightScaleBits);
-#if defined(__MINGW32__) || defined(__MINGW64__)
-      _mm256_storeu_si256
-#else
-      _mm256_store_si256
-#endif
-        (&out[i], _mm256_permutevar8x32_epi32(_mm256_max_epi8(
-          _mm256_packs_epi16(words0, words1), kZero), kOffsets));
-    }
-    constexpr IndexType kStart = kNumChunks * kSimdWidth;
-#elif defined(USE_SSE41)
-    constexpr IndexType kNumChunks = kInputDimensions / kSimdWidth;
-    const __m128i kZero = _mm_setzero_si128();
-    const auto in = reinterpret_cast<const __m128i*>(input);
-    const auto out = reinterpret_cast<__m128i*>(output);
-    for (IndexType i = 0; i < kNumChunks; ++i) {
-      const __m128i words0 = _mm_srai_epi16(_mm_packs_epi32(
-          _mm_load_si128(&in[i * 4 + 0]),
-          _mm_load_si128(&in[i * 4 + 1])), kWeightScaleBits);
-      const __m128i words1 = _mm_srai_epi16(_mm_packs_epi32(
-          _mm_load_si128(&in[i * 4 + 2]),
-          _mm_load_si128(&in[i * 4 + 3])), kWeightScaleBits);
-      _mm_store_si128(&out[i], _mm_max_epi8(
-          _mm_packs_epi16(words0, words1), kZero));
-    }
-    constexpr IndexType kStart = kNumChunks * kSimdWidth;
-#elif defined(IS_ARM)
-    constexpr IndexType kNumChunks = kInputDimensions / (kSimdWidth / 2);
-    const int8x8_t kZero = {0};
-    const auto in = reinterpret_cast<const int32x4_t*>(input);
-    const auto out = reinterpret_cast<int8x8_t*>(output);
-    for (IndexType i = 0; i < kNumChunks; ++i) {
-      int16x8_t shifted;
-      const auto pack = reinterpret_cast<int16x4_t*>(&shifted);
-      pack[0] = vqshrn_n_s32(in[i * 2 + 0], kWeightScaleBits);
-      pack[1] = vqshrn_n_s32(in[i * 2 + 1], kWeightScaleBits);
-      out[i] = vmax_s8(vqmovn_s16(shifted), kZero);
-    }
-    constexpr IndexType kStart = kNumChunks * (kSimdWidth / 2);
-#else
-    constexpr IndexType kStart = 0;
-#endif
-    for (IndexType i = kStart; i < kInputDimensions; ++i) {
-      output[i] = static_cast<OutputType>(
-          std::max(0, std::min(127, input[i] >> kWeightScaleBits)));
+    Kernels::ClippedReLU<kInputDimensions>(output, input);
+    return output;
+  }
+
+  // 複数局面の順伝播で、局面ごとの出力の間隔
+  static constexpr IndexType OutputStride(IndexType /*transformed_stride*/) {
+    return kSelfBufferSize / sizeof(OutputType);
+  }
+
+  // 複数局面の順伝播。バッファはkBufferSize * batch_sizeバイト使う
+  const OutputType* PropagateBatch(
+      const TransformedFeatureType* transformed_features,
+      IndexType transformed_stride, IndexType batch_size, char* buffer) const {
+    const auto input = previous_layer_.PropagateBatch(
+        transformed_features, transformed_stride, batch_size,
+        buffer + kSelfBufferSize * batch_size);
+    const IndexType input_stride = PreviousLayer::OutputStride(transformed_stride);
+    const IndexType output_stride = OutputStride(transformed_stride);
+    const auto output = reinterpret_cast<OutputType*>(buffer);
+    for (IndexType b = 0; b < batch_size; ++b) {
+      Kernels::ClippedReLU<kInputDimensions>(&output[b * output_stride],
+                                             &input[b * input_stride]);
     }
     return output;
   }
@@ -53,6 +53,16 @@ class InputSlice {
     return true;
   }
 
+  // 入力特徴量変換器の直後の層を、0でない入力だけを計算するかどうか設定する
+  void SetSparseInput(bool /*sparse*/) {}
+
+  // SIMDの経路の検証用の順伝播。この層は計算しないのでPropagate()と同じ。
+  const OutputType* PropagateReference(
+      const TransformedFeatureType* transformed_features,
+      char* buffer) const {
+    return Propagate(transformed_features, buffer);
+  }
+
   // 順伝播
   const OutputType* Propagate(
       const TransformedFeatureType* transformed_features,
@@ -60,9 +70,28 @@ class InputSlice {
     return transformed_features + Offset;
   }
 
+  // 複数局面の順伝播で、局面ごとの出力の間隔。変換後の入力特徴量の間隔と同じ
+  static constexpr IndexType OutputStride(IndexType transformed_stride) {
+    return transformed_stride;
+  }
+
+  // 複数局面の順伝播。局面ごとの変換後の入力特徴量はtransformed_strideずつ離れている
+  const OutputType* PropagateBatch(
+      const TransformedFeatureType* transformed_features,
+      IndexType /*transformed_stride*/, IndexType /*batch_size*/,
+      char* /*buffer*/) const {
+    return transformed_features + Offset;
+  }
+
  private:
 };
 
+// 層が入力層かどうか
+template <typename LayerType>
+struct IsInputSlice : std::false_type {};
+template <IndexType OutputDimensions, IndexType Offset>
+struct IsInputSlice<InputSlice<OutputDimensions, Offset>> : std::true_type {};
+
 }  // namespace Layers
 
 }  // namespace NNUE
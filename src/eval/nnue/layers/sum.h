@@ -67,6 +67,12 @@ class Sum : public Sum<RemainingPreviousLayers...> {
     return previous_layer_.WriteParameters(stream);
   }
 
+  // 入力特徴量変換器の直後の層を、0でない入力だけを計算するかどうか設定する
+  void SetSparseInput(bool sparse) {
+    Tail::SetSparseInput(sparse);
+    previous_layer_.SetSparseInput(sparse);
+  }
+
   // 順伝播
   const OutputType* Propagate(
       const TransformedFeatureType* transformed_features, char* buffer) const {
@@ -133,6 +139,11 @@ class Sum<PreviousLayer> {
     return previous_layer_.WriteParameters(stream);
   }
 
+  // 入力特徴量変換器の直後の層を、0でない入力だけを計算するかどうか設定する
+  void SetSparseInput(bool sparse) {
+    previous_layer_.SetSparseInput(sparse);
+  }
+
   // 順伝播
   const OutputType* Propagate(
       const TransformedFeatureType* transformed_features, char* buffer) const {
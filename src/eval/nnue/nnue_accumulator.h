@@ -11,16 +11,68 @@ namespace Eval {
 
 namespace NNUE {
 
+// 同時に読み込む評価関数の番号
+// 主の評価関数に加えて、静止探索と枝刈りの判定に使う小さな評価関数を読み込める
+// 局面ごとの累積値は評価関数ごとに持つので、どちらの差分計算も互いに壊さない
+enum NetworkSlot : int {
+  kMainNetwork,
+  kSmallNetwork,
+  kNetworkSlots
+};
+
 // 入力特徴量をアフィン変換した結果を保持するクラス
 // 最終的な出力である評価値も一緒に持たせておく
-struct alignas(32) Accumulator {
-  std::int16_t
-      accumulation[2][kRefreshTriggers.size()][kTransformedFeatureDimensions];
+// 累積値は組み込んだどのアーキテクチャのものも入る大きさで持ち、
+// 読み込んだアーキテクチャのFeatureTransformerが[視点][全計算のタイミング][次元]の順に使う
+struct alignas(kCacheLineSize) Accumulator {
+  std::int16_t accumulation[AllArchitectures::kMaxAccumulationSize];
   Value score = VALUE_ZERO;
   bool computed_accumulation = false;
   bool computed_score = false;
 };
 
+// 玉が動いた時の全計算の代わりに用いるスレッド毎のキャッシュ
+// 玉の位置と視点ごとに、最後に計算した累積値とその時の玉以外の駒の配置を保持し、
+// 現在の駒の配置との差分だけを計算する
+template <typename Architecture>
+struct RefreshCache {
+  // 差分計算の代わりに全計算を行うタイミングのリスト
+  static constexpr auto kRefreshTriggers = Architecture::RawFeatures::kRefreshTriggers;
+
+  // 玉に相対的な特徴量の全計算を行うタイミングの数
+  static constexpr IndexType CountKingRelativeTriggers() {
+    IndexType count = 0;
+    for (const auto trigger : kRefreshTriggers) {
+      count += Features::IsKingRelative(trigger);
+    }
+    return count;
+  }
+  static constexpr IndexType kKingRelativeTriggers = CountKingRelativeTriggers();
+
+  // kRefreshTriggers[i]が玉に相対的な場合の、キャッシュ内での番号
+  static constexpr IndexType KingRelativeTriggerSlot(IndexType i) {
+    IndexType slot = 0;
+    for (IndexType j = 0; j < i; ++j) {
+      slot += Features::IsKingRelative(kRefreshTriggers[j]);
+    }
+    return slot;
+  }
+
+  struct alignas(kCacheLineSize) Entry {
+    std::int16_t accumulation[Architecture::kTransformedFeatureDimensions];
+    Bitboard colorBB[2];
+    Bitboard pieceBB[KING];
+  };
+  Entry entries[kKingRelativeTriggers > 0 ? kKingRelativeTriggers : 1][2][SQUARE_NB];
+};
+
+// 組み込んだどのアーキテクチャのRefreshCacheも入る大きさ
+template <typename... Architectures>
+constexpr std::size_t MaxRefreshCacheSize(ArchitectureList<Architectures...>) {
+  return std::max({sizeof(RefreshCache<Architectures>)...});
+}
+constexpr std::size_t kMaxRefreshCacheSize = MaxRefreshCacheSize(AllArchitectures());
+
 }  // namespace NNUE
 
 }  // namespace Eval
@@ -5,23 +5,79 @@
 
 #if defined(EVAL_NNUE)
 
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+
 // 入力特徴量とネットワーク構造が定義されたヘッダをincludeする
-//#include "architectures/k-p_256x2-32-32.h"
-//#include "architectures/k-p-cr_256x2-32-32.h"
-//#include "architectures/k-p-cr-ep_256x2-32-32.h"
+// 全て1つのバイナリに組み込み、評価関数ファイルのヘッダから実行時に選ぶ
 #include "architectures/halfkp_256x2-32-32.h"
-//#include "architectures/halfkp-cr-ep_256x2-32-32.h"
+#include "architectures/halfkp_384x2-32-32.h"
+#include "architectures/halfkp-cr-ep_256x2-32-32.h"
+#include "architectures/k-p_256x2-32-32.h"
+#include "architectures/k-p-cr_256x2-32-32.h"
+#include "architectures/k-p-cr-ep_256x2-32-32.h"
 
 namespace Eval {
 
 namespace NNUE {
 
-static_assert(kTransformedFeatureDimensions % kMaxSimdWidth == 0, "");
-static_assert(Network::kOutputDimensions == 1, "");
-static_assert(std::is_same<Network::OutputType, std::int32_t>::value, "");
+namespace Architectures {
+
+// 入力特徴量変換器の重みを8bitに量子化したアーキテクチャ
+// 重みは評価関数ファイルごとの倍率を掛けて16bitに戻しながら足すので、
+// 累積値から先の計算とネットワークは元のアーキテクチャと同じ
+template <typename Architecture>
+struct QuantizedFeatures : Architecture {
+  using FeatureWeightType = std::int8_t;
+};
+
+}  // namespace Architectures
+
+// 組み込むアーキテクチャのリスト
+template <typename... Architectures>
+struct ArchitectureList {
+  // アーキテクチャの数
+  static constexpr std::size_t kSize = sizeof...(Architectures);
+
+  // I番目のアーキテクチャ
+  template <std::size_t I>
+  using At = std::tuple_element_t<I, std::tuple<Architectures...>>;
+
+  // 同時に値が1となる入力特徴量のインデックスの数の最大値
+  static constexpr IndexType kMaxActiveDimensions = std::max({
+      Architectures::RawFeatures::kMaxActiveDimensions...});
+
+  // 1局面の累積値の要素数(視点 x 全計算のタイミング x 次元数)の最大値
+  static constexpr IndexType kMaxAccumulationSize = std::max({static_cast<IndexType>(
+      2 * Architectures::RawFeatures::kRefreshTriggers.size() *
+      Architectures::kTransformedFeatureDimensions)...});
+};
+
+// 組み込む全てのアーキテクチャ
+// 先頭のものを評価関数ファイルを読み込む前の既定のアーキテクチャとする
+using AllArchitectures = ArchitectureList<
+    Architectures::HalfKP256,
+    Architectures::HalfKP384,
+    Architectures::HalfKPCrEp256,
+    Architectures::KP256,
+    Architectures::KPCr256,
+    Architectures::KPCrEp256,
+    Architectures::QuantizedFeatures<Architectures::HalfKP256>,
+    Architectures::QuantizedFeatures<Architectures::HalfKP384>,
+    Architectures::QuantizedFeatures<Architectures::HalfKPCrEp256>>;
+
+// 評価関数の学習に用いるアーキテクチャ
+using LearnArchitecture = Architectures::HalfKP256;
+static_assert(std::is_same<AllArchitectures::At<0>, LearnArchitecture>::value, "");
+
+template <typename Architecture>
+class FeatureTransformer;
 
-// 差分計算の代わりに全計算を行うタイミングのリスト
-constexpr auto kRefreshTriggers = RawFeatures::kRefreshTriggers;
+// 学習器とテストコマンドが扱う型
+using LearnRawFeatures = LearnArchitecture::RawFeatures;
+using LearnNetwork = LearnArchitecture::Network;
+using LearnFeatureTransformer = FeatureTransformer<LearnArchitecture>;
 
 }  // namespace NNUE
 
@@ -19,16 +19,12 @@ constexpr int kWeightScaleBits = 6;
 // キャッシュラインのサイズ（バイト単位）
 constexpr std::size_t kCacheLineSize = 64;
 
-// SIMD幅（バイト単位）
-#if defined(USE_AVX2)
-constexpr std::size_t kSimdWidth = 32;
-#elif defined(USE_SSE2)
-constexpr std::size_t kSimdWidth = 16;
-#elif defined(IS_ARM)
-constexpr std::size_t kSimdWidth = 16;
-#endif
+// 評価関数ファイルのパディングに使うSIMD幅（バイト単位）
 constexpr std::size_t kMaxSimdWidth = 32;
 
+// AVX-512のレジスタ幅（バイト単位）
+constexpr std::size_t kAvx512Width = 64;
+
 // 変換後の入力特徴量の型
 using TransformedFeatureType = std::uint8_t;
 
@@ -0,0 +1,556 @@
+﻿// NNUE評価関数ファイルの圧縮形式
+
+#if defined(EVAL_NNUE)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <pthread.h>
+
+#include "nnue_compression.h"
+
+namespace Eval {
+
+namespace NNUE {
+
+namespace {
+
+// 圧縮形式のファイルのヘッダ
+struct CompressedHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t block_count;
+  std::uint64_t raw_size;
+};
+
+constexpr char kCompressedMagic[8] = "WeissNZ";
+
+// 符号化の方法を変えたら上げる
+constexpr std::uint32_t kCompressedVersion = 1;
+
+// 1ブロックの元のバイト数の上限
+constexpr std::size_t kBlockSize = 128 * 1024;
+
+// 語のビット長は0から16なので、符号化する記号は17種類
+constexpr int kSymbols = 17;
+
+// ハフマン符号の長さの上限。復号表はこのビット数で引く
+constexpr int kMaxCodeLength = 12;
+
+std::uint64_t ElapsedNs(std::chrono::steady_clock::time_point start) {
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count());
+}
+
+// 語の値。word_size[byte]の符号なし整数として扱う
+std::uint32_t LoadWord(const unsigned char* p, int word_size) {
+  return word_size == 2 ? p[0] | (p[1] << 8) : p[0];
+}
+
+// stride語前の語との差分をzigzag符号にする。strideが0か、ブロックの先頭の列なら差分を取らない
+std::uint32_t Residual(const unsigned char* words, std::size_t i, int word_size,
+                       std::uint32_t stride) {
+  const int bits = 8 * word_size;
+  const std::uint32_t mask = (1u << bits) - 1;
+  const std::uint32_t previous = stride && i >= stride
+      ? LoadWord(words + (i - stride) * word_size, word_size) : 0;
+  const std::uint32_t delta = (LoadWord(words + i * word_size, word_size) - previous) & mask;
+  const std::uint32_t sign = delta >> (bits - 1);
+  return ((delta << 1) ^ (0u - sign)) & mask;
+}
+
+// 値のビット長。これをハフマン符号で書き、最上位以外のビットをそのまま書く
+int BitLength(std::uint32_t value) {
+  return value ? 32 - __builtin_clz(value) : 0;
+}
+
+// 記号の出現回数から、長さがkMaxCodeLength以下のハフマン符号の長さを求める
+void BuildCodeLengths(const std::uint64_t* frequencies, std::uint8_t* lengths) {
+  std::uint64_t scaled[kSymbols];
+  std::copy(frequencies, frequencies + kSymbols, scaled);
+  for (;;) {
+    // 記号が少ないので、最も少ない2つを単純に探して併合する
+    std::uint64_t weight[2 * kSymbols];
+    int parent[2 * kSymbols];
+    bool alive[2 * kSymbols] = {};
+    int nodes = 0, used = 0;
+    for (int i = 0; i < kSymbols; ++i) {
+      weight[i] = scaled[i];
+      parent[i] = -1;
+      alive[i] = scaled[i] != 0;
+      used += alive[i];
+    }
+    nodes = kSymbols;
+    std::fill(lengths, lengths + kSymbols, 0);
+    if (used == 1) {
+      for (int i = 0; i < kSymbols; ++i) if (alive[i]) lengths[i] = 1;
+      return;
+    }
+    for (int merges = 0; merges < used - 1; ++merges) {
+      int a = -1, b = -1;
+      for (int i = 0; i < nodes; ++i) {
+        if (!alive[i]) continue;
+        if (a == -1 || weight[i] < weight[a]) b = a, a = i;
+        else if (b == -1 || weight[i] < weight[b]) b = i;
+      }
+      weight[nodes] = weight[a] + weight[b];
+      parent[nodes] = -1;
+      alive[nodes] = true;
+      alive[a] = alive[b] = false;
+      parent[a] = parent[b] = nodes++;
+    }
+    int longest = 0;
+    for (int i = 0; i < kSymbols; ++i) {
+      if (!scaled[i]) continue;
+      int length = 0;
+      for (int node = i; parent[node] != -1; node = parent[node]) ++length;
+      lengths[i] = static_cast<std::uint8_t>(length);
+      longest = std::max(longest, length);
+    }
+    if (longest <= kMaxCodeLength) return;
+
+    // 長すぎれば出現回数の差を縮めて作り直す
+    for (int i = 0; i < kSymbols; ++i)
+      if (scaled[i]) scaled[i] = (scaled[i] >> 1) | 1;
+  }
+}
+
+// 符号の長さから、下位ビットから読む順に並べた正準ハフマン符号を求める
+// 長さが不正ならfalseを返す
+bool BuildCodes(const std::uint8_t* lengths, std::uint32_t* codes) {
+  std::uint32_t code = 0;
+  std::uint64_t kraft = 0;
+  for (int length = 1; length <= kMaxCodeLength; ++length) {
+    for (int symbol = 0; symbol < kSymbols; ++symbol) {
+      if (lengths[symbol] != length) continue;
+      std::uint32_t reversed = 0;
+      for (int bit = 0; bit < length; ++bit)
+        reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+      codes[symbol] = reversed;
+      kraft += 1ULL << (kMaxCodeLength - length);
+      ++code;
+    }
+    code <<= 1;
+  }
+  for (int symbol = 0; symbol < kSymbols; ++symbol)
+    if (lengths[symbol] > kMaxCodeLength) return false;
+  return kraft <= (1ULL << kMaxCodeLength);
+}
+
+// 下位ビットから順にバイト列に書く
+class BitWriter {
+ public:
+  explicit BitWriter(std::string* out) : out_(out) {}
+
+  void Put(std::uint32_t value, int bits) {
+    buffer_ |= static_cast<std::uint64_t>(value) << count_;
+    count_ += bits;
+    while (count_ >= 8) {
+      out_->push_back(static_cast<char>(buffer_));
+      buffer_ >>= 8;
+      count_ -= 8;
+    }
+  }
+
+  void Flush() {
+    if (count_ > 0) out_->push_back(static_cast<char>(buffer_));
+    buffer_ = 0;
+    count_ = 0;
+  }
+
+ private:
+  std::string* out_;
+  std::uint64_t buffer_ = 0;
+  int count_ = 0;
+};
+
+// 下位ビットから順にバイト列を読む。終端を越えた分は0として読み、越えたかを覚えておく
+class BitReader {
+ public:
+  BitReader(const unsigned char* begin, const unsigned char* end)
+      : begin_(begin), p_(begin), end_(end) {}
+
+  // 少なくとも56ビットを読める状態にする
+  void Refill() {
+    if (end_ - p_ >= 8) {
+      std::uint64_t bytes;
+      std::memcpy(&bytes, p_, sizeof(bytes));
+      buffer_ |= bytes << count_;
+      p_ += (63 - count_) >> 3;
+      count_ |= 56;
+    } else {
+      while (count_ <= 56) {
+        const std::uint64_t byte = p_ < end_ ? *p_++ : (++overrun_, 0);
+        buffer_ |= byte << count_;
+        count_ += 8;
+      }
+    }
+  }
+
+  std::uint32_t Peek(int bits) const {
+    return static_cast<std::uint32_t>(buffer_ & ((1ULL << bits) - 1));
+  }
+
+  void Skip(int bits) {
+    buffer_ >>= bits;
+    count_ -= bits;
+  }
+
+  // 終端を越えて読んでいないか
+  bool Valid() const {
+    const std::size_t consumed = (static_cast<std::size_t>(p_ - begin_) + overrun_) * 8 - count_;
+    return consumed <= static_cast<std::size_t>(end_ - begin_) * 8;
+  }
+
+ private:
+  const unsigned char* begin_;
+  const unsigned char* p_;
+  const unsigned char* end_;
+  std::uint64_t buffer_ = 0;
+  int count_ = 0;
+  std::size_t overrun_ = 0;
+};
+
+// words[0, count)をstride語前との差分で符号化した大きさ[bit]を見積もる
+// ハフマン符号の長さをlengthsに書き込む
+std::uint64_t EstimateBlock(const unsigned char* words, std::size_t count, int word_size,
+                            std::uint32_t stride, std::uint8_t* lengths) {
+  std::uint64_t frequencies[kSymbols] = {};
+  for (std::size_t i = 0; i < count; ++i)
+    ++frequencies[BitLength(Residual(words, i, word_size, stride))];
+  BuildCodeLengths(frequencies, lengths);
+  std::uint64_t bits = 0;
+  for (int symbol = 0; symbol < kSymbols; ++symbol)
+    bits += frequencies[symbol] * (lengths[symbol] + std::max(symbol - 1, 0));
+  return bits;
+}
+
+// 1ブロックを符号化してoutに追加する。差分を取るかは小さくなる方を選ぶ
+void EncodeBlock(const unsigned char* data, std::size_t size, int word_size,
+                 std::uint32_t stride, std::string* out) {
+  const std::size_t count = size / word_size;
+  std::uint8_t lengths[kSymbols];
+  std::uint64_t bits = EstimateBlock(data, count, word_size, 0, lengths);
+  std::uint32_t chosen_stride = 0;
+  if (stride && stride < count) {
+    std::uint8_t delta_lengths[kSymbols];
+    const std::uint64_t delta_bits = EstimateBlock(data, count, word_size, stride, delta_lengths);
+    if (delta_bits < bits) {
+      bits = delta_bits;
+      chosen_stride = stride;
+      std::copy(delta_lengths, delta_lengths + kSymbols, lengths);
+    }
+  }
+
+  std::uint32_t codes[kSymbols] = {};
+  BuildCodes(lengths, codes);
+
+  std::string payload(reinterpret_cast<const char*>(lengths), kSymbols);
+  payload.reserve(kSymbols + bits / 8 + 1);
+  BitWriter writer(&payload);
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::uint32_t residual = Residual(data, i, word_size, chosen_stride);
+    const int length = BitLength(residual);
+    writer.Put(codes[length], lengths[length]);
+    if (length > 1) writer.Put(residual & ((1u << (length - 1)) - 1), length - 1);
+  }
+  writer.Flush();
+
+  const std::uint32_t header[3] = {static_cast<std::uint32_t>(size),
+                                   static_cast<std::uint32_t>(payload.size()), chosen_stride};
+  const std::uint8_t word[4] = {static_cast<std::uint8_t>(word_size), 0, 0, 0};
+  out->append(reinterpret_cast<const char*>(header), sizeof(header));
+  out->append(reinterpret_cast<const char*>(word), sizeof(word));
+  out->append(payload);
+}
+
+// 復号表の値。符号と続くビットがkMaxCodeLengthビットに収まれば、値と合わせた長さを持つ
+// 収まらなければ、記号と符号の長さを持ち、続くビットを別に読む。不正な符号は0
+constexpr std::uint32_t kFullEntry = 1u << 31;
+
+// count語を復号してoutに書き込む。1語は長くても12+15ビットなので、1回の補充で2語ずつ読める
+// readerはoutへの書き込みと別名にならないよう、値で受け取ってレジスタに置く
+template <typename Word>
+bool DecodeWords(BitReader reader, const std::uint32_t* table, std::size_t count,
+                 std::uint32_t stride, char* out) {
+  const auto decode = [&](std::size_t i) {
+    const std::uint32_t entry = table[reader.Peek(kMaxCodeLength)];
+    reader.Skip((entry >> 16) & 0xFF);
+    std::uint32_t residual = entry & 0xFFFF;
+    if (!(entry & kFullEntry) && residual > 1) {
+      const int length = static_cast<int>(residual);
+      residual = (1u << (length - 1)) | reader.Peek(length - 1);
+      reader.Skip(length - 1);
+    }
+    Word value = static_cast<Word>((residual >> 1) ^ (0u - (residual & 1)));
+    if (stride && i >= stride) {
+      Word previous;
+      std::memcpy(&previous, out + (i - stride) * sizeof(Word), sizeof(Word));
+      value = static_cast<Word>(value + previous);
+    }
+    std::memcpy(out + i * sizeof(Word), &value, sizeof(Word));
+    return entry != 0;
+  };
+
+  bool valid = true;
+  std::size_t i = 0;
+  for (; i + 1 < count; i += 2) {
+    reader.Refill();
+    valid &= decode(i);
+    valid &= decode(i + 1);
+  }
+  if (i < count) {
+    reader.Refill();
+    valid &= decode(i);
+  }
+  return valid && reader.Valid();
+}
+
+// 符号化したブロックを元のraw_sizeバイトに復号してoutに書き込む。壊れていればfalseを返す
+bool DecodeBlock(const char* payload, std::size_t encoded_size, std::size_t raw_size,
+                 int word_size, std::uint32_t stride, char* out) {
+  if ((word_size != 1 && word_size != 2) || raw_size % word_size != 0 ||
+      encoded_size < kSymbols) {
+    return false;
+  }
+
+  // 符号の長さから、kMaxCodeLengthビットで引く復号表を作る
+  const std::uint8_t* lengths = reinterpret_cast<const std::uint8_t*>(payload);
+  std::uint32_t codes[kSymbols] = {};
+  if (!BuildCodes(lengths, codes)) return false;
+  std::uint32_t table[1 << kMaxCodeLength] = {};
+  for (int symbol = 0; symbol <= 8 * word_size; ++symbol) {
+    const int length = lengths[symbol];
+    if (!length) continue;
+    const int extra = std::max(symbol - 1, 0);
+    for (std::uint32_t i = codes[symbol]; i < (1u << kMaxCodeLength); i += 1u << length) {
+      if (length + extra <= kMaxCodeLength) {
+        const std::uint32_t residual = symbol == 0 ? 0
+            : (1u << extra) | ((i >> length) & ((1u << extra) - 1));
+        table[i] = kFullEntry | (length + extra) << 16 | residual;
+      } else {
+        table[i] = length << 16 | symbol;
+      }
+    }
+  }
+
+  const auto bytes = reinterpret_cast<const unsigned char*>(payload);
+  BitReader reader(bytes + kSymbols, bytes + encoded_size);
+  return word_size == 2
+      ? DecodeWords<std::uint16_t>(reader, table, raw_size / 2, stride, out)
+      : DecodeWords<std::uint8_t>(reader, table, raw_size, stride, out);
+}
+
+// 複数のスレッドで復号するブロック
+struct PendingBlock {
+  std::vector<char> payload;
+  std::uint32_t raw_size;
+  std::uint32_t stride;
+  int word_size;
+  char* out;
+};
+
+// 読み込みと復号を並行して進める1回の読み込み
+// 読み込むスレッドがブロックを読むたびにreadを進め、復号するスレッドはnextから順に取って復号する
+struct DecodeJob {
+  std::unique_ptr<PendingBlock[]> blocks;
+  std::atomic<int> read{0};
+  std::atomic<int> next{0};
+  std::atomic<bool> done{false};
+  std::atomic<bool> failed{false};
+  std::atomic<std::uint64_t> decode_ns{0};
+};
+
+// 読み込み終わったブロックを、無くなるまで復号する
+void* DecodeWorker(void* arg) {
+  DecodeJob& job = *static_cast<DecodeJob*>(arg);
+  for (int i = job.next++; ; i = job.next++) {
+    while (i >= job.read.load(std::memory_order_acquire)) {
+      if (job.done.load(std::memory_order_acquire) &&
+          i >= job.read.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      std::this_thread::yield();
+    }
+    const PendingBlock& block = job.blocks[i];
+    const auto start = std::chrono::steady_clock::now();
+    if (!DecodeBlock(block.payload.data(), block.payload.size(), block.raw_size,
+                     block.word_size, block.stride, block.out)) {
+      job.failed = true;
+    }
+    job.decode_ns += ElapsedNs(start);
+  }
+}
+
+}  // namespace
+
+// streamが圧縮形式で始まるか。読み込み位置は変えない
+bool IsCompressed(std::istream& stream) {
+  char magic[sizeof(kCompressedMagic)] = {};
+  const auto position = stream.tellg();
+  stream.read(magic, sizeof(magic));
+  const bool compressed = stream.gcount() == sizeof(magic) &&
+      std::memcmp(magic, kCompressedMagic, sizeof(magic)) == 0;
+  stream.clear();
+  stream.seekg(position);
+  return compressed;
+}
+
+// dataをsectionsに分けて圧縮し、streamに書き込む
+bool WriteCompressed(std::ostream& stream, const std::string& data,
+                     const std::vector<CompressedSection>& sections) {
+  std::string blocks;
+  std::uint32_t block_count = 0;
+  std::size_t offset = 0;
+  for (const auto& section : sections) {
+    if (offset + section.bytes > data.size() || section.bytes % section.word_size != 0)
+      return false;
+    // ブロックの大きさを語の大きさと列の数の倍数に揃え、列を途中で切らない
+    const std::size_t row = section.word_size * std::max<std::size_t>(section.stride, 1);
+    if (row > kBlockSize) return false;
+    const std::size_t block_size = std::max(kBlockSize / row, std::size_t(1)) * row;
+    for (std::size_t begin = 0; begin < section.bytes; begin += block_size) {
+      const std::size_t size = std::min(block_size, section.bytes - begin);
+      EncodeBlock(reinterpret_cast<const unsigned char*>(data.data() + offset + begin), size,
+                  section.word_size, section.stride, &blocks);
+      ++block_count;
+    }
+    offset += section.bytes;
+  }
+  if (offset != data.size()) return false;
+
+  CompressedHeader header = {};
+  std::memcpy(header.magic, kCompressedMagic, sizeof(header.magic));
+  header.version = kCompressedVersion;
+  header.block_count = block_count;
+  header.raw_size = data.size();
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(blocks.data(), blocks.size());
+  return !stream.fail();
+}
+
+DecompressingStreamBuf::DecompressingStreamBuf(std::istream& source, int threads)
+    : source_(source),
+      threads_(threads > 0 ? threads
+                           : std::max(1, static_cast<int>(std::thread::hardware_concurrency()))) {
+  CompressedHeader header;
+  source_.read(reinterpret_cast<char*>(&header), sizeof(header));
+  failed_ = !source_ ||
+      std::memcmp(header.magic, kCompressedMagic, sizeof(header.magic)) != 0 ||
+      header.version != kCompressedVersion;
+  remaining_blocks_ = failed_ ? 0 : header.block_count;
+}
+
+// 次のブロックのヘッダをnext_に読み込む。もう無ければfalseを返す
+bool DecompressingStreamBuf::PeekBlock() {
+  if (has_next_) return true;
+  if (failed_ || remaining_blocks_ == 0) return false;
+  const auto start = std::chrono::steady_clock::now();
+  source_.read(reinterpret_cast<char*>(&next_), sizeof(next_));
+  stats_.read_ns += ElapsedNs(start);
+  if (!source_ || next_.raw_size == 0 || next_.raw_size > kBlockSize ||
+      next_.encoded_size > kSymbols + 4 * kBlockSize) {
+    failed_ = true;
+    return false;
+  }
+  has_next_ = true;
+  return true;
+}
+
+// 1ブロックずつ復号する
+DecompressingStreamBuf::int_type DecompressingStreamBuf::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  if (!PeekBlock()) return traits_type::eof();
+
+  auto start = std::chrono::steady_clock::now();
+  payload_.resize(next_.encoded_size);
+  source_.read(payload_.data(), payload_.size());
+  stats_.read_ns += ElapsedNs(start);
+  block_.resize(next_.raw_size);
+  has_next_ = false;
+  --remaining_blocks_;
+
+  start = std::chrono::steady_clock::now();
+  if (!source_ || !DecodeBlock(payload_.data(), payload_.size(), next_.raw_size,
+                               next_.word_size, next_.stride, block_.data())) {
+    failed_ = true;
+    return traits_type::eof();
+  }
+  stats_.decode_ns += ElapsedNs(start);
+  ++stats_.blocks;
+
+  setg(block_.data(), block_.data(), block_.data() + block_.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize DecompressingStreamBuf::xsgetn(char* s, std::streamsize n) {
+  std::streamsize copied = 0;
+  while (copied < n) {
+    if (gptr() == egptr()) {
+      // 丸ごと収まるブロックは、復号した結果をコピーせず読み込み先に直接書く
+      copied += DecodeBlocks(s + copied, n - copied);
+      if (copied == n || failed_ || underflow() == traits_type::eof()) break;
+    }
+    const std::streamsize count = std::min<std::streamsize>(n - copied, egptr() - gptr());
+    std::memcpy(s + copied, gptr(), count);
+    gbump(static_cast<int>(count));
+    copied += count;
+  }
+  return copied;
+}
+
+// 収まるだけのブロックをsに直接復号し、復号したバイト数を返す
+// このスレッドが符号化したブロックを順に読み込み、読み込んだものから他のスレッドと共に復号する
+std::streamsize DecompressingStreamBuf::DecodeBlocks(char* s, std::streamsize n) {
+  if (!PeekBlock() || next_.raw_size > n) return 0;
+
+  DecodeJob job;
+  job.blocks.reset(new PendingBlock[remaining_blocks_]);
+  const int helpers = static_cast<int>(std::min<std::streamsize>(
+      {threads_, n / next_.raw_size, remaining_blocks_})) - 1;
+  std::vector<pthread_t> pthreads(std::max(helpers, 0));
+  for (auto& thread : pthreads)
+    pthread_create(&thread, NULL, DecodeWorker, &job);
+
+  std::streamsize decoded = 0;
+  for (int i = 0; PeekBlock() && next_.raw_size <= n - decoded; ++i) {
+    PendingBlock& block = job.blocks[i];
+    block.raw_size = next_.raw_size;
+    block.stride = next_.stride;
+    block.word_size = next_.word_size;
+    block.out = s + decoded;
+    block.payload.resize(next_.encoded_size);
+    const auto start = std::chrono::steady_clock::now();
+    source_.read(block.payload.data(), block.payload.size());
+    stats_.read_ns += ElapsedNs(start);
+    has_next_ = false;
+    --remaining_blocks_;
+    if (!source_) {
+      failed_ = true;
+      break;
+    }
+    decoded += block.raw_size;
+    job.read.store(i + 1, std::memory_order_release);
+  }
+  job.done.store(true, std::memory_order_release);
+
+  // 読み込み終えたら、このスレッドも復号に加わる
+  DecodeWorker(&job);
+  for (auto& thread : pthreads)
+    pthread_join(thread, NULL);
+
+  stats_.decode_ns += job.decode_ns;
+  stats_.blocks += job.read;
+  if (job.failed) failed_ = true;
+  return failed_ ? 0 : decoded;
+}
+
+}  // namespace NNUE
+
+}  // namespace Eval
+
+#endif  // defined(EVAL_NNUE)
@@ -0,0 +1,98 @@
+﻿// NNUE評価関数ファイルの圧縮形式
+
+#ifndef _NNUE_COMPRESSION_H_
+#define _NNUE_COMPRESSION_H_
+
+#if defined(EVAL_NNUE)
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace Eval {
+
+namespace NNUE {
+
+// 圧縮形式は、評価関数ファイルのバイト列を区間に分け、区間ごとに決めた語の大きさで
+// ブロック単位に符号化したもの。外部のライブラリは使わない
+// ブロックは独立に復号できるので、大きな読み込みは複数のスレッドで復号する
+//
+// ファイル: CompressedHeader、(BlockHeader、符号化したブロック) × block_count
+// ブロック: 各語とstride語前の語(列)との差分をzigzag符号にして、そのビット長を
+//           ハフマン符号で、最上位以外のビットをそのまま書く
+
+// 圧縮する区間。bytes[byte]を大きさword_size[byte]の語に分け、stride語前との差分で符号化する
+// strideが0なら差分を取らない
+struct CompressedSection {
+  std::size_t bytes;
+  int word_size;
+  std::uint32_t stride;
+};
+
+// 圧縮形式を読み込むときの時間の内訳
+struct DecompressionStats {
+  std::uint64_t read_ns = 0;    // 元のストリームから符号化したブロックを読み込んだ時間
+  std::uint64_t decode_ns = 0;  // ブロックを復号した時間。全スレッドの合計
+  std::uint64_t blocks = 0;     // 復号したブロック数
+};
+
+// streamが圧縮形式で始まるか。読み込み位置は変えない
+bool IsCompressed(std::istream& stream);
+
+// dataをsectionsに分けて圧縮し、streamに書き込む
+// sectionsの大きさの合計はdataの大きさと同じでなければならない
+bool WriteCompressed(std::ostream& stream, const std::string& data,
+                     const std::vector<CompressedSection>& sections);
+
+// 圧縮形式のストリームを、元の評価関数ファイルのバイト列として読むためのバッファ
+// 少しずつ読むときは1ブロックずつ復号し、ブロックより大きな読み込みは
+// 読み込み先に直接、最大threads個のスレッドで復号する
+class DecompressingStreamBuf : public std::streambuf {
+ public:
+  explicit DecompressingStreamBuf(std::istream& source, int threads = 0);
+
+  // 壊れたデータを見つけたか
+  bool Failed() const { return failed_; }
+
+  const DecompressionStats& Stats() const { return stats_; }
+
+ protected:
+  int_type underflow() override;
+  std::streamsize xsgetn(char* s, std::streamsize n) override;
+
+ private:
+  struct BlockHeader {
+    std::uint32_t raw_size;
+    std::uint32_t encoded_size;
+    std::uint32_t stride;
+    std::uint8_t word_size;
+    std::uint8_t reserved[3];
+  };
+
+  // 次のブロックのヘッダをnext_に読み込む。もう無ければfalseを返す
+  bool PeekBlock();
+
+  // 収まるだけのブロックをsに直接復号し、復号したバイト数を返す
+  std::streamsize DecodeBlocks(char* s, std::streamsize n);
+
+  std::istream& source_;
+  int threads_;
+  bool failed_ = false;
+  std::uint32_t remaining_blocks_ = 0;
+  bool has_next_ = false;
+  BlockHeader next_ = {};
+  std::vector<char> payload_;
+  std::vector<char> block_;
+  DecompressionStats stats_;
+};
+
+}  // namespace NNUE
+
+}  // namespace Eval
+
+#endif  // defined(EVAL_NNUE)
+
+#endif
@@ -7,19 +7,60 @@
 
 #include "nnue_common.h"
 #include "nnue_architecture.h"
+#include "nnue_accumulator.h"
+#include "nnue_kernels.h"
 #include "features/index_list.h"
+#include "../../bitboard.h"
 
+#include <cmath>
 #include <cstring> // std::memset()
 
 namespace Eval {
 
 namespace NNUE {
 
+// 入力特徴量変換器の重みに掛ける倍率
+// 16bitの重みはそのまま足すので倍率を持たない
+template <typename WeightType>
+struct FeatureWeightScale {
+  static constexpr std::int16_t weight_scale_ = 1;
+};
+
+// 8bitに量子化した重みは、評価関数ファイルごとの倍率を掛けて16bitに戻す
+template <>
+struct FeatureWeightScale<std::int8_t> {
+  std::int16_t weight_scale_;
+};
+
 // 入力特徴量変換器
-class FeatureTransformer {
+// Architectureの入力特徴量と次元数で実体化する
+template <typename Architecture>
+class FeatureTransformer
+    : private FeatureWeightScale<typename Architecture::FeatureWeightType> {
  private:
+  // 評価関数で用いる入力特徴量
+  using RawFeatures = typename Architecture::RawFeatures;
+
+  // 玉の位置ごとの累積値のキャッシュ
+  using Cache = RefreshCache<Architecture>;
+
+  // 差分計算の代わりに全計算を行うタイミングのリスト
+  static constexpr auto kRefreshTriggers = RawFeatures::kRefreshTriggers;
+
   // 片側分の出力の次元数
-  static constexpr IndexType kHalfDimensions = kTransformedFeatureDimensions;
+  static constexpr IndexType kHalfDimensions =
+      Architecture::kTransformedFeatureDimensions;
+  static_assert(kHalfDimensions % kMaxSimdWidth == 0, "");
+
+  // 差分計算で遡る手数の上限
+  static constexpr int kMaxUpdatePlies = 32;
+
+  // 重みを8bitに量子化しているか
+  static constexpr bool kQuantized =
+      std::is_same<typename Architecture::FeatureWeightType, std::int8_t>::value;
+
+  // 量子化した重みの評価関数ファイルで、ハッシュ値に混ぜる値
+  static constexpr std::uint32_t kQuantizedHashValue = 0x51A8D3E7u;
 
  public:
   // 出力の型
@@ -33,22 +74,33 @@ class FeatureTransformer {
   static constexpr std::size_t kBufferSize =
       kOutputDimensions * sizeof(OutputType);
 
+  // 1局面の累積値の要素数
+  static constexpr IndexType kAccumulationSize =
+      2 * kRefreshTriggers.size() * kHalfDimensions;
+  static_assert(kAccumulationSize <= AllArchitectures::kMaxAccumulationSize, "");
+
   // 評価関数ファイルに埋め込むハッシュ値
   static constexpr std::uint32_t GetHashValue() {
-    return RawFeatures::kHashValue ^ kOutputDimensions;
+    return RawFeatures::kHashValue ^ kOutputDimensions ^
+        (kQuantized ? kQuantizedHashValue : 0);
   }
 
   // 構造を表す文字列
   static std::string GetStructureString() {
     return RawFeatures::GetName() + "[" +
         std::to_string(kInputDimensions) + "->" +
-        std::to_string(kHalfDimensions) + "x2]";
+        std::to_string(kHalfDimensions) + "x2" + (kQuantized ? ",int8" : "") + "]";
   }
 
   // パラメータを読み込む
+  // 量子化した重みの場合は、バイアスと重みの間に倍率がある
   bool ReadParameters(std::istream& stream) {
     stream.read(reinterpret_cast<char*>(biases_),
                 kHalfDimensions * sizeof(BiasType));
+    if constexpr (kQuantized) {
+      stream.read(reinterpret_cast<char*>(&this->weight_scale_),
+                  sizeof(this->weight_scale_));
+    }
     stream.read(reinterpret_cast<char*>(weights_),
                 kHalfDimensions * kInputDimensions * sizeof(WeightType));
     return !stream.fail();
@@ -58,173 +110,290 @@ class FeatureTransformer {
   bool WriteParameters(std::ostream& stream) const {
     stream.write(reinterpret_cast<const char*>(biases_),
                  kHalfDimensions * sizeof(BiasType));
+    if constexpr (kQuantized) {
+      stream.write(reinterpret_cast<const char*>(&this->weight_scale_),
+                   sizeof(this->weight_scale_));
+    }
     stream.write(reinterpret_cast<const char*>(weights_),
                  kHalfDimensions * kInputDimensions * sizeof(WeightType));
     return !stream.fail();
   }
 
   // 可能なら差分計算を進める
-  bool UpdateAccumulatorIfPossible(const Position& pos) const {
+  // 直前の局面に限らず、累積値が計算済みの局面まで遡ってその間の差分を順に適用する
+  // 差分の列の数が全計算で足す列の数（盤上の駒の数）以上になるなら諦めて全計算させる
+  // 累積値は各局面のslotの評価関数用のものを読み書きする
+  bool UpdateAccumulatorIfPossible(const Position& pos, NetworkSlot slot,
+                                   Cache* cache = nullptr,
+                                   EvalStats* stats = nullptr) const {
     const auto now = pos.state();
-    if (now->accumulator.computed_accumulation) {
+    if (now->accumulators[slot].computed_accumulation) {
       return true;
     }
+    const int refresh_cost = PopCount(pos.pieceBB[ALL]);
+    const StateInfo* path[kMaxUpdatePlies];
+    int plies = 0;
+    int cost = 0;
+    for (const StateInfo* st = now; !st->accumulators[slot].computed_accumulation;
+         st = st->previous) {
+      cost += 2 * st->dirtyPiece.dirty_num;
+      if (!st->previous || plies == kMaxUpdatePlies || cost >= refresh_cost) {
+        return false;
+      }
+      path[plies++] = st;
+    }
+    UpdateAccumulator(pos, slot, path, plies, cache);
+    if (stats) {
+      ++stats->update_calls;
+      stats->update_plies += plies;
+    }
+    return true;
+  }
+
+  // 差分計算で読み書きする重みの列と累積値を先読みする
+  // 指し手を指した直後に呼び出し、キャッシュミスを合法手チェックなどと重ねる
+  void PrefetchUpdate(const Position& pos, NetworkSlot slot) const {
+    const auto now = pos.state();
     const auto prev = now->previous;
-    if (prev && prev->accumulator.computed_accumulation) {
-      UpdateAccumulator(pos);
-      return true;
+    if (!prev || !prev->accumulators[slot].computed_accumulation) {
+      return;
+    }
+    for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+      Features::IndexList removed_indices[2], added_indices[2];
+      bool reset[2];
+      RawFeatures::AppendChangedIndices(pos, now, kRefreshTriggers[i],
+                                        removed_indices, added_indices, reset);
+      for (const auto perspective : Colors) {
+        if (reset[perspective]) continue;
+        for (const auto index : removed_indices[perspective]) {
+          PrefetchColumn(index);
+        }
+        for (const auto index : added_indices[perspective]) {
+          PrefetchColumn(index);
+        }
+      }
+    }
+    const char* accumulation = reinterpret_cast<const char*>(now->accumulators[slot].accumulation);
+    for (std::size_t j = 0; j < kAccumulationSize * sizeof(BiasType); j += kCacheLineSize) {
+      __builtin_prefetch(accumulation + j, 1);
     }
-    return false;
   }
 
-  // 入力特徴量を変換する
-  void Transform(const Position& pos, OutputType* output, bool refresh) const {
-    if (refresh || !UpdateAccumulatorIfPossible(pos)) {
-      RefreshAccumulator(pos);
+  // SIMDの経路の検証用に、スカラーの経路で累積値を一から計算して入力特徴量を変換する
+  void TransformReference(const Position& pos, OutputType* output,
+                          Accumulator* accumulator) const {
+    for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+      Features::IndexList active_indices[2];
+      RawFeatures::AppendActiveIndices(pos, kRefreshTriggers[i],
+                                       active_indices);
+      for (const auto perspective : Colors) {
+        for (IndexType j = 0; j < kHalfDimensions; ++j) {
+          Accumulation(*accumulator, perspective, i)[j] = i == 0 ? biases_[j] : 0;
+        }
+        for (const auto index : active_indices[perspective]) {
+          const IndexType offset = kHalfDimensions * index;
+          for (IndexType j = 0; j < kHalfDimensions; ++j) {
+            Accumulation(*accumulator, perspective, i)[j] +=
+                weights_[offset + j] * this->weight_scale_;
+          }
+        }
+      }
     }
-    const auto& accumulation = pos.state()->accumulator.accumulation;
-#if defined(USE_AVX2)
-    constexpr IndexType kNumChunks = kHalfDimensions / kSimdWidth;
-    constexpr int kControl = 0b11011000;
-    const __m256i kZero = _mm256_setzero_si256();
-#elif defined(USE_SSE41)
-    constexpr IndexType kNumChunks = kHalfDimensions / kSimdWidth;
-    const __m128i kZero = _mm_setzero_si128();
-#elif defined(IS_ARM)
-    constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-    const int8x8_t kZero = {0};
-#endif
     const Color perspectives[2] = {pos.side_to_move(), ~pos.side_to_move()};
     for (IndexType p = 0; p < 2; ++p) {
       const IndexType offset = kHalfDimensions * p;
-#if defined(USE_AVX2)
-      auto out = reinterpret_cast<__m256i*>(&output[offset]);
-      for (IndexType j = 0; j < kNumChunks; ++j) {
-        __m256i sum0 =
-#if defined(__MINGW32__) || defined(__MINGW64__)
-          // HACK: Use _mm256_loadu_si256() instead of _mm256_load_si256. Because the binary
-          //       compiled with g++ in MSYS2 crashes here because the output memory is not aligned
-          //       even though alignas is specified.
-          _mm256_loadu_si256
-#else
-          _mm256_load_si256
-#endif
-          (&reinterpret_cast<const __m256i*>(
-            accumulation[perspectives[p]][0])[j * 2 + 0]);
-        __m256i sum1 =
-#if defined(__MINGW32__) || defined(__MINGW64__)
-          _mm256_loadu_si256
-#else
-          _mm256_load_si256
-#endif
-          (&reinterpret_cast<const __m256i*>(
-            accumulation[perspectives[p]][0])[j * 2 + 1]);
+      for (IndexType j = 0; j < kHalfDimensions; ++j) {
+        BiasType sum = Accumulation(*accumulator, perspectives[p], 0)[j];
         for (IndexType i = 1; i < kRefreshTriggers.size(); ++i) {
-          sum0 = _mm256_add_epi16(sum0, reinterpret_cast<const __m256i*>(
-              accumulation[perspectives[p]][i])[j * 2 + 0]);
-          sum1 = _mm256_add_epi16(sum1, reinterpret_cast<const __m256i*>(
-              accumulation[perspectives[p]][i])[j * 2 + 1]);
+          sum += Accumulation(*accumulator, perspectives[p], i)[j];
         }
-#if defined(__MINGW32__) || defined(__MINGW64__)
-        _mm256_storeu_si256
-#else
-        _mm256_store_si256
-#endif
-        (&out[j], _mm256_permute4x64_epi64(_mm256_max_epi8(
-            _mm256_packs_epi16(sum0, sum1), kZero), kControl));
+        output[offset + j] = static_cast<OutputType>(
+            std::max<int>(0, std::min<int>(127, sum)));
       }
-#elif defined(USE_SSE41)
-      auto out = reinterpret_cast<__m128i*>(&output[offset]);
-      for (IndexType j = 0; j < kNumChunks; ++j) {
-        __m128i sum0 = _mm_load_si128(&reinterpret_cast<const __m128i*>(
-            accumulation[perspectives[p]][0])[j * 2 + 0]);
-        __m128i sum1 = _mm_load_si128(&reinterpret_cast<const __m128i*>(
-            accumulation[perspectives[p]][0])[j * 2 + 1]);
-        for (IndexType i = 1; i < kRefreshTriggers.size(); ++i) {
-          sum0 = _mm_add_epi16(sum0, reinterpret_cast<const __m128i*>(
-              accumulation[perspectives[p]][i])[j * 2 + 0]);
-          sum1 = _mm_add_epi16(sum1, reinterpret_cast<const __m128i*>(
-              accumulation[perspectives[p]][i])[j * 2 + 1]);
+    }
+  }
+
+  // 玉の位置ごとのキャッシュを、駒のない盤面での累積値で初期化する
+  void ResetRefreshCache(Cache* cache) const {
+    for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+      if (!Features::IsKingRelative(kRefreshTriggers[i])) continue;
+      for (auto& entries : cache->entries[Cache::KingRelativeTriggerSlot(i)]) {
+        for (auto& entry : entries) {
+          if (i == 0) {
+            std::memcpy(entry.accumulation, biases_,
+                        kHalfDimensions * sizeof(BiasType));
+          } else {
+            std::memset(entry.accumulation, 0,
+                        kHalfDimensions * sizeof(BiasType));
+          }
+          std::memset(entry.colorBB, 0, sizeof(entry.colorBB));
+          std::memset(entry.pieceBB, 0, sizeof(entry.pieceBB));
         }
-        _mm_store_si128(&out[j], _mm_max_epi8(
-            _mm_packs_epi16(sum0, sum1), kZero));
       }
-#elif defined(IS_ARM)
-      const auto out = reinterpret_cast<int8x8_t*>(&output[offset]);
-      for (IndexType j = 0; j < kNumChunks; ++j) {
-        int16x8_t sum = reinterpret_cast<const int16x8_t*>(
-            accumulation[perspectives[p]][0])[j];
-        for (IndexType i = 1; i < kRefreshTriggers.size(); ++i) {
-          sum = vaddq_s16(sum, reinterpret_cast<const int16x8_t*>(
-              accumulation[perspectives[p]][i])[j]);
-        }
-        out[j] = vmax_s8(vqmovn_s16(sum), kZero);
+    }
+  }
+
+  // 16bitの重みを持つsourceのパラメータを、重みを8bitに量子化して写す
+  // 倍率は重みの絶対値の最大が127に収まる最小の整数にし、各重みは倍率で割って丸める
+  template <typename SourceArchitecture>
+  void Quantize(const FeatureTransformer<SourceArchitecture>& source) {
+    static_assert(kQuantized, "");
+    static_assert(sizeof(source.weights_) == 2 * sizeof(weights_), "");
+    int max_weight = 0;
+    for (const auto weight : source.weights_) {
+      max_weight = std::max(max_weight, std::abs(static_cast<int>(weight)));
+    }
+    const int scale = std::max(1, (max_weight + 126) / 127);
+    this->weight_scale_ = static_cast<std::int16_t>(scale);
+    std::memcpy(biases_, source.biases_, sizeof(biases_));
+    for (IndexType i = 0; i < kHalfDimensions * kInputDimensions; ++i) {
+      weights_[i] = static_cast<WeightType>(std::lround(
+          static_cast<double>(source.weights_[i]) / scale));
+    }
+  }
+
+  // 差分計算を用いずに累積値を計算する
+  // cacheを渡すと、玉に相対的な特徴量はキャッシュとの差分から計算する
+  void Refresh(const Position& pos, NetworkSlot slot, Cache* cache = nullptr) const {
+    RefreshAccumulator(pos, slot, cache);
+  }
+
+  // 入力特徴量を変換する
+  // cacheを渡すと、玉が動いた時の全計算をキャッシュとの差分計算で代える
+  void Transform(const Position& pos, NetworkSlot slot, OutputType* output,
+                 bool refresh, Cache* cache = nullptr,
+                 EvalStats* stats = nullptr) const {
+    if (refresh || !UpdateAccumulatorIfPossible(pos, slot, cache, stats)) {
+      RefreshAccumulator(pos, slot, cache);
+      if (stats) {
+        ++stats->refresh_calls;
       }
-#else
-      for (IndexType j = 0; j < kHalfDimensions; ++j) {
-        BiasType sum = accumulation[static_cast<int>(perspectives[p])][0][j];
+    }
+    const auto& accumulator = pos.state()->accumulators[slot];
+    const Color perspectives[2] = {pos.side_to_move(), ~pos.side_to_move()};
+    for (IndexType p = 0; p < 2; ++p) {
+      const IndexType offset = kHalfDimensions * p;
+      if constexpr (kRefreshTriggers.size() == 1) {
+        Kernels::Pack<kHalfDimensions>(&output[offset],
+                                       Accumulation(accumulator, perspectives[p], 0));
+      } else {
+        alignas(kCacheLineSize) BiasType sum[kHalfDimensions];
+        std::memcpy(sum, Accumulation(accumulator, perspectives[p], 0), sizeof(sum));
         for (IndexType i = 1; i < kRefreshTriggers.size(); ++i) {
-          sum += accumulation[static_cast<int>(perspectives[p])][i][j];
+          Kernels::AddColumn<kHalfDimensions>(
+              sum, Accumulation(accumulator, perspectives[p], i));
         }
-        output[offset + j] = static_cast<OutputType>(
-            std::max<int>(0, std::min<int>(127, sum)));
+        Kernels::Pack<kHalfDimensions>(&output[offset], sum);
       }
-#endif
     }
   }
 
  private:
+  // 累積値のうち、視点perspectiveのkRefreshTriggers[i]の分
+  static std::int16_t* Accumulation(Accumulator& accumulator,
+                                    Color perspective, IndexType i) {
+    return &accumulator.accumulation[
+        (perspective * kRefreshTriggers.size() + i) * kHalfDimensions];
+  }
+  static const std::int16_t* Accumulation(const Accumulator& accumulator,
+                                          Color perspective, IndexType i) {
+    return &accumulator.accumulation[
+        (perspective * kRefreshTriggers.size() + i) * kHalfDimensions];
+  }
+
+  // 特徴量indexに対応する重みの列を先読みする
+  void PrefetchColumn(IndexType index) const {
+    const char* column = reinterpret_cast<const char*>(&weights_[kHalfDimensions * index]);
+    for (std::size_t j = 0; j < kHalfDimensions * sizeof(WeightType); j += kCacheLineSize) {
+      __builtin_prefetch(column + j);
+    }
+  }
+
+  // 前の累積値inputに、removedの列を引いてaddedの列を足した値をoutputに書き込む
+  void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                     const IndexType* removed, IndexType num_removed,
+                     const IndexType* added, IndexType num_added) const {
+    if constexpr (kQuantized) {
+      Kernels::UpdateColumns<kHalfDimensions>(
+          output, input, weights_, this->weight_scale_,
+          removed, num_removed, added, num_added);
+    } else {
+      Kernels::UpdateColumns<kHalfDimensions>(
+          output, input, weights_, removed, num_removed, added, num_added);
+    }
+  }
+
+  // 現在の局面から見たBonaPiece
+  static BonaPiece MakeBonaPiece(Color perspective, Piece pc, Square sq) {
+    return static_cast<BonaPiece>(perspective == BLACK ?
+        kpp_board_index[pc].fb + Inv(sq) : kpp_board_index[pc].fw + sq);
+  }
+
+  // 玉の位置ごとのキャッシュに保存した駒の配置との差分から累積値を計算する
+  void RefreshFromCache(const Position& pos, IndexType i, Color perspective,
+                        Cache* cache, std::int16_t* accumulation) const {
+    const Color king_color =
+        kRefreshTriggers[i] == Features::TriggerEvent::kFriendKingMoved ?
+        perspective : ~perspective;
+    const Square sq_k = Lsb(pos.colorBB[king_color] & pos.pieceBB[KING]);
+    auto& entry = cache->entries[Cache::KingRelativeTriggerSlot(i)][perspective][sq_k];
+
+    BonaPiece removed_pieces[PIECE_NUMBER_KING], added_pieces[PIECE_NUMBER_KING];
+    int removed_count = 0, added_count = 0;
+    for (const auto c : Colors) {
+      for (PieceType pt = PAWN; pt < KING; ++pt) {
+        const Bitboard now = pos.colorBB[c] & pos.pieceBB[pt];
+        const Bitboard cached = entry.colorBB[c] & entry.pieceBB[pt];
+        const Piece pc = MakePiece(c, pt);
+        for (Bitboard bb = cached & ~now; bb; ) {
+          removed_pieces[removed_count++] = MakeBonaPiece(perspective, pc, PopLsb(&bb));
+        }
+        for (Bitboard bb = now & ~cached; bb; ) {
+          added_pieces[added_count++] = MakeBonaPiece(perspective, pc, PopLsb(&bb));
+        }
+      }
+    }
+    Features::IndexList removed_indices{}, added_indices{};
+    RawFeatures::AppendPieceIndices(pos, kRefreshTriggers[i], perspective,
+                                    removed_pieces, removed_count, &removed_indices);
+    RawFeatures::AppendPieceIndices(pos, kRefreshTriggers[i], perspective,
+                                    added_pieces, added_count, &added_indices);
+    UpdateColumns(entry.accumulation, entry.accumulation,
+                  removed_indices.begin(), removed_indices.size(),
+                  added_indices.begin(), added_indices.size());
+    std::memcpy(entry.colorBB, pos.colorBB, sizeof(entry.colorBB));
+    std::memcpy(entry.pieceBB, pos.pieceBB, sizeof(entry.pieceBB));
+    std::memcpy(accumulation, entry.accumulation,
+                kHalfDimensions * sizeof(BiasType));
+  }
+
+  // 有効な特徴量の列だけから累積値を計算する
+  void RefreshFromScratch(IndexType i, const Features::IndexList& active,
+                          std::int16_t* accumulation) const {
+    if (i != 0) {
+      std::memset(accumulation, 0, kHalfDimensions * sizeof(BiasType));
+    }
+    UpdateColumns(accumulation, i == 0 ? biases_ : accumulation,
+                  nullptr, 0, active.begin(), active.size());
+  }
+
   // 差分計算を用いずに累積値を計算する
-  void RefreshAccumulator(const Position& pos) const {
-    auto& accumulator = pos.state()->accumulator;
+  void RefreshAccumulator(const Position& pos, NetworkSlot slot, Cache* cache) const {
+    auto& accumulator = pos.state()->accumulators[slot];
     for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+      if (cache && Features::IsKingRelative(kRefreshTriggers[i])) {
+        for (const auto perspective : Colors) {
+          RefreshFromCache(pos, i, perspective, cache,
+                           Accumulation(accumulator, perspective, i));
+        }
+        continue;
+      }
       Features::IndexList active_indices[2];
       RawFeatures::AppendActiveIndices(pos, kRefreshTriggers[i],
                                        active_indices);
       for (const auto perspective : Colors) {
-        if (i == 0) {
-          std::memcpy(accumulator.accumulation[perspective][i], biases_,
-                      kHalfDimensions * sizeof(BiasType));
-        } else {
-          std::memset(accumulator.accumulation[perspective][i], 0,
-                      kHalfDimensions * sizeof(BiasType));
-        }
-        for (const auto index : active_indices[perspective]) {
-          const IndexType offset = kHalfDimensions * index;
-#if defined(USE_AVX2)
-          auto accumulation = reinterpret_cast<__m256i*>(
-              &accumulator.accumulation[perspective][i][0]);
-          auto column = reinterpret_cast<const __m256i*>(&weights_[offset]);
-          constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-          for (IndexType j = 0; j < kNumChunks; ++j) {
-#if defined(__MINGW32__) || defined(__MINGW64__)
-            _mm256_storeu_si256(&accumulation[j], _mm256_add_epi16(_mm256_loadu_si256(&accumulation[j]), column[j]));
-#else
-            accumulation[j] = _mm256_add_epi16(accumulation[j], column[j]);
-#endif
-          }
-#elif defined(USE_SSE2)
-          auto accumulation = reinterpret_cast<__m128i*>(
-              &accumulator.accumulation[perspective][i][0]);
-          auto column = reinterpret_cast<const __m128i*>(&weights_[offset]);
-          constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-          for (IndexType j = 0; j < kNumChunks; ++j) {
-            accumulation[j] = _mm_add_epi16(accumulation[j], column[j]);
-          }
-#elif defined(IS_ARM)
-          auto accumulation = reinterpret_cast<int16x8_t*>(
-              &accumulator.accumulation[perspective][i][0]);
-          auto column = reinterpret_cast<const int16x8_t*>(&weights_[offset]);
-          constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-          for (IndexType j = 0; j < kNumChunks; ++j) {
-            accumulation[j] = vaddq_s16(accumulation[j], column[j]);
-          }
-#else
-          for (IndexType j = 0; j < kHalfDimensions; ++j) {
-            accumulator.accumulation[perspective][i][j] += weights_[offset + j];
-          }
-#endif
-        }
+        RefreshFromScratch(i, active_indices[perspective],
+                           Accumulation(accumulator, perspective, i));
       }
     }
 
@@ -233,92 +402,53 @@ class FeatureTransformer {
   }
 
   // 差分計算を用いて累積値を計算する
-  void UpdateAccumulator(const Position& pos) const {
-    const auto prev_accumulator = pos.state()->previous->accumulator;
-    auto& accumulator = pos.state()->accumulator;
+  // path[plies - 1]の一手前が計算済みの局面で、そこから現在の局面まで差分を順に適用する
+  void UpdateAccumulator(const Position& pos, NetworkSlot slot,
+                         const StateInfo* const* path, int plies, Cache* cache) const {
+    const auto& prev_accumulator = path[plies - 1]->previous->accumulators[slot];
+    auto& accumulator = pos.state()->accumulators[slot];
     for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+      // 全ての手の差分を視点ごとに集めてから、一度にまとめて適用する
       Features::IndexList removed_indices[2], added_indices[2];
-      bool reset[2];
-      RawFeatures::AppendChangedIndices(pos, kRefreshTriggers[i],
-                                        removed_indices, added_indices, reset);
-      for (const auto perspective : Colors) {
-#if defined(USE_AVX2)
-        constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-        auto accumulation = reinterpret_cast<__m256i*>(
-            &accumulator.accumulation[perspective][i][0]);
-#elif defined(USE_SSE2)
-        constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-        auto accumulation = reinterpret_cast<__m128i*>(
-            &accumulator.accumulation[perspective][i][0]);
-#elif defined(IS_ARM)
-        constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth / 2);
-        auto accumulation = reinterpret_cast<int16x8_t*>(
-            &accumulator.accumulation[perspective][i][0]);
-#endif
-        if (reset[perspective]) {
-          if (i == 0) {
-            std::memcpy(accumulator.accumulation[perspective][i], biases_,
-                        kHalfDimensions * sizeof(BiasType));
-          } else {
-            std::memset(accumulator.accumulation[perspective][i], 0,
-                        kHalfDimensions * sizeof(BiasType));
+      bool reset[2] = {false, false};
+      for (int ply = plies - 1; ply >= 0; --ply) {
+        Features::IndexList ply_removed[2], ply_added[2];
+        bool ply_reset[2];
+        RawFeatures::AppendChangedIndices(pos, path[ply], kRefreshTriggers[i],
+                                          ply_removed, ply_added, ply_reset);
+        for (const auto perspective : Colors) {
+          if (reset[perspective]) continue;
+          // 途中で玉が動いた視点は、現在の局面で有効な特徴量から全計算する
+          if (ply_reset[perspective]) {
+            reset[perspective] = true;
+            added_indices[perspective] = ply_added[perspective];
+            continue;
           }
-        } else {  // 1から0に変化した特徴量に関する差分計算
-          std::memcpy(accumulator.accumulation[perspective][i],
-                      prev_accumulator.accumulation[perspective][i],
-                      kHalfDimensions * sizeof(BiasType));
-          for (const auto index : removed_indices[perspective]) {
-            const IndexType offset = kHalfDimensions * index;
-#if defined(USE_AVX2)
-            auto column = reinterpret_cast<const __m256i*>(&weights_[offset]);
-            for (IndexType j = 0; j < kNumChunks; ++j) {
-              accumulation[j] = _mm256_sub_epi16(accumulation[j], column[j]);
-            }
-#elif defined(USE_SSE2)
-            auto column = reinterpret_cast<const __m128i*>(&weights_[offset]);
-            for (IndexType j = 0; j < kNumChunks; ++j) {
-              accumulation[j] = _mm_sub_epi16(accumulation[j], column[j]);
-            }
-#elif defined(IS_ARM)
-            auto column = reinterpret_cast<const int16x8_t*>(&weights_[offset]);
-            for (IndexType j = 0; j < kNumChunks; ++j) {
-              accumulation[j] = vsubq_s16(accumulation[j], column[j]);
-            }
-#else
-            for (IndexType j = 0; j < kHalfDimensions; ++j) {
-              accumulator.accumulation[perspective][i][j] -=
-                  weights_[offset + j];
-            }
-#endif
+          for (const auto index : ply_removed[perspective]) {
+            removed_indices[perspective].push_back(index);
           }
-        }
-        {  // 0から1に変化した特徴量に関する差分計算
-          for (const auto index : added_indices[perspective]) {
-            const IndexType offset = kHalfDimensions * index;
-#if defined(USE_AVX2)
-            auto column = reinterpret_cast<const __m256i*>(&weights_[offset]);
-            for (IndexType j = 0; j < kNumChunks; ++j) {
-              accumulation[j] = _mm256_add_epi16(accumulation[j], column[j]);
-            }
-#elif defined(USE_SSE2)
-            auto column = reinterpret_cast<const __m128i*>(&weights_[offset]);
-            for (IndexType j = 0; j < kNumChunks; ++j) {
-              accumulation[j] = _mm_add_epi16(accumulation[j], column[j]);
-            }
-#elif defined(IS_ARM)
-            auto column = reinterpret_cast<const int16x8_t*>(&weights_[offset]);
-            for (IndexType j = 0; j < kNumChunks; ++j) {
-              accumulation[j] = vaddq_s16(accumulation[j], column[j]);
-            }
-#else
-            for (IndexType j = 0; j < kHalfDimensions; ++j) {
-              accumulator.accumulation[perspective][i][j] +=
-                  weights_[offset + j];
-            }
-#endif
+          for (const auto index : ply_added[perspective]) {
+            added_indices[perspective].push_back(index);
           }
         }
       }
+      for (const auto perspective : Colors) {
+        if (!reset[perspective]) {
+          UpdateColumns(
+              Accumulation(accumulator, perspective, i),
+              Accumulation(prev_accumulator, perspective, i),
+              removed_indices[perspective].begin(),
+              removed_indices[perspective].size(),
+              added_indices[perspective].begin(),
+              added_indices[perspective].size());
+        } else if (cache && Features::IsKingRelative(kRefreshTriggers[i])) {
+          RefreshFromCache(pos, i, perspective, cache,
+                           Accumulation(accumulator, perspective, i));
+        } else {
+          RefreshFromScratch(i, added_indices[perspective],
+                             Accumulation(accumulator, perspective, i));
+        }
+      }
     }
 
     accumulator.computed_accumulation = true;
@@ -327,11 +457,15 @@ class FeatureTransformer {
 
   // パラメータの型
   using BiasType = std::int16_t;
-  using WeightType = std::int16_t;
+  using WeightType = typename Architecture::FeatureWeightType;
 
   // 学習用クラスをfriendにする
   friend class Trainer<FeatureTransformer>;
 
+  // 量子化する時に元のパラメータを読むので、他のアーキテクチャのものもfriendにする
+  template <typename OtherArchitecture>
+  friend class FeatureTransformer;
+
   // パラメータ
   alignas(kCacheLineSize) BiasType biases_[kHalfDimensions];
   alignas(kCacheLineSize)
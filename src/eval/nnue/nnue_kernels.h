@@ -0,0 +1,1778 @@
+﻿// NNUE評価関数の計算カーネル
+// 命令セット毎に関数を用意し、起動時にcpuidで選んだものを実行時に呼び分ける
+
+#ifndef _NNUE_KERNELS_H_
+#define _NNUE_KERNELS_H_
+
+#if defined(EVAL_NNUE)
+
+#include "nnue_common.h"
+#include "../../cpu.h"
+
+#include <algorithm>
+
+namespace Eval {
+
+namespace NNUE {
+
+namespace Kernels {
+
+// 呼び出し元の命令セットに関わらず、この関数だけ指定した命令セットでコンパイルする
+#define NNUE_TARGET(isa) __attribute__((target(isa)))
+
+#if defined(__MINGW32__) || defined(__MINGW64__)
+// HACK: MSYS2のg++でコンパイルしたバイナリは、alignasを指定しても
+//       メモリが揃わずにクラッシュするので、アラインされていない読み書きを使う
+#define NNUE_LOAD256  _mm256_loadu_si256
+#define NNUE_STORE256 _mm256_storeu_si256
+#define NNUE_LOAD512  _mm512_loadu_si512
+#define NNUE_STORE512 _mm512_storeu_si512
+#else
+#define NNUE_LOAD256  _mm256_load_si256
+#define NNUE_STORE256 _mm256_store_si256
+#define NNUE_LOAD512  _mm512_load_si512
+#define NNUE_STORE512 _mm512_store_si512
+#endif
+
+// 累積値の差分計算で、一度にレジスタに載せておく累積値のレジスタ数
+// 使えるレジスタ数以下で、累積値全体のレジスタ数を割り切る最大の数
+constexpr IndexType TileHeight(IndexType num_chunks, IndexType max_registers) {
+  IndexType height = num_chunks < max_registers ? num_chunks : max_registers;
+  while (num_chunks % height != 0) --height;
+  return height;
+}
+
+// 出力を何行ずつまとめて計算するか
+constexpr IndexType AffineGroupSize(IndexType output_dimensions) {
+  return output_dimensions % 4 == 0 ? 4 : 1;
+}
+
+// まとめた行の重みを交互に並べる単位のバイト数
+// どのSIMDの幅で読み込んでも、1回の読み込みが1行の中に収まる
+constexpr IndexType AffineBlockSize(IndexType padded_input_dimensions) {
+  return padded_input_dimensions % kAvx512Width == 0 ? kAvx512Width
+                                                     : kMaxSimdWidth;
+}
+
+// 通常の層の重みの配置で、出力iの入力jに対する重みの位置
+// AffineGroupSize行ごとに、AffineBlockSizeバイトずつ行を交互に並べる
+template <IndexType PaddedInputDimensions, IndexType OutputDimensions>
+constexpr IndexType AffineWeightIndex(IndexType i, IndexType j) {
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  constexpr IndexType kBlockSize = AffineBlockSize(PaddedInputDimensions);
+  return (i / kGroupSize) * kGroupSize * PaddedInputDimensions +
+         (j / kBlockSize) * kGroupSize * kBlockSize +
+         (i % kGroupSize) * kBlockSize + j % kBlockSize;
+}
+
+// 疎な入力用の重みの配置で、出力iの入力jに対する重みの位置
+// 入力を4バイトの塊に分け、塊ごとに全出力の4バイト分の重みを連続して並べる
+template <IndexType OutputDimensions>
+constexpr IndexType SparseWeightIndex(IndexType i, IndexType j) {
+  return (j / 4) * OutputDimensions * 4 + i * 4 + j % 4;
+}
+
+// 疎な入力として計算する0でない塊の数の上限。これより多ければ密に計算した方が速い
+constexpr IndexType SparseChunkLimit(IndexType input_dimensions) {
+  return input_dimensions / 4 * 3 / 4;
+}
+
+// SIMDを使わない実装
+namespace Scalar {
+
+template <IndexType N>
+inline void AddColumn(std::int16_t* accumulation, const std::int16_t* column) {
+  for (IndexType j = 0; j < N; ++j) {
+    accumulation[j] += column[j];
+  }
+}
+
+template <IndexType N>
+inline void SubColumn(std::int16_t* accumulation, const std::int16_t* column) {
+  for (IndexType j = 0; j < N; ++j) {
+    accumulation[j] -= column[j];
+  }
+}
+
+// 前の累積値inputに、removedの列を引いてaddedの列を足した値をoutputに書き込む
+template <IndexType N>
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int16_t* weights,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  for (IndexType j = 0; j < N; ++j) {
+    output[j] = input[j];
+  }
+  for (IndexType r = 0; r < num_removed; ++r) {
+    SubColumn<N>(output, &weights[N * removed[r]]);
+  }
+  for (IndexType a = 0; a < num_added; ++a) {
+    AddColumn<N>(output, &weights[N * added[a]]);
+  }
+}
+
+// 8bitに量子化した重みの列を、倍率scaleを掛けて16bitに戻しながら適用する
+template <IndexType N>
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int8_t* weights, std::int16_t scale,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  for (IndexType j = 0; j < N; ++j) {
+    output[j] = input[j];
+  }
+  for (IndexType r = 0; r < num_removed; ++r) {
+    const std::int8_t* column = &weights[N * removed[r]];
+    for (IndexType j = 0; j < N; ++j) {
+      output[j] -= column[j] * scale;
+    }
+  }
+  for (IndexType a = 0; a < num_added; ++a) {
+    const std::int8_t* column = &weights[N * added[a]];
+    for (IndexType j = 0; j < N; ++j) {
+      output[j] += column[j] * scale;
+    }
+  }
+}
+
+// 累積値を[0, 127]に制限して8bitに詰める
+template <IndexType N>
+inline void Pack(std::uint8_t* output, const std::int16_t* accumulation) {
+  for (IndexType j = 0; j < N; ++j) {
+    output[j] = static_cast<std::uint8_t>(
+        std::max<int>(0, std::min<int>(127, accumulation[j])));
+  }
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  constexpr IndexType kBlockSize = AffineBlockSize(PaddedInputDimensions);
+  for (IndexType i = 0; i < OutputDimensions; ++i) {
+    std::int32_t sum = biases[i];
+    for (IndexType b = 0; b < PaddedInputDimensions; b += kBlockSize) {
+      const auto row = &weights[
+          AffineWeightIndex<PaddedInputDimensions, OutputDimensions>(i, b)];
+      for (IndexType j = 0; j < kBlockSize; ++j) {
+        sum += row[j] * input[b + j];
+      }
+    }
+    output[i] = sum;
+  }
+}
+
+// 入力のうち0でない4バイトの塊についてだけ、全出力の積和を取る
+// sparse_weightsはSparseWeightIndexの配置で、0でない塊が多い場合はweightsで密に計算する
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+inline void SparseAffine(std::int32_t* output, const std::uint8_t* input,
+                         const std::int8_t* weights,
+                         const std::int8_t* sparse_weights,
+                         const std::int32_t* biases) {
+  IndexType count = 0;
+  for (IndexType c = 0; c < InputDimensions / 4; ++c) {
+    count += (input[c * 4] | input[c * 4 + 1] | input[c * 4 + 2] | input[c * 4 + 3]) != 0;
+  }
+  if (count > SparseChunkLimit(InputDimensions)) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, input, weights, biases);
+    return;
+  }
+  // 8bitの重みはoutputと別名になり得るので、積和は手元の配列で取る
+  std::int32_t sums[OutputDimensions];
+  for (IndexType i = 0; i < OutputDimensions; ++i) {
+    sums[i] = biases[i];
+  }
+  for (IndexType c = 0; c < InputDimensions / 4; ++c) {
+    const std::uint8_t* in = &input[c * 4];
+    if (!(in[0] | in[1] | in[2] | in[3])) continue;
+    const std::int8_t* column = &sparse_weights[c * OutputDimensions * 4];
+    for (IndexType i = 0; i < OutputDimensions; ++i) {
+      for (IndexType k = 0; k < 4; ++k) {
+        sums[i] += column[i * 4 + k] * in[k];
+      }
+    }
+  }
+  for (IndexType i = 0; i < OutputDimensions; ++i) {
+    output[i] = sums[i];
+  }
+}
+
+template <IndexType N>
+inline void ClippedReLU(std::uint8_t* output, const std::int32_t* input,
+                        IndexType start = 0) {
+  for (IndexType i = start; i < N; ++i) {
+    output[i] = static_cast<std::uint8_t>(
+        std::max(0, std::min(127, input[i] >> kWeightScaleBits)));
+  }
+}
+
+}  // namespace Scalar
+
+#if defined(IS_ARM)
+
+namespace Neon {
+
+template <IndexType N>
+inline void AddColumn(std::int16_t* accumulation, const std::int16_t* column) {
+  auto acc = reinterpret_cast<int16x8_t*>(accumulation);
+  auto col = reinterpret_cast<const int16x8_t*>(column);
+  for (IndexType j = 0; j < N / 8; ++j) {
+    acc[j] = vaddq_s16(acc[j], col[j]);
+  }
+}
+
+// 前の累積値inputに、removedの列を引いてaddedの列を足した値をoutputに書き込む
+// 累積値を16レジスタ分ずつレジスタに載せたまま全ての列を適用し、書き込みは一度で済ませる
+template <IndexType N>
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int16_t* weights,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 8 == 0, "");
+  constexpr IndexType kNumChunks = N / 8;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 16);
+  const auto in = reinterpret_cast<const int16x8_t*>(input);
+  const auto out = reinterpret_cast<int16x8_t*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    int16x8_t acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = *(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const auto col = reinterpret_cast<const int16x8_t*>(&weights[N * removed[r]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = vsubq_s16(acc[k], *(&col[t + k]));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const auto col = reinterpret_cast<const int16x8_t*>(&weights[N * added[a]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = vaddq_s16(acc[k], *(&col[t + k]));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      *(&out[t + k]) = acc[k];
+    }
+  }
+}
+
+// 8bitの重みを8要素ずつ16bitに広げ、倍率を掛ける
+inline int16x8_t WidenColumn(const std::int8_t* column, std::int16_t scale) {
+  return vmulq_n_s16(vmovl_s8(vld1_s8(column)), scale);
+}
+
+// 8bitの重みは16bitに広げてから適用する
+template <IndexType N>
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int8_t* weights, std::int16_t scale,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 8 == 0, "");
+  constexpr IndexType kNumChunks = N / 8;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 16);
+  const auto in = reinterpret_cast<const int16x8_t*>(input);
+  const auto out = reinterpret_cast<int16x8_t*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    int16x8_t acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = *(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const std::int8_t* column = &weights[N * removed[r]];
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = vsubq_s16(acc[k], WidenColumn(&column[(t + k) * 8], scale));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const std::int8_t* column = &weights[N * added[a]];
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = vaddq_s16(acc[k], WidenColumn(&column[(t + k) * 8], scale));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      *(&out[t + k]) = acc[k];
+    }
+  }
+}
+
+template <IndexType N>
+inline void Pack(std::uint8_t* output, const std::int16_t* accumulation) {
+  const int8x8_t kZero = {0};
+  const auto in = reinterpret_cast<const int16x8_t*>(accumulation);
+  const auto out = reinterpret_cast<int8x8_t*>(output);
+  for (IndexType j = 0; j < N / 8; ++j) {
+    out[j] = vmax_s8(vqmovn_s16(in[j]), kZero);
+  }
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  constexpr IndexType kNumChunks = PaddedInputDimensions / 16;
+  const auto input_vector = reinterpret_cast<const int8x8_t*>(input);
+  for (IndexType i = 0; i < OutputDimensions; ++i) {
+    int32x4_t sum = {biases[i]};
+    for (IndexType j = 0; j < kNumChunks; ++j) {
+      const auto row = reinterpret_cast<const int8x8_t*>(&weights[
+          AffineWeightIndex<PaddedInputDimensions, OutputDimensions>(
+              i, j * 16)]);
+      int16x8_t product = vmull_s8(input_vector[j * 2], row[0]);
+      product = vmlal_s8(product, input_vector[j * 2 + 1], row[1]);
+      sum = vpadalq_s16(sum, product);
+    }
+    output[i] = sum[0] + sum[1] + sum[2] + sum[3];
+  }
+}
+
+template <IndexType N>
+inline void ClippedReLU(std::uint8_t* output, const std::int32_t* input) {
+  constexpr IndexType kNumChunks = N / 8;
+  const int8x8_t kZero = {0};
+  const auto in = reinterpret_cast<const int32x4_t*>(input);
+  const auto out = reinterpret_cast<int8x8_t*>(output);
+  for (IndexType i = 0; i < kNumChunks; ++i) {
+    int16x8_t shifted;
+    const auto pack = reinterpret_cast<int16x4_t*>(&shifted);
+    pack[0] = vqshrn_n_s32(in[i * 2 + 0], kWeightScaleBits);
+    pack[1] = vqshrn_n_s32(in[i * 2 + 1], kWeightScaleBits);
+    out[i] = vmax_s8(vqmovn_s16(shifted), kZero);
+  }
+  Scalar::ClippedReLU<N>(output, input, kNumChunks * 8);
+}
+
+}  // namespace Neon
+
+#else
+
+// SSE2はx86-64の全てのCPUで使える
+namespace Sse2 {
+
+template <IndexType N>
+NNUE_TARGET("sse2")
+inline void AddColumn(std::int16_t* accumulation, const std::int16_t* column) {
+  static_assert(N % 8 == 0, "");
+  auto acc = reinterpret_cast<__m128i*>(accumulation);
+  auto col = reinterpret_cast<const __m128i*>(column);
+  for (IndexType j = 0; j < N / 8; ++j) {
+    acc[j] = _mm_add_epi16(acc[j], col[j]);
+  }
+}
+
+// 前の累積値inputに、removedの列を引いてaddedの列を足した値をoutputに書き込む
+// 累積値を8レジスタ分ずつレジスタに載せたまま全ての列を適用し、書き込みは一度で済ませる
+template <IndexType N>
+NNUE_TARGET("sse2")
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int16_t* weights,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 8 == 0, "");
+  constexpr IndexType kNumChunks = N / 8;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 8);
+  const auto in = reinterpret_cast<const __m128i*>(input);
+  const auto out = reinterpret_cast<__m128i*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    __m128i acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = _mm_load_si128(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const auto col = reinterpret_cast<const __m128i*>(&weights[N * removed[r]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm_sub_epi16(acc[k], _mm_load_si128(&col[t + k]));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const auto col = reinterpret_cast<const __m128i*>(&weights[N * added[a]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm_add_epi16(acc[k], _mm_load_si128(&col[t + k]));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      _mm_store_si128(&out[t + k], acc[k]);
+    }
+  }
+}
+
+// 8bitの重みを8要素ずつ16bitに広げ、倍率を掛ける
+// SSE2には符号拡張の命令が無いので、上位バイトに並べてから算術シフトで戻す
+NNUE_TARGET("sse2")
+inline __m128i WidenColumn(const std::int8_t* column, __m128i scale) {
+  const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(column));
+  return _mm_mullo_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8), scale);
+}
+
+// 8bitの重みは16bitに広げてから適用する
+template <IndexType N>
+NNUE_TARGET("sse2")
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int8_t* weights, std::int16_t scale,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 8 == 0, "");
+  constexpr IndexType kNumChunks = N / 8;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 8);
+  const __m128i kScale = _mm_set1_epi16(scale);
+  const auto in = reinterpret_cast<const __m128i*>(input);
+  const auto out = reinterpret_cast<__m128i*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    __m128i acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = _mm_load_si128(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const std::int8_t* column = &weights[N * removed[r]];
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm_sub_epi16(acc[k], WidenColumn(&column[(t + k) * 8], kScale));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const std::int8_t* column = &weights[N * added[a]];
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm_add_epi16(acc[k], WidenColumn(&column[(t + k) * 8], kScale));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      _mm_store_si128(&out[t + k], acc[k]);
+    }
+  }
+}
+
+// SSE2にはmax_epi8が無いので、[0, 255]に詰めてから127で抑える
+template <IndexType N>
+NNUE_TARGET("sse2")
+inline void Pack(std::uint8_t* output, const std::int16_t* accumulation) {
+  static_assert(N % 16 == 0, "");
+  const __m128i k127 = _mm_set1_epi8(127);
+  const auto in = reinterpret_cast<const __m128i*>(accumulation);
+  const auto out = reinterpret_cast<__m128i*>(output);
+  for (IndexType j = 0; j < N / 16; ++j) {
+    _mm_store_si128(&out[j], _mm_min_epu8(
+        _mm_packus_epi16(in[j * 2 + 0], in[j * 2 + 1]), k127));
+  }
+}
+
+// 4つのベクトルをそれぞれ横に足した値を1つのベクトルに並べる
+NNUE_TARGET("sse2")
+inline __m128i ReduceAdd4(__m128i sum0, __m128i sum1,
+                          __m128i sum2, __m128i sum3) {
+  const __m128i sum01 = _mm_add_epi32(
+      _mm_unpacklo_epi32(sum0, sum1), _mm_unpackhi_epi32(sum0, sum1));
+  const __m128i sum23 = _mm_add_epi32(
+      _mm_unpacklo_epi32(sum2, sum3), _mm_unpackhi_epi32(sum2, sum3));
+  return _mm_add_epi32(
+      _mm_unpacklo_epi64(sum01, sum23), _mm_unpackhi_epi64(sum01, sum23));
+}
+
+// maddubsが無いので、16bitに広げてからmaddで積和を取る
+// 4行ずつまとめて入力を1回だけ読み、最後にまとめて横に足す
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("sse2")
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  constexpr IndexType kNumChunks = PaddedInputDimensions / 16;
+  constexpr IndexType kBlockChunks =
+      AffineBlockSize(PaddedInputDimensions) / 16;
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  const __m128i kZero = _mm_setzero_si128();
+  const auto input_vector = reinterpret_cast<const __m128i*>(input);
+  for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+    __m128i sum[kGroupSize];
+    for (IndexType k = 0; k < kGroupSize; ++k) {
+      sum[k] = kZero;
+    }
+    const auto rows =
+        reinterpret_cast<const __m128i*>(&weights[i * PaddedInputDimensions]);
+    for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+      const auto block = &rows[j * kGroupSize];
+      for (IndexType s = 0; s < kBlockChunks; ++s) {
+        const __m128i in = _mm_load_si128(&input_vector[j + s]);
+        const __m128i in_lo = _mm_unpacklo_epi8(in, kZero);
+        const __m128i in_hi = _mm_unpackhi_epi8(in, kZero);
+        for (IndexType k = 0; k < kGroupSize; ++k) {
+          const __m128i w = _mm_load_si128(&block[k * kBlockChunks + s]);
+          const __m128i w_lo = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+          const __m128i w_hi = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+          sum[k] = _mm_add_epi32(sum[k], _mm_madd_epi16(in_lo, w_lo));
+          sum[k] = _mm_add_epi32(sum[k], _mm_madd_epi16(in_hi, w_hi));
+        }
+      }
+    }
+    if constexpr (kGroupSize == 4) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_add_epi32(
+          ReduceAdd4(sum[0], sum[1], sum[2], sum[3]),
+          _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]))));
+    } else {
+      sum[0] = _mm_add_epi32(sum[0], _mm_shuffle_epi32(sum[0], 0x4E));
+      sum[0] = _mm_add_epi32(sum[0], _mm_shuffle_epi32(sum[0], 0xB1));
+      output[i] = _mm_cvtsi128_si32(sum[0]) + biases[i];
+    }
+  }
+}
+
+template <IndexType N>
+NNUE_TARGET("sse2")
+inline void ClippedReLU(std::uint8_t* output, const std::int32_t* input) {
+  constexpr IndexType kNumChunks = N / 16;
+  const __m128i k127 = _mm_set1_epi8(127);
+  const auto in = reinterpret_cast<const __m128i*>(input);
+  const auto out = reinterpret_cast<__m128i*>(output);
+  for (IndexType i = 0; i < kNumChunks; ++i) {
+    const __m128i words0 = _mm_srai_epi16(_mm_packs_epi32(
+        _mm_load_si128(&in[i * 4 + 0]),
+        _mm_load_si128(&in[i * 4 + 1])), kWeightScaleBits);
+    const __m128i words1 = _mm_srai_epi16(_mm_packs_epi32(
+        _mm_load_si128(&in[i * 4 + 2]),
+        _mm_load_si128(&in[i * 4 + 3])), kWeightScaleBits);
+    _mm_store_si128(&out[i], _mm_min_epu8(
+        _mm_packus_epi16(words0, words1), k127));
+  }
+  Scalar::ClippedReLU<N>(output, input, kNumChunks * 16);
+}
+
+}  // namespace Sse2
+
+// SSE4.1の経路はSSSE3のmaddubsで積和を取る
+namespace Sse41 {
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("ssse3,sse4.1")
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  constexpr IndexType kNumChunks = PaddedInputDimensions / 16;
+  constexpr IndexType kBlockChunks =
+      AffineBlockSize(PaddedInputDimensions) / 16;
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  const __m128i kOnes = _mm_set1_epi16(1);
+  const auto input_vector = reinterpret_cast<const __m128i*>(input);
+  for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+    __m128i sum[kGroupSize];
+    for (IndexType k = 0; k < kGroupSize; ++k) {
+      sum[k] = _mm_setzero_si128();
+    }
+    const auto rows =
+        reinterpret_cast<const __m128i*>(&weights[i * PaddedInputDimensions]);
+    for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+      const auto block = &rows[j * kGroupSize];
+      for (IndexType s = 0; s < kBlockChunks; ++s) {
+        const __m128i in = _mm_load_si128(&input_vector[j + s]);
+        for (IndexType k = 0; k < kGroupSize; ++k) {
+          const __m128i product = _mm_maddubs_epi16(in, _mm_load_si128(
+              &block[k * kBlockChunks + s]));
+          sum[k] = _mm_add_epi32(sum[k], _mm_madd_epi16(product, kOnes));
+        }
+      }
+    }
+    if constexpr (kGroupSize == 4) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_add_epi32(
+          _mm_hadd_epi32(_mm_hadd_epi32(sum[0], sum[1]),
+                         _mm_hadd_epi32(sum[2], sum[3])),
+          _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]))));
+    } else {
+      sum[0] = _mm_hadd_epi32(sum[0], sum[0]);
+      sum[0] = _mm_hadd_epi32(sum[0], sum[0]);
+      output[i] = _mm_cvtsi128_si32(sum[0]) + biases[i];
+    }
+  }
+}
+
+// 入力のうち0でない4バイトの塊の数を返し、上限以下ならその番号を列挙する
+// 入力は[0, 127]なので、32bit整数として正なら0でない
+template <IndexType InputDimensions>
+NNUE_TARGET("ssse3,sse4.1")
+inline IndexType FindNonZeroChunks(std::uint16_t* chunks,
+                                   const std::uint8_t* input) {
+  static_assert(InputDimensions % 16 == 0, "");
+  const __m128i kZero = _mm_setzero_si128();
+  const auto input_vector = reinterpret_cast<const __m128i*>(input);
+  unsigned masks[InputDimensions / 16];
+  IndexType count = 0;
+  for (IndexType j = 0; j < InputDimensions / 16; ++j) {
+    masks[j] = _mm_movemask_ps(_mm_castsi128_ps(
+        _mm_cmpgt_epi32(_mm_load_si128(&input_vector[j]), kZero)));
+    count += __builtin_popcount(masks[j]);
+  }
+  if (count > SparseChunkLimit(InputDimensions)) return count;
+  IndexType n = 0;
+  for (IndexType j = 0; j < InputDimensions / 16; ++j) {
+    for (unsigned mask = masks[j]; mask; mask &= mask - 1) {
+      chunks[n++] = static_cast<std::uint16_t>(j * 4 + __builtin_ctz(mask));
+    }
+  }
+  return count;
+}
+
+// 0でない塊の4バイトを全レーンに並べ、全出力の重みとまとめて積和を取る
+// 依存の連鎖を短くするため、塊をkNumSets組に分けて別々のレジスタに足す
+// 0でない塊が多い場合は、通常の配置の重みで密に計算する
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("ssse3,sse4.1")
+inline void SparseAffine(std::int32_t* output, const std::uint8_t* input,
+                         const std::int8_t* weights,
+                         const std::int8_t* sparse_weights,
+                         const std::int32_t* biases) {
+  static_assert(OutputDimensions % 4 == 0, "");
+  constexpr IndexType kNumRegs = OutputDimensions / 4;
+  constexpr IndexType kNumSets = kNumRegs >= 8 ? 1 : 8 / kNumRegs;
+  std::uint16_t chunks[InputDimensions / 4];
+  const IndexType count = FindNonZeroChunks<InputDimensions>(chunks, input);
+  if (count > SparseChunkLimit(InputDimensions)) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, input, weights, biases);
+    return;
+  }
+  const __m128i kOnes = _mm_set1_epi16(1);
+  const auto input32 = reinterpret_cast<const std::int32_t*>(input);
+  const auto bias = reinterpret_cast<const __m128i*>(biases);
+  __m128i acc[kNumSets][kNumRegs];
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    acc[0][k] = _mm_load_si128(&bias[k]);
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[s][k] = _mm_setzero_si128();
+    }
+  }
+  IndexType n = 0;
+  for (; n + kNumSets <= count; n += kNumSets) {
+    for (IndexType s = 0; s < kNumSets; ++s) {
+      const IndexType c = chunks[n + s];
+      const __m128i in = _mm_set1_epi32(input32[c]);
+      const auto column = reinterpret_cast<const __m128i*>(
+          &sparse_weights[c * OutputDimensions * 4]);
+      for (IndexType k = 0; k < kNumRegs; ++k) {
+        acc[s][k] = _mm_add_epi32(acc[s][k], _mm_madd_epi16(
+            _mm_maddubs_epi16(in, _mm_load_si128(&column[k])), kOnes));
+      }
+    }
+  }
+  for (; n < count; ++n) {
+    const IndexType c = chunks[n];
+    const __m128i in = _mm_set1_epi32(input32[c]);
+    const auto column = reinterpret_cast<const __m128i*>(
+        &sparse_weights[c * OutputDimensions * 4]);
+    for (IndexType k = 0; k < kNumRegs; ++k) {
+      acc[0][k] = _mm_add_epi32(acc[0][k], _mm_madd_epi16(
+          _mm_maddubs_epi16(in, _mm_load_si128(&column[k])), kOnes));
+    }
+  }
+  const auto out = reinterpret_cast<__m128i*>(output);
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[0][k] = _mm_add_epi32(acc[0][k], acc[s][k]);
+    }
+    _mm_store_si128(&out[k], acc[0][k]);
+  }
+}
+
+}  // namespace Sse41
+
+namespace Avx2 {
+
+template <IndexType N>
+NNUE_TARGET("avx2")
+inline void AddColumn(std::int16_t* accumulation, const std::int16_t* column) {
+  static_assert(N % 16 == 0, "");
+  auto acc = reinterpret_cast<__m256i*>(accumulation);
+  auto col = reinterpret_cast<const __m256i*>(column);
+  for (IndexType j = 0; j < N / 16; ++j) {
+    NNUE_STORE256(&acc[j], _mm256_add_epi16(NNUE_LOAD256(&acc[j]), col[j]));
+  }
+}
+
+// 前の累積値inputに、removedの列を引いてaddedの列を足した値をoutputに書き込む
+// 累積値を8レジスタ分ずつレジスタに載せたまま全ての列を適用し、書き込みは一度で済ませる
+template <IndexType N>
+NNUE_TARGET("avx2")
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int16_t* weights,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 16 == 0, "");
+  constexpr IndexType kNumChunks = N / 16;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 8);
+  const auto in = reinterpret_cast<const __m256i*>(input);
+  const auto out = reinterpret_cast<__m256i*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    __m256i acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = NNUE_LOAD256(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const auto col = reinterpret_cast<const __m256i*>(&weights[N * removed[r]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm256_sub_epi16(acc[k], NNUE_LOAD256(&col[t + k]));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const auto col = reinterpret_cast<const __m256i*>(&weights[N * added[a]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm256_add_epi16(acc[k], NNUE_LOAD256(&col[t + k]));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      NNUE_STORE256(&out[t + k], acc[k]);
+    }
+  }
+}
+
+// 8bitの重みを16要素ずつ16bitに広げ、倍率を掛ける
+NNUE_TARGET("avx2")
+inline __m256i WidenColumn(const __m128i* column, __m256i scale) {
+  return _mm256_mullo_epi16(_mm256_cvtepi8_epi16(_mm_load_si128(column)), scale);
+}
+
+// 8bitの重みは16bitに広げてから適用する
+template <IndexType N>
+NNUE_TARGET("avx2")
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int8_t* weights, std::int16_t scale,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 16 == 0, "");
+  constexpr IndexType kNumChunks = N / 16;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 8);
+  const __m256i kScale = _mm256_set1_epi16(scale);
+  const auto in = reinterpret_cast<const __m256i*>(input);
+  const auto out = reinterpret_cast<__m256i*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    __m256i acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = NNUE_LOAD256(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const auto col = reinterpret_cast<const __m128i*>(&weights[N * removed[r]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm256_sub_epi16(acc[k], WidenColumn(&col[t + k], kScale));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const auto col = reinterpret_cast<const __m128i*>(&weights[N * added[a]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm256_add_epi16(acc[k], WidenColumn(&col[t + k], kScale));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      NNUE_STORE256(&out[t + k], acc[k]);
+    }
+  }
+}
+
+// packsは128bitレーン毎に詰めるので、64bit単位で並べ直す
+template <IndexType N>
+NNUE_TARGET("avx2")
+inline void Pack(std::uint8_t* output, const std::int16_t* accumulation) {
+  static_assert(N % 32 == 0, "");
+  constexpr int kControl = 0b11011000;
+  const __m256i kZero = _mm256_setzero_si256();
+  const auto in = reinterpret_cast<const __m256i*>(accumulation);
+  const auto out = reinterpret_cast<__m256i*>(output);
+  for (IndexType j = 0; j < N / 32; ++j) {
+    const __m256i sum0 = NNUE_LOAD256(&in[j * 2 + 0]);
+    const __m256i sum1 = NNUE_LOAD256(&in[j * 2 + 1]);
+    NNUE_STORE256(&out[j], _mm256_permute4x64_epi64(_mm256_max_epi8(
+        _mm256_packs_epi16(sum0, sum1), kZero), kControl));
+  }
+}
+
+// 4つのベクトルをそれぞれ横に足した値を1つのベクトルに並べる
+NNUE_TARGET("avx2")
+inline __m128i ReduceAdd4(__m256i sum0, __m256i sum1,
+                          __m256i sum2, __m256i sum3) {
+  const __m256i sum = _mm256_hadd_epi32(
+      _mm256_hadd_epi32(sum0, sum1), _mm256_hadd_epi32(sum2, sum3));
+  return _mm_add_epi32(
+      _mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx2")
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  static_assert(PaddedInputDimensions % 32 == 0, "");
+  constexpr IndexType kNumChunks = PaddedInputDimensions / 32;
+  constexpr IndexType kBlockChunks =
+      AffineBlockSize(PaddedInputDimensions) / 32;
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  const __m256i kOnes = _mm256_set1_epi16(1);
+  const auto input_vector = reinterpret_cast<const __m256i*>(input);
+  for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+    __m256i sum[kGroupSize];
+    for (IndexType k = 0; k < kGroupSize; ++k) {
+      sum[k] = _mm256_setzero_si256();
+    }
+    const auto rows =
+        reinterpret_cast<const __m256i*>(&weights[i * PaddedInputDimensions]);
+    for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+      const auto block = &rows[j * kGroupSize];
+      for (IndexType s = 0; s < kBlockChunks; ++s) {
+        const __m256i in = NNUE_LOAD256(&input_vector[j + s]);
+        for (IndexType k = 0; k < kGroupSize; ++k) {
+          const __m256i product = _mm256_maddubs_epi16(in, _mm256_load_si256(
+              &block[k * kBlockChunks + s]));
+          sum[k] = _mm256_add_epi32(sum[k], _mm256_madd_epi16(product, kOnes));
+        }
+      }
+    }
+    if constexpr (kGroupSize == 4) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_add_epi32(
+          ReduceAdd4(sum[0], sum[1], sum[2], sum[3]),
+          _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]))));
+    } else {
+      sum[0] = _mm256_hadd_epi32(sum[0], sum[0]);
+      sum[0] = _mm256_hadd_epi32(sum[0], sum[0]);
+      const __m128i lo = _mm256_extracti128_si256(sum[0], 0);
+      const __m128i hi = _mm256_extracti128_si256(sum[0], 1);
+      output[i] = _mm_cvtsi128_si32(lo) + _mm_cvtsi128_si32(hi) + biases[i];
+    }
+  }
+}
+
+// 複数の局面の入力をまとめて計算する。局面bの入力はinput + b * input_stride、
+// 出力はoutput + b * output_stride。読み込んだ重みをkTile局面の入力に続けて掛けるので、
+// 重みの読み込みは局面数の1/kTileで済む。余った局面は1局面ずつ計算する
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx2")
+inline void AffineBatch(std::int32_t* output, IndexType output_stride,
+                        const std::uint8_t* input, IndexType input_stride,
+                        IndexType batch_size, const std::int8_t* weights,
+                        const std::int32_t* biases) {
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  IndexType b = 0;
+  if constexpr (kGroupSize == 4) {
+    // 局面ごとに4行分の和を持つので、2局面で8レジスタを使う
+    constexpr IndexType kTile = 2;
+    constexpr IndexType kNumChunks = PaddedInputDimensions / 32;
+    constexpr IndexType kBlockChunks =
+        AffineBlockSize(PaddedInputDimensions) / 32;
+    const __m256i kOnes = _mm256_set1_epi16(1);
+    for (; b + kTile <= batch_size; b += kTile) {
+      for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+        __m256i sum[kTile][kGroupSize];
+        for (IndexType t = 0; t < kTile; ++t) {
+          for (IndexType k = 0; k < kGroupSize; ++k) {
+            sum[t][k] = _mm256_setzero_si256();
+          }
+        }
+        const auto rows = reinterpret_cast<const __m256i*>(
+            &weights[i * PaddedInputDimensions]);
+        for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+          const auto block = &rows[j * kGroupSize];
+          for (IndexType s = 0; s < kBlockChunks; ++s) {
+            __m256i w[kGroupSize];
+            for (IndexType k = 0; k < kGroupSize; ++k) {
+              w[k] = _mm256_load_si256(&block[k * kBlockChunks + s]);
+            }
+            for (IndexType t = 0; t < kTile; ++t) {
+              const __m256i in = NNUE_LOAD256(&reinterpret_cast<const __m256i*>(
+                  &input[(b + t) * input_stride])[j + s]);
+              for (IndexType k = 0; k < kGroupSize; ++k) {
+                sum[t][k] = _mm256_add_epi32(sum[t][k], _mm256_madd_epi16(
+                    _mm256_maddubs_epi16(in, w[k]), kOnes));
+              }
+            }
+          }
+        }
+        const __m128i bias =
+            _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]));
+        for (IndexType t = 0; t < kTile; ++t) {
+          _mm_store_si128(
+              reinterpret_cast<__m128i*>(&output[(b + t) * output_stride + i]),
+              _mm_add_epi32(ReduceAdd4(sum[t][0], sum[t][1], sum[t][2], sum[t][3]),
+                            bias));
+        }
+      }
+    }
+  }
+  for (; b < batch_size; ++b) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        &output[b * output_stride], &input[b * input_stride], weights, biases);
+  }
+}
+
+// 入力のうち0でない4バイトの塊の数を返し、上限以下ならその番号を列挙する
+template <IndexType InputDimensions>
+NNUE_TARGET("avx2")
+inline IndexType FindNonZeroChunks(std::uint16_t* chunks,
+                                   const std::uint8_t* input) {
+  static_assert(InputDimensions % 32 == 0, "");
+  const __m256i kZero = _mm256_setzero_si256();
+  const auto input_vector = reinterpret_cast<const __m256i*>(input);
+  unsigned masks[InputDimensions / 32];
+  IndexType count = 0;
+  for (IndexType j = 0; j < InputDimensions / 32; ++j) {
+    masks[j] = _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(NNUE_LOAD256(&input_vector[j]), kZero)));
+    count += __builtin_popcount(masks[j]);
+  }
+  if (count > SparseChunkLimit(InputDimensions)) return count;
+  IndexType n = 0;
+  for (IndexType j = 0; j < InputDimensions / 32; ++j) {
+    for (unsigned mask = masks[j]; mask; mask &= mask - 1) {
+      chunks[n++] = static_cast<std::uint16_t>(j * 8 + __builtin_ctz(mask));
+    }
+  }
+  return count;
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx2")
+inline void SparseAffine(std::int32_t* output, const std::uint8_t* input,
+                         const std::int8_t* weights,
+                         const std::int8_t* sparse_weights,
+                         const std::int32_t* biases) {
+  static_assert(OutputDimensions % 8 == 0, "");
+  constexpr IndexType kNumRegs = OutputDimensions / 8;
+  constexpr IndexType kNumSets = kNumRegs >= 8 ? 1 : 8 / kNumRegs;
+  std::uint16_t chunks[InputDimensions / 4];
+  const IndexType count = FindNonZeroChunks<InputDimensions>(chunks, input);
+  if (count > SparseChunkLimit(InputDimensions)) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, input, weights, biases);
+    return;
+  }
+  const __m256i kOnes = _mm256_set1_epi16(1);
+  const auto input32 = reinterpret_cast<const std::int32_t*>(input);
+  const auto bias = reinterpret_cast<const __m256i*>(biases);
+  __m256i acc[kNumSets][kNumRegs];
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    acc[0][k] = NNUE_LOAD256(&bias[k]);
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[s][k] = _mm256_setzero_si256();
+    }
+  }
+  IndexType n = 0;
+  for (; n + kNumSets <= count; n += kNumSets) {
+    for (IndexType s = 0; s < kNumSets; ++s) {
+      const IndexType c = chunks[n + s];
+      const __m256i in = _mm256_set1_epi32(input32[c]);
+      const auto column = reinterpret_cast<const __m256i*>(
+          &sparse_weights[c * OutputDimensions * 4]);
+      for (IndexType k = 0; k < kNumRegs; ++k) {
+        acc[s][k] = _mm256_add_epi32(acc[s][k], _mm256_madd_epi16(
+            _mm256_maddubs_epi16(in, NNUE_LOAD256(&column[k])), kOnes));
+      }
+    }
+  }
+  for (; n < count; ++n) {
+    const IndexType c = chunks[n];
+    const __m256i in = _mm256_set1_epi32(input32[c]);
+    const auto column = reinterpret_cast<const __m256i*>(
+        &sparse_weights[c * OutputDimensions * 4]);
+    for (IndexType k = 0; k < kNumRegs; ++k) {
+      acc[0][k] = _mm256_add_epi32(acc[0][k], _mm256_madd_epi16(
+          _mm256_maddubs_epi16(in, NNUE_LOAD256(&column[k])), kOnes));
+    }
+  }
+  const auto out = reinterpret_cast<__m256i*>(output);
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[0][k] = _mm256_add_epi32(acc[0][k], acc[s][k]);
+    }
+    NNUE_STORE256(&out[k], acc[0][k]);
+  }
+}
+
+template <IndexType N>
+NNUE_TARGET("avx2")
+inline void ClippedReLU(std::uint8_t* output, const std::int32_t* input) {
+  constexpr IndexType kNumChunks = N / 32;
+  const __m256i kZero = _mm256_setzero_si256();
+  const __m256i kOffsets = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+  const auto in = reinterpret_cast<const __m256i*>(input);
+  const auto out = reinterpret_cast<__m256i*>(output);
+  for (IndexType i = 0; i < kNumChunks; ++i) {
+    const __m256i words0 = _mm256_srai_epi16(_mm256_packs_epi32(
+        NNUE_LOAD256(&in[i * 4 + 0]),
+        NNUE_LOAD256(&in[i * 4 + 1])), kWeightScaleBits);
+    const __m256i words1 = _mm256_srai_epi16(_mm256_packs_epi32(
+        NNUE_LOAD256(&in[i * 4 + 2]),
+        NNUE_LOAD256(&in[i * 4 + 3])), kWeightScaleBits);
+    NNUE_STORE256(&out[i], _mm256_permutevar8x32_epi32(_mm256_max_epi8(
+        _mm256_packs_epi16(words0, words1), kZero), kOffsets));
+  }
+  Scalar::ClippedReLU<N>(output, input, kNumChunks * 32);
+}
+
+}  // namespace Avx2
+
+namespace Avx512 {
+
+// GCC 12では_mm512_reduce_add_epi32などが未初期化の警告を出すので、
+// maskz版で256bitずつ取り出して足してから畳む
+NNUE_TARGET("avx512f,avx512bw")
+inline __m256i Fold(__m512i sum) {
+  return _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xF, sum, 0),
+                          _mm512_maskz_extracti64x4_epi64(0xF, sum, 1));
+}
+
+NNUE_TARGET("avx512f,avx512bw")
+inline std::int32_t ReduceAdd(__m512i sum) {
+  const __m256i sum256 = Fold(sum);
+  __m128i sum128 = _mm_add_epi32(
+      _mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+  sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x4E));
+  sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0xB1));
+  return _mm_cvtsi128_si32(sum128);
+}
+
+// 4つのベクトルをそれぞれ横に足した値を1つのベクトルに並べる
+NNUE_TARGET("avx512f,avx512bw")
+inline __m128i ReduceAdd4(__m512i sum0, __m512i sum1,
+                          __m512i sum2, __m512i sum3) {
+  return Avx2::ReduceAdd4(Fold(sum0), Fold(sum1), Fold(sum2), Fold(sum3));
+}
+
+template <IndexType N>
+NNUE_TARGET("avx512f,avx512bw")
+inline void AddColumn(std::int16_t* accumulation, const std::int16_t* column) {
+  static_assert(N % 32 == 0, "");
+  auto acc = reinterpret_cast<__m512i*>(accumulation);
+  auto col = reinterpret_cast<const __m512i*>(column);
+  for (IndexType j = 0; j < N / 32; ++j) {
+    NNUE_STORE512(&acc[j], _mm512_add_epi16(NNUE_LOAD512(&acc[j]), col[j]));
+  }
+}
+
+// 前の累積値inputに、removedの列を引いてaddedの列を足した値をoutputに書き込む
+// 累積値を16レジスタ分ずつレジスタに載せたまま全ての列を適用し、書き込みは一度で済ませる
+template <IndexType N>
+NNUE_TARGET("avx512f,avx512bw")
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int16_t* weights,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 32 == 0, "");
+  constexpr IndexType kNumChunks = N / 32;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 16);
+  const auto in = reinterpret_cast<const __m512i*>(input);
+  const auto out = reinterpret_cast<__m512i*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    __m512i acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = NNUE_LOAD512(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const auto col = reinterpret_cast<const __m512i*>(&weights[N * removed[r]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm512_sub_epi16(acc[k], NNUE_LOAD512(&col[t + k]));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const auto col = reinterpret_cast<const __m512i*>(&weights[N * added[a]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm512_add_epi16(acc[k], NNUE_LOAD512(&col[t + k]));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      NNUE_STORE512(&out[t + k], acc[k]);
+    }
+  }
+}
+
+// 8bitの重みを32要素ずつ16bitに広げ、倍率を掛ける
+NNUE_TARGET("avx512f,avx512bw")
+inline __m512i WidenColumn(const __m256i* column, __m512i scale) {
+  return _mm512_mullo_epi16(_mm512_cvtepi8_epi16(NNUE_LOAD256(column)), scale);
+}
+
+// 8bitの重みは16bitに広げてから適用する
+template <IndexType N>
+NNUE_TARGET("avx512f,avx512bw")
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int8_t* weights, std::int16_t scale,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+  static_assert(N % 32 == 0, "");
+  constexpr IndexType kNumChunks = N / 32;
+  constexpr IndexType kTileHeight = TileHeight(kNumChunks, 16);
+  const __m512i kScale = _mm512_set1_epi16(scale);
+  const auto in = reinterpret_cast<const __m512i*>(input);
+  const auto out = reinterpret_cast<__m512i*>(output);
+  for (IndexType t = 0; t < kNumChunks; t += kTileHeight) {
+    __m512i acc[kTileHeight];
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      acc[k] = NNUE_LOAD512(&in[t + k]);
+    }
+    for (IndexType r = 0; r < num_removed; ++r) {
+      const auto col = reinterpret_cast<const __m256i*>(&weights[N * removed[r]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm512_sub_epi16(acc[k], WidenColumn(&col[t + k], kScale));
+      }
+    }
+    for (IndexType a = 0; a < num_added; ++a) {
+      const auto col = reinterpret_cast<const __m256i*>(&weights[N * added[a]]);
+      for (IndexType k = 0; k < kTileHeight; ++k) {
+        acc[k] = _mm512_add_epi16(acc[k], WidenColumn(&col[t + k], kScale));
+      }
+    }
+    for (IndexType k = 0; k < kTileHeight; ++k) {
+      NNUE_STORE512(&out[t + k], acc[k]);
+    }
+  }
+}
+
+// packsは128bitレーン毎に詰めるので、64bit単位で並べ直す
+// maskz版を使うのは上と同じく警告を避けるため
+template <IndexType N>
+NNUE_TARGET("avx512f,avx512bw")
+inline void Pack(std::uint8_t* output, const std::int16_t* accumulation) {
+  static_assert(N % 64 == 0, "");
+  const __m512i kControl = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+  const __m512i kZero = _mm512_setzero_si512();
+  const auto in = reinterpret_cast<const __m512i*>(accumulation);
+  const auto out = reinterpret_cast<__m512i*>(output);
+  for (IndexType j = 0; j < N / 64; ++j) {
+    const __m512i sum0 = NNUE_LOAD512(&in[j * 2 + 0]);
+    const __m512i sum1 = NNUE_LOAD512(&in[j * 2 + 1]);
+    NNUE_STORE512(&out[j], _mm512_maskz_permutexvar_epi64(0xFF, kControl,
+        _mm512_max_epi8(_mm512_packs_epi16(sum0, sum1), kZero)));
+  }
+}
+
+// 評価関数ファイルのパディングはkMaxSimdWidthのままなので、
+// 64で割り切れない層ではAVX2の命令を使う
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx512f,avx512bw")
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  if constexpr (PaddedInputDimensions % kAvx512Width == 0) {
+    constexpr IndexType kNumChunks = PaddedInputDimensions / kAvx512Width;
+    constexpr IndexType kBlockChunks =
+        AffineBlockSize(PaddedInputDimensions) / kAvx512Width;
+    constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+    const __m512i kOnes = _mm512_set1_epi16(1);
+    const auto input_vector = reinterpret_cast<const __m512i*>(input);
+    for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+      __m512i sum[kGroupSize];
+      for (IndexType k = 0; k < kGroupSize; ++k) {
+        sum[k] = _mm512_setzero_si512();
+      }
+      const auto rows = reinterpret_cast<const __m512i*>(
+          &weights[i * PaddedInputDimensions]);
+      for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+        const auto block = &rows[j * kGroupSize];
+        for (IndexType s = 0; s < kBlockChunks; ++s) {
+          const __m512i in = NNUE_LOAD512(&input_vector[j + s]);
+          for (IndexType k = 0; k < kGroupSize; ++k) {
+            const __m512i product = _mm512_maddubs_epi16(in, _mm512_load_si512(
+                &block[k * kBlockChunks + s]));
+            sum[k] = _mm512_add_epi32(
+                sum[k], _mm512_madd_epi16(product, kOnes));
+          }
+        }
+      }
+      if constexpr (kGroupSize == 4) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_add_epi32(
+            ReduceAdd4(sum[0], sum[1], sum[2], sum[3]),
+            _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]))));
+      } else {
+        output[i] = ReduceAdd(sum[0]) + biases[i];
+      }
+    }
+  } else {
+    Avx2::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, input, weights, biases);
+  }
+}
+
+// 複数の局面の入力をまとめて計算する。レジスタが32本あるので4局面ずつ計算する
+// 64で割り切れない層ではAVX2の命令を使う
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx512f,avx512bw")
+inline void AffineBatch(std::int32_t* output, IndexType output_stride,
+                        const std::uint8_t* input, IndexType input_stride,
+                        IndexType batch_size, const std::int8_t* weights,
+                        const std::int32_t* biases) {
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  if constexpr (PaddedInputDimensions % kAvx512Width == 0 && kGroupSize == 4) {
+    constexpr IndexType kTile = 4;
+    constexpr IndexType kNumChunks = PaddedInputDimensions / kAvx512Width;
+    constexpr IndexType kBlockChunks =
+        AffineBlockSize(PaddedInputDimensions) / kAvx512Width;
+    const __m512i kOnes = _mm512_set1_epi16(1);
+    IndexType b = 0;
+    for (; b + kTile <= batch_size; b += kTile) {
+      for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+        __m512i sum[kTile][kGroupSize];
+        for (IndexType t = 0; t < kTile; ++t) {
+          for (IndexType k = 0; k < kGroupSize; ++k) {
+            sum[t][k] = _mm512_setzero_si512();
+          }
+        }
+        const auto rows = reinterpret_cast<const __m512i*>(
+            &weights[i * PaddedInputDimensions]);
+        for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+          const auto block = &rows[j * kGroupSize];
+          for (IndexType s = 0; s < kBlockChunks; ++s) {
+            __m512i w[kGroupSize];
+            for (IndexType k = 0; k < kGroupSize; ++k) {
+              w[k] = _mm512_load_si512(&block[k * kBlockChunks + s]);
+            }
+            for (IndexType t = 0; t < kTile; ++t) {
+              const __m512i in = NNUE_LOAD512(&reinterpret_cast<const __m512i*>(
+                  &input[(b + t) * input_stride])[j + s]);
+              for (IndexType k = 0; k < kGroupSize; ++k) {
+                sum[t][k] = _mm512_add_epi32(
+                    sum[t][k], _mm512_madd_epi16(_mm512_maddubs_epi16(in, w[k]), kOnes));
+              }
+            }
+          }
+        }
+        const __m128i bias =
+            _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]));
+        for (IndexType t = 0; t < kTile; ++t) {
+          _mm_store_si128(
+              reinterpret_cast<__m128i*>(&output[(b + t) * output_stride + i]),
+              _mm_add_epi32(ReduceAdd4(sum[t][0], sum[t][1], sum[t][2], sum[t][3]),
+                            bias));
+        }
+      }
+    }
+    for (; b < batch_size; ++b) {
+      Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          &output[b * output_stride], &input[b * input_stride], weights, biases);
+    }
+  } else {
+    Avx2::AffineBatch<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, output_stride, input, input_stride, batch_size, weights, biases);
+  }
+}
+
+// 入力のうち0でない4バイトの塊の数を返し、上限以下ならその番号を列挙する
+template <IndexType InputDimensions>
+NNUE_TARGET("avx512f,avx512bw")
+inline IndexType FindNonZeroChunks(std::uint16_t* chunks,
+                                   const std::uint8_t* input) {
+  static_assert(InputDimensions % 64 == 0, "");
+  const __m512i kZero = _mm512_setzero_si512();
+  const auto input_vector = reinterpret_cast<const __m512i*>(input);
+  unsigned masks[InputDimensions / 64];
+  IndexType count = 0;
+  for (IndexType j = 0; j < InputDimensions / 64; ++j) {
+    masks[j] = _mm512_cmpgt_epi32_mask(NNUE_LOAD512(&input_vector[j]), kZero);
+    count += __builtin_popcount(masks[j]);
+  }
+  if (count > SparseChunkLimit(InputDimensions)) return count;
+  IndexType n = 0;
+  for (IndexType j = 0; j < InputDimensions / 64; ++j) {
+    for (unsigned mask = masks[j]; mask; mask &= mask - 1) {
+      chunks[n++] = static_cast<std::uint16_t>(j * 16 + __builtin_ctz(mask));
+    }
+  }
+  return count;
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx512f,avx512bw")
+inline void SparseAffine(std::int32_t* output, const std::uint8_t* input,
+                         const std::int8_t* weights,
+                         const std::int8_t* sparse_weights,
+                         const std::int32_t* biases) {
+  static_assert(OutputDimensions % 16 == 0, "");
+  constexpr IndexType kNumRegs = OutputDimensions / 16;
+  constexpr IndexType kNumSets = kNumRegs >= 8 ? 1 : 8 / kNumRegs;
+  std::uint16_t chunks[InputDimensions / 4];
+  const IndexType count = FindNonZeroChunks<InputDimensions>(chunks, input);
+  if (count > SparseChunkLimit(InputDimensions)) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, input, weights, biases);
+    return;
+  }
+  const __m512i kOnes = _mm512_set1_epi16(1);
+  const auto input32 = reinterpret_cast<const std::int32_t*>(input);
+  const auto bias = reinterpret_cast<const __m512i*>(biases);
+  __m512i acc[kNumSets][kNumRegs];
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    acc[0][k] = NNUE_LOAD512(&bias[k]);
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[s][k] = _mm512_setzero_si512();
+    }
+  }
+  IndexType n = 0;
+  for (; n + kNumSets <= count; n += kNumSets) {
+    for (IndexType s = 0; s < kNumSets; ++s) {
+      const IndexType c = chunks[n + s];
+      const __m512i in = _mm512_set1_epi32(input32[c]);
+      const auto column = reinterpret_cast<const __m512i*>(
+          &sparse_weights[c * OutputDimensions * 4]);
+      for (IndexType k = 0; k < kNumRegs; ++k) {
+        acc[s][k] = _mm512_add_epi32(acc[s][k], _mm512_madd_epi16(
+            _mm512_maddubs_epi16(in, NNUE_LOAD512(&column[k])), kOnes));
+      }
+    }
+  }
+  for (; n < count; ++n) {
+    const IndexType c = chunks[n];
+    const __m512i in = _mm512_set1_epi32(input32[c]);
+    const auto column = reinterpret_cast<const __m512i*>(
+        &sparse_weights[c * OutputDimensions * 4]);
+    for (IndexType k = 0; k < kNumRegs; ++k) {
+      acc[0][k] = _mm512_add_epi32(acc[0][k], _mm512_madd_epi16(
+          _mm512_maddubs_epi16(in, NNUE_LOAD512(&column[k])), kOnes));
+    }
+  }
+  const auto out = reinterpret_cast<__m512i*>(output);
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[0][k] = _mm512_add_epi32(acc[0][k], acc[s][k]);
+    }
+    NNUE_STORE512(&out[k], acc[0][k]);
+  }
+}
+
+}  // namespace Avx512
+
+// VNNIのdpbusdは積和を1命令で取る
+namespace Vnni {
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx512f,avx512bw,avx512vl,avx512vnni")
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  if constexpr (PaddedInputDimensions % kAvx512Width == 0) {
+    constexpr IndexType kNumChunks = PaddedInputDimensions / kAvx512Width;
+    constexpr IndexType kBlockChunks =
+        AffineBlockSize(PaddedInputDimensions) / kAvx512Width;
+    const auto input_vector = reinterpret_cast<const __m512i*>(input);
+    for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+      __m512i sum[kGroupSize];
+      for (IndexType k = 0; k < kGroupSize; ++k) {
+        sum[k] = _mm512_setzero_si512();
+      }
+      const auto rows = reinterpret_cast<const __m512i*>(
+          &weights[i * PaddedInputDimensions]);
+      for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+        const auto block = &rows[j * kGroupSize];
+        for (IndexType s = 0; s < kBlockChunks; ++s) {
+          const __m512i in = NNUE_LOAD512(&input_vector[j + s]);
+          for (IndexType k = 0; k < kGroupSize; ++k) {
+            sum[k] = _mm512_dpbusd_epi32(sum[k], in, _mm512_load_si512(
+                &block[k * kBlockChunks + s]));
+          }
+        }
+      }
+      if constexpr (kGroupSize == 4) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_add_epi32(
+            Avx512::ReduceAdd4(sum[0], sum[1], sum[2], sum[3]),
+            _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]))));
+      } else {
+        output[i] = Avx512::ReduceAdd(sum[0]) + biases[i];
+      }
+    }
+  } else {
+    constexpr IndexType kNumChunks = PaddedInputDimensions / 32;
+    constexpr IndexType kBlockChunks =
+        AffineBlockSize(PaddedInputDimensions) / 32;
+    const auto input_vector = reinterpret_cast<const __m256i*>(input);
+    for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+      __m256i sum[kGroupSize];
+      for (IndexType k = 0; k < kGroupSize; ++k) {
+        sum[k] = _mm256_setzero_si256();
+      }
+      const auto rows = reinterpret_cast<const __m256i*>(
+          &weights[i * PaddedInputDimensions]);
+      for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+        const auto block = &rows[j * kGroupSize];
+        for (IndexType s = 0; s < kBlockChunks; ++s) {
+          const __m256i in = NNUE_LOAD256(&input_vector[j + s]);
+          for (IndexType k = 0; k < kGroupSize; ++k) {
+            sum[k] = _mm256_dpbusd_epi32(sum[k], in, _mm256_load_si256(
+                &block[k * kBlockChunks + s]));
+          }
+        }
+      }
+      if constexpr (kGroupSize == 4) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_add_epi32(
+            Avx2::ReduceAdd4(sum[0], sum[1], sum[2], sum[3]),
+            _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]))));
+      } else {
+        sum[0] = _mm256_hadd_epi32(sum[0], sum[0]);
+        sum[0] = _mm256_hadd_epi32(sum[0], sum[0]);
+        const __m128i lo = _mm256_extracti128_si256(sum[0], 0);
+        const __m128i hi = _mm256_extracti128_si256(sum[0], 1);
+        output[i] = _mm_cvtsi128_si32(lo) + _mm_cvtsi128_si32(hi) + biases[i];
+      }
+    }
+  }
+}
+
+// 複数の局面の入力をまとめて計算する
+// 64で割り切れない層は出力が少なく重みも小さいので、AVX2の実装で足りる
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx512f,avx512bw,avx512vl,avx512vnni")
+inline void AffineBatch(std::int32_t* output, IndexType output_stride,
+                        const std::uint8_t* input, IndexType input_stride,
+                        IndexType batch_size, const std::int8_t* weights,
+                        const std::int32_t* biases) {
+  constexpr IndexType kGroupSize = AffineGroupSize(OutputDimensions);
+  if constexpr (PaddedInputDimensions % kAvx512Width == 0 && kGroupSize == 4) {
+    constexpr IndexType kTile = 4;
+    constexpr IndexType kNumChunks = PaddedInputDimensions / kAvx512Width;
+    constexpr IndexType kBlockChunks =
+        AffineBlockSize(PaddedInputDimensions) / kAvx512Width;
+    IndexType b = 0;
+    for (; b + kTile <= batch_size; b += kTile) {
+      for (IndexType i = 0; i < OutputDimensions; i += kGroupSize) {
+        __m512i sum[kTile][kGroupSize];
+        for (IndexType t = 0; t < kTile; ++t) {
+          for (IndexType k = 0; k < kGroupSize; ++k) {
+            sum[t][k] = _mm512_setzero_si512();
+          }
+        }
+        const auto rows = reinterpret_cast<const __m512i*>(
+            &weights[i * PaddedInputDimensions]);
+        for (IndexType j = 0; j < kNumChunks; j += kBlockChunks) {
+          const auto block = &rows[j * kGroupSize];
+          for (IndexType s = 0; s < kBlockChunks; ++s) {
+            __m512i w[kGroupSize];
+            for (IndexType k = 0; k < kGroupSize; ++k) {
+              w[k] = _mm512_load_si512(&block[k * kBlockChunks + s]);
+            }
+            for (IndexType t = 0; t < kTile; ++t) {
+              const __m512i in = NNUE_LOAD512(&reinterpret_cast<const __m512i*>(
+                  &input[(b + t) * input_stride])[j + s]);
+              for (IndexType k = 0; k < kGroupSize; ++k) {
+                sum[t][k] = _mm512_dpbusd_epi32(sum[t][k], in, w[k]);
+              }
+            }
+          }
+        }
+        const __m128i bias =
+            _mm_load_si128(reinterpret_cast<const __m128i*>(&biases[i]));
+        for (IndexType t = 0; t < kTile; ++t) {
+          _mm_store_si128(
+              reinterpret_cast<__m128i*>(&output[(b + t) * output_stride + i]),
+              _mm_add_epi32(Avx512::ReduceAdd4(sum[t][0], sum[t][1], sum[t][2], sum[t][3]),
+                            bias));
+        }
+      }
+    }
+    for (; b < batch_size; ++b) {
+      Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          &output[b * output_stride], &input[b * input_stride], weights, biases);
+    }
+  } else {
+    Avx2::AffineBatch<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, output_stride, input, input_stride, batch_size, weights, biases);
+  }
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+NNUE_TARGET("avx512f,avx512bw,avx512vl,avx512vnni")
+inline void SparseAffine(std::int32_t* output, const std::uint8_t* input,
+                         const std::int8_t* weights,
+                         const std::int8_t* sparse_weights,
+                         const std::int32_t* biases) {
+  static_assert(OutputDimensions % 16 == 0, "");
+  constexpr IndexType kNumRegs = OutputDimensions / 16;
+  constexpr IndexType kNumSets = kNumRegs >= 8 ? 1 : 8 / kNumRegs;
+  std::uint16_t chunks[InputDimensions / 4];
+  const IndexType count = Avx512::FindNonZeroChunks<InputDimensions>(chunks, input);
+  if (count > SparseChunkLimit(InputDimensions)) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        output, input, weights, biases);
+    return;
+  }
+  const auto input32 = reinterpret_cast<const std::int32_t*>(input);
+  const auto bias = reinterpret_cast<const __m512i*>(biases);
+  __m512i acc[kNumSets][kNumRegs];
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    acc[0][k] = NNUE_LOAD512(&bias[k]);
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[s][k] = _mm512_setzero_si512();
+    }
+  }
+  IndexType n = 0;
+  for (; n + kNumSets <= count; n += kNumSets) {
+    for (IndexType s = 0; s < kNumSets; ++s) {
+      const IndexType c = chunks[n + s];
+      const __m512i in = _mm512_set1_epi32(input32[c]);
+      const auto column = reinterpret_cast<const __m512i*>(
+          &sparse_weights[c * OutputDimensions * 4]);
+      for (IndexType k = 0; k < kNumRegs; ++k) {
+        acc[s][k] = _mm512_dpbusd_epi32(acc[s][k], in, NNUE_LOAD512(&column[k]));
+      }
+    }
+  }
+  for (; n < count; ++n) {
+    const IndexType c = chunks[n];
+    const __m512i in = _mm512_set1_epi32(input32[c]);
+    const auto column = reinterpret_cast<const __m512i*>(
+        &sparse_weights[c * OutputDimensions * 4]);
+    for (IndexType k = 0; k < kNumRegs; ++k) {
+      acc[0][k] = _mm512_dpbusd_epi32(acc[0][k], in, NNUE_LOAD512(&column[k]));
+    }
+  }
+  const auto out = reinterpret_cast<__m512i*>(output);
+  for (IndexType k = 0; k < kNumRegs; ++k) {
+    for (IndexType s = 1; s < kNumSets; ++s) {
+      acc[0][k] = _mm512_add_epi32(acc[0][k], acc[s][k]);
+    }
+    NNUE_STORE512(&out[k], acc[0][k]);
+  }
+}
+
+}  // namespace Vnni
+
+#endif  // defined(IS_ARM)
+
+// 以下は実行時に選ばれた命令セット（Simd）の実装を呼び出す
+
+template <IndexType N>
+inline void AddColumn(std::int16_t* accumulation, const std::int16_t* column) {
+#if defined(IS_ARM)
+  Neon::AddColumn<N>(accumulation, column);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+    case SIMD_AVX512: Avx512::AddColumn<N>(accumulation, column); break;
+    case SIMD_AVX2:   Avx2::AddColumn<N>(accumulation, column); break;
+    case SIMD_SSE41:
+    case SIMD_SSE2:   Sse2::AddColumn<N>(accumulation, column); break;
+    default:          Scalar::AddColumn<N>(accumulation, column); break;
+  }
+#endif
+}
+
+template <IndexType N>
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int16_t* weights,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+#if defined(IS_ARM)
+  Neon::UpdateColumns<N>(output, input, weights,
+                         removed, num_removed, added, num_added);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+    case SIMD_AVX512:
+      Avx512::UpdateColumns<N>(output, input, weights,
+                               removed, num_removed, added, num_added);
+      break;
+    case SIMD_AVX2:
+      Avx2::UpdateColumns<N>(output, input, weights,
+                             removed, num_removed, added, num_added);
+      break;
+    case SIMD_SSE41:
+    case SIMD_SSE2:
+      Sse2::UpdateColumns<N>(output, input, weights,
+                             removed, num_removed, added, num_added);
+      break;
+    default:
+      Scalar::UpdateColumns<N>(output, input, weights,
+                               removed, num_removed, added, num_added);
+      break;
+  }
+#endif
+}
+
+template <IndexType N>
+inline void UpdateColumns(std::int16_t* output, const std::int16_t* input,
+                          const std::int8_t* weights, std::int16_t scale,
+                          const IndexType* removed, IndexType num_removed,
+                          const IndexType* added, IndexType num_added) {
+#if defined(IS_ARM)
+  Neon::UpdateColumns<N>(output, input, weights, scale,
+                         removed, num_removed, added, num_added);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+    case SIMD_AVX512:
+      Avx512::UpdateColumns<N>(output, input, weights, scale,
+                               removed, num_removed, added, num_added);
+      break;
+    case SIMD_AVX2:
+      Avx2::UpdateColumns<N>(output, input, weights, scale,
+                             removed, num_removed, added, num_added);
+      break;
+    case SIMD_SSE41:
+    case SIMD_SSE2:
+      Sse2::UpdateColumns<N>(output, input, weights, scale,
+                             removed, num_removed, added, num_added);
+      break;
+    default:
+      Scalar::UpdateColumns<N>(output, input, weights, scale,
+                               removed, num_removed, added, num_added);
+      break;
+  }
+#endif
+}
+
+template <IndexType N>
+inline void Pack(std::uint8_t* output, const std::int16_t* accumulation) {
+#if defined(IS_ARM)
+  Neon::Pack<N>(output, accumulation);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+    case SIMD_AVX512: Avx512::Pack<N>(output, accumulation); break;
+    case SIMD_AVX2:   Avx2::Pack<N>(output, accumulation); break;
+    case SIMD_SSE41:
+    case SIMD_SSE2:   Sse2::Pack<N>(output, accumulation); break;
+    default:          Scalar::Pack<N>(output, accumulation); break;
+  }
+#endif
+}
+
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+inline void Affine(std::int32_t* output, const std::uint8_t* input,
+                   const std::int8_t* weights, const std::int32_t* biases) {
+#if defined(IS_ARM)
+  Neon::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+      output, input, weights, biases);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+      Vnni::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+    case SIMD_AVX512:
+      Avx512::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+    case SIMD_AVX2:
+      Avx2::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+    case SIMD_SSE41:
+      Sse41::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+    case SIMD_SSE2:
+      Sse2::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+    default:
+      Scalar::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+  }
+#endif
+}
+
+// 複数の局面の入力をまとめて計算する。局面bの入力はinput + b * input_stride、
+// 出力はoutput + b * output_stride。対応する実装が無い命令セットでは1局面ずつ計算する
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+inline void AffineBatch(std::int32_t* output, IndexType output_stride,
+                        const std::uint8_t* input, IndexType input_stride,
+                        IndexType batch_size, const std::int8_t* weights,
+                        const std::int32_t* biases) {
+#if !defined(IS_ARM)
+  switch (Simd) {
+    case SIMD_VNNI:
+      Vnni::AffineBatch<InputDimensions, PaddedInputDimensions,
+                        OutputDimensions>(
+          output, output_stride, input, input_stride, batch_size,
+          weights, biases);
+      return;
+    case SIMD_AVX512:
+      Avx512::AffineBatch<InputDimensions, PaddedInputDimensions,
+                          OutputDimensions>(
+          output, output_stride, input, input_stride, batch_size,
+          weights, biases);
+      return;
+    case SIMD_AVX2:
+      Avx2::AffineBatch<InputDimensions, PaddedInputDimensions,
+                        OutputDimensions>(
+          output, output_stride, input, input_stride, batch_size,
+          weights, biases);
+      return;
+    default:
+      break;
+  }
+#endif
+  for (IndexType b = 0; b < batch_size; ++b) {
+    Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+        &output[b * output_stride], &input[b * input_stride], weights, biases);
+  }
+}
+
+// 疎な入力用の配置の重みsparse_weightsを使い、0でない入力だけについて計算する
+// 対応する実装が無い命令セットでは、通常の配置の重みweightsで密に計算する
+template <IndexType InputDimensions, IndexType PaddedInputDimensions,
+          IndexType OutputDimensions>
+inline void SparseAffine(std::int32_t* output, const std::uint8_t* input,
+                         const std::int8_t* weights,
+                         const std::int8_t* sparse_weights,
+                         const std::int32_t* biases) {
+#if defined(IS_ARM)
+  (void)sparse_weights;
+  Neon::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+      output, input, weights, biases);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+      Vnni::SparseAffine<InputDimensions, PaddedInputDimensions,
+                         OutputDimensions>(
+          output, input, weights, sparse_weights, biases);
+      break;
+    case SIMD_AVX512:
+      Avx512::SparseAffine<InputDimensions, PaddedInputDimensions,
+                           OutputDimensions>(
+          output, input, weights, sparse_weights, biases);
+      break;
+    case SIMD_AVX2:
+      Avx2::SparseAffine<InputDimensions, PaddedInputDimensions,
+                         OutputDimensions>(
+          output, input, weights, sparse_weights, biases);
+      break;
+    case SIMD_SSE41:
+      Sse41::SparseAffine<InputDimensions, PaddedInputDimensions,
+                          OutputDimensions>(
+          output, input, weights, sparse_weights, biases);
+      break;
+    case SIMD_SSE2:
+      Sse2::Affine<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, input, weights, biases);
+      break;
+    default:
+      Scalar::SparseAffine<InputDimensions, PaddedInputDimensions,
+                           OutputDimensions>(
+          output, input, weights, sparse_weights, biases);
+      break;
+  }
+#endif
+}
+
+// 出力が32次元しかないので、AVX-512でもAVX2の命令を使う
+template <IndexType N>
+inline void ClippedReLU(std::uint8_t* output, const std::int32_t* input) {
+#if defined(IS_ARM)
+  Neon::ClippedReLU<N>(output, input);
+#else
+  switch (Simd) {
+    case SIMD_VNNI:
+    case SIMD_AVX512:
+    case SIMD_AVX2:   Avx2::ClippedReLU<N>(output, input); break;
+    case SIMD_SSE41:
+    case SIMD_SSE2:   Sse2::ClippedReLU<N>(output, input); break;
+    default:          Scalar::ClippedReLU<N>(output, input); break;
+  }
+#endif
+}
+
+}  // namespace Kernels
+
+}  // namespace NNUE
+
+}  // namespace Eval
+
+#endif  // defined(EVAL_NNUE)
+
+#endif
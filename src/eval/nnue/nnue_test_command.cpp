@@ -20,7 +20,10 @@ namespace NNUE {
 namespace {
 
 // 主に差分計算に関するRawFeaturesのテスト
+// 特徴量はアーキテクチャごとに異なるので、学習用のものを対象にする
 void TestFeatures(Position& pos) {
+  using RawFeatures = LearnRawFeatures;
+  constexpr auto kRefreshTriggers = RawFeatures::kRefreshTriggers;
   const std::uint64_t num_games = 1000;
   StateInfo si;
   pos.set(StartFEN, false, &si, Threads.main());
@@ -59,7 +62,7 @@ void TestFeatures(Position& pos) {
     for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
       Features::IndexList removed_indices[2], added_indices[2];
       bool reset[2];
-      RawFeatures::AppendChangedIndices(pos, kRefreshTriggers[i],
+      RawFeatures::AppendChangedIndices(pos, pos.state(), kRefreshTriggers[i],
                                         removed_indices, added_indices, reset);
       for (const auto perspective : Colors) {
         if (reset[perspective]) {
@@ -161,9 +164,11 @@ void PrintInfo(std::istream& stream) {
 
     std::cout << file_name << ": ";
     if (success) {
-      if (hash_value == kHashValue) {
+      const int index = FindArchitecture(hash_value, architecture);
+      if (index >= 0) {
         std::cout << "matches with this binary";
-        if (architecture != GetArchitectureString()) {
+        if (static_cast<std::size_t>(index) == parameters.architecture[kMainNetwork] &&
+            architecture != GetArchitectureString()) {
           std::cout << ", but architecture string differs: " << architecture;
         }
         std::cout << std::endl;
@@ -25,7 +25,7 @@ class Trainer<Layers::AffineTransform<PreviousLayer, OutputDimensions>> {
  public:
   // ファクトリ関数
   static std::shared_ptr<Trainer> Create(
-      LayerType* target_layer, FeatureTransformer* feature_transformer) {
+      LayerType* target_layer, LearnFeatureTransformer* feature_transformer) {
     return std::shared_ptr<Trainer>(
         new Trainer(target_layer, feature_transformer));
   }
@@ -186,7 +186,7 @@ class Trainer<Layers::AffineTransform<PreviousLayer, OutputDimensions>> {
 
  private:
   // コンストラクタ
-  Trainer(LayerType* target_layer, FeatureTransformer* feature_transformer) :
+  Trainer(LayerType* target_layer, LearnFeatureTransformer* feature_transformer) :
       batch_size_(0),
       batch_input_(nullptr),
       previous_layer_trainer_(Trainer<PreviousLayer>::Create(
@@ -213,13 +213,13 @@ class Trainer<Layers::AffineTransform<PreviousLayer, OutputDimensions>> {
     }
     for (IndexType i = 0; i < kOutputDimensions; ++i) {
       const auto offset = kInputDimensions * i;
-      const auto padded_offset = LayerType::kPaddedInputDimensions * i;
       for (IndexType j = 0; j < kInputDimensions; ++j) {
-        target_layer_->weights_[padded_offset + j] =
+        target_layer_->weights_[LayerType::WeightIndex(i, j)] =
             Round<typename LayerType::WeightType>(
                 weights_[offset + j] * kWeightScale);
       }
     }
+    target_layer_->UpdateSparseWeights();
   }
 
   // 整数化されたパラメータの読み込み
@@ -230,10 +230,10 @@ class Trainer<Layers::AffineTransform<PreviousLayer, OutputDimensions>> {
     }
     for (IndexType i = 0; i < kOutputDimensions; ++i) {
       const auto offset = kInputDimensions * i;
-      const auto padded_offset = LayerType::kPaddedInputDimensions * i;
       for (IndexType j = 0; j < kInputDimensions; ++j) {
         weights_[offset + j] = static_cast<LearnFloatType>(
-            target_layer_->weights_[padded_offset + j] / kWeightScale);
+            target_layer_->weights_[LayerType::WeightIndex(i, j)] /
+            kWeightScale);
       }
     }
     std::fill(std::begin(biases_diff_), std::end(biases_diff_),
@@ -23,7 +23,7 @@ class Trainer<Layers::ClippedReLU<PreviousLayer>> {
  public:
   // ファクトリ関数
   static std::shared_ptr<Trainer> Create(
-      LayerType* target_layer, FeatureTransformer* feature_transformer) {
+      LayerType* target_layer, LearnFeatureTransformer* feature_transformer) {
     return std::shared_ptr<Trainer>(
         new Trainer(target_layer, feature_transformer));
   }
@@ -78,7 +78,7 @@ class Trainer<Layers::ClippedReLU<PreviousLayer>> {
 
  private:
   // コンストラクタ
-  Trainer(LayerType* target_layer, FeatureTransformer* feature_transformer) :
+  Trainer(LayerType* target_layer, LearnFeatureTransformer* feature_transformer) :
       batch_size_(0),
       previous_layer_trainer_(Trainer<PreviousLayer>::Create(
           &target_layer->previous_layer_, feature_transformer)),
@@ -26,10 +26,10 @@ namespace NNUE {
 
 // 学習：入力特徴量変換器
 template <>
-class Trainer<FeatureTransformer> {
+class Trainer<LearnFeatureTransformer> {
  private:
   // 学習対象の層の型
-  using LayerType = FeatureTransformer;
+  using LayerType = LearnFeatureTransformer;
 
  public:
   template <typename T>
@@ -69,9 +69,9 @@ class Trainer<FeatureTransformer> {
   template <typename RNG>
   void Initialize(RNG& rng) {
     std::fill(std::begin(weights_), std::end(weights_), +kZero);
-    const double kSigma = 0.1 / std::sqrt(RawFeatures::kMaxActiveDimensions);
+    const double kSigma = 0.1 / std::sqrt(LearnRawFeatures::kMaxActiveDimensions);
     auto distribution = std::normal_distribution<double>(0.0, kSigma);
-    for (IndexType i = 0; i < kHalfDimensions * RawFeatures::kDimensions; ++i) {
+    for (IndexType i = 0; i < kHalfDimensions * LearnRawFeatures::kDimensions; ++i) {
       const auto weight = static_cast<LearnFloatType>(distribution(rng));
       weights_[i] = weight;
     }
@@ -253,9 +253,9 @@ class Trainer<FeatureTransformer> {
     }
     std::vector<TrainingFeature> training_features;
 #pragma omp parallel for private(training_features)
-    for (IndexType j = 0; j < RawFeatures::kDimensions; ++j) {
+    for (IndexType j = 0; j < LearnRawFeatures::kDimensions; ++j) {
       training_features.clear();
-      Features::Factorizer<RawFeatures>::AppendTrainingFeatures(
+      Features::Factorizer<LearnRawFeatures>::AppendTrainingFeatures(
           j, &training_features);
       for (IndexType i = 0; i < kHalfDimensions; ++i) {
         double sum = 0.0;
@@ -275,7 +275,7 @@ class Trainer<FeatureTransformer> {
           target_layer_->biases_[i] / kBiasScale);
     }
     std::fill(std::begin(weights_), std::end(weights_), +kZero);
-    for (IndexType i = 0; i < kHalfDimensions * RawFeatures::kDimensions; ++i) {
+    for (IndexType i = 0; i < kHalfDimensions * LearnRawFeatures::kDimensions; ++i) {
       weights_[i] = static_cast<LearnFloatType>(
           target_layer_->weights_[i] / kWeightScale);
     }
@@ -322,7 +322,7 @@ class Trainer<FeatureTransformer> {
 
   // 入出力の次元数
   static constexpr IndexType kInputDimensions =
-      Features::Factorizer<RawFeatures>::GetDimensions();
+      Features::Factorizer<LearnRawFeatures>::GetDimensions();
   static constexpr IndexType kOutputDimensions = LayerType::kOutputDimensions;
   static constexpr IndexType kHalfDimensions = LayerType::kHalfDimensions;
 
@@ -18,7 +18,7 @@ class SharedInputTrainer {
  public:
   // ファクトリ関数
   static std::shared_ptr<SharedInputTrainer> Create(
-      FeatureTransformer* feature_transformer) {
+      LearnFeatureTransformer* feature_transformer) {
     static std::shared_ptr<SharedInputTrainer> instance;
     if (!instance) {
       instance.reset(new SharedInputTrainer(feature_transformer));
@@ -105,19 +105,19 @@ class SharedInputTrainer {
 
  private:
   // コンストラクタ
-  SharedInputTrainer(FeatureTransformer* feature_transformer) :
+  SharedInputTrainer(LearnFeatureTransformer* feature_transformer) :
       batch_size_(0),
       num_referrers_(0),
       num_calls_(0),
       current_operation_(Operation::kNone),
-      feature_transformer_trainer_(Trainer<FeatureTransformer>::Create(
+      feature_transformer_trainer_(Trainer<LearnFeatureTransformer>::Create(
           feature_transformer)),
       output_(nullptr) {
   }
 
   // 入出力の次元数
   static constexpr IndexType kInputDimensions =
-      FeatureTransformer::kOutputDimensions;
+      LearnFeatureTransformer::kOutputDimensions;
 
   // 処理の種類
   enum class Operation {
@@ -141,7 +141,7 @@ class SharedInputTrainer {
   Operation current_operation_;
 
   // 入力特徴量変換器のTrainer
-  const std::shared_ptr<Trainer<FeatureTransformer>>
+  const std::shared_ptr<Trainer<LearnFeatureTransformer>>
       feature_transformer_trainer_;
 
   // 順伝播用に共有する出力のポインタ
@@ -161,7 +161,7 @@ class Trainer<Layers::InputSlice<OutputDimensions, Offset>> {
  public:
   // ファクトリ関数
   static std::shared_ptr<Trainer> Create(
-      LayerType* /*target_layer*/, FeatureTransformer* feature_transformer) {
+      LayerType* /*target_layer*/, LearnFeatureTransformer* feature_transformer) {
     return std::shared_ptr<Trainer>(new Trainer(feature_transformer));
   }
 
@@ -218,14 +218,14 @@ class Trainer<Layers::InputSlice<OutputDimensions, Offset>> {
 
  private:
   // コンストラクタ
-  Trainer(FeatureTransformer* feature_transformer) :
+  Trainer(LearnFeatureTransformer* feature_transformer) :
       batch_size_(0),
       shared_input_trainer_(SharedInputTrainer::Create(feature_transformer)) {
   }
 
   // 入出力の次元数
   static constexpr IndexType kInputDimensions =
-      FeatureTransformer::kOutputDimensions;
+      LearnFeatureTransformer::kOutputDimensions;
   static constexpr IndexType kOutputDimensions = OutputDimensions;
   static_assert(Offset + kOutputDimensions <= kInputDimensions, "");
 
@@ -21,6 +21,7 @@
 #include "types.h"
 
 class Position;
+struct StateInfo;
 
 // Check for (likely) material draw
 #define CHECK_MAT_DRAW
@@ -56,12 +57,152 @@ namespace Eval {
 
 Value evaluate(const Position *pos);
 
+#if defined(EVAL_NNUE)
+// EvalSmallNetŏȕ]֐ǂݍł΂ŕ]AȂevaluate()ƓB
+// Î~TƁAPVm[hŎ}̔ɎgÓI]lɗpB
+// ǖʂƂ̗ݐϒleval hash̃Gg]֐ƂɕʂɎB
+Value evaluate_fast(const Position *pos);
+#else
+inline Value evaluate_fast(const Position *pos) { return evaluate(pos); }
+#endif
+
+#if defined(EVAL_NNUE)
+// evaluate_fast()ȕ]֐ŕ]ȂtrueB
+// ̕]l͒u\ɕۑȂBPVm[hevaluate()̑ɎgĂ܂߁B
+bool small_network_loaded();
+#else
+inline bool small_network_loaded() { return false; }
+#endif
+
+#if defined(EVAL_NNUE)
+// ǂݍ񂾎̕]֐ʂlBp[^̓e狁߂B
+// ۑu\̕]lA̕]֐ŌvẐm߂̂ɎgB
+uint64_t network_id();
+#else
+inline uint64_t network_id() { return 0; }
+#endif
+
+#if defined(EVAL_NNUE)
+// ̋ǖʂ܂Ƃ߂ĕ]Aԑ猩]lvaluesɏށB
+// lbg[N̏d݂ǂݍނтɕ̋ǖʂɎĝŁA1ǖʂevaluate()ĂԂ葬B
+// ]levaluate()ƓɂȂBeval hash͎gȂB
+void evaluate_batch(const Position* const* positions, int count, Value* values);
+#endif
+
 #if defined(EVAL_NNUE) || defined(EVAL_LEARN)
 // �]���֐��t�@�C����ǂݍ��ށB
 // ����́A"is_ready"�R�}���h�̉�������1�x�����Ăяo�����B2�x�Ăяo�����Ƃ͑z�肵�Ă��Ȃ��B
 // (�������AEvalDir(�]���֐��t�H���_)���ύX�ɂȂ������ƁAisready���ēx�����Ă�����ǂ݂Ȃ����B)
 void load_eval();
 
+// ]֐t@C𗠂̃XbhŐV̈ɓǂݍݎn߂āAɖ߂B
+// ǂݍ񂾂͎̂swap_eval()ōւ̂ŁAT~߂ɕ]֐؂ւB
+// ǂݍ߂Ȃ΁AւƂɂo͂č̕]֐gB
+// ܂ǂݍłȂload_eval()ƓB
+void load_eval_async();
+
+// œǂݍݏI]֐AT̃XbhȂ΍ւtrueԂB
+// Âp[^͂ŉBgoŒTn߂OɌĂяoB
+bool swap_eval();
+
+// Tn߂ƂAIƂɌĂяoBTswap_eval()ւȂB
+void enter_search();
+void leave_search();
+
+// ǂݍ񂾕]֐p[^AvZp̔zû܂EvalDirɏoB
+// EvalMapLȂA񂩂͂̃t@CǂݎpmmapĎgB
+// onn.binςĂ΁Ãt@C͎g킸nn.binǂݍށB
+bool save_eval_map();
+
+// NUMAm[hɕ]֐p[^̕BNUMAȂ畡jB
+void create_replicas();
+
+// ĂяoXbh]ɗpp[^Ãm[h̕ɐ؂ւB
+void bind_replica(int node);
+
+// eval hash̑傫[MB]ύXB2ׂ̂ɐ؂艺A0ȂgȂB
+void resize_eval_hash(size_t mb);
+
+// eval hashNABucinewgameŒu\ƋɃNAB
+void clear_eval_hash();
+
+// wwɁA]Ŏgeval hash̃GgAd݁Aݐϒlǂ݂ĂB
+// NO_PREFETCH`ĂΉȂB
+void prefetch_evaluation(const Position* pos);
+
+// SIMĎoȞvZʂAXJ[̌oHňꂩvẐƊSɈv邩m߂B
+// ݐϒl͍vZłȂ獷vZB
+bool verify_simd(const Position* pos);
+
+// Őǖʂ̍vZrepetitionsJԂA[ns]ԂB
+uint64_t time_update(const Position* pos, int repetitions);
+
+// ݐϒlvZς݂̋ǖʂŃlbg[ŇvZrepetitionsJԂA[ns]ԂB
+uint64_t time_evaluate(const Position* pos, int repetitions);
+
+// x`}[N̋ǖʂőAŏ̑w̓͂̂0łȂ4oCg̉̊ԂB
+// sparseɂ́Åŏ̑w0łȂ͂ŌvZĂ邩ԂB
+double input_density(bool* sparse);
+
+// vZLbVpɗݐϒlSvZ邱ƂrepetitionsJԂA[ns]ԂB
+uint64_t time_refresh(const Position* pos, int repetitions);
+
+// ݐϒlvZς݂̋ǖʂœ͓ʂ̕ϊrepetitionsJԂA[ns]ԂB
+uint64_t time_transform(const Position* pos, int repetitions);
+
+// ݐϒlvZς݂̋ǖʂŁAlbg[N̏`drepetitionsJԂA[ns]ԂB
+uint64_t time_propagate(const Position* pos, int repetitions);
+
+// Őǖʂ̍vZ܂߂evaluate()repetitionsJԂA[ns]ԂB
+// use_hashfalseȂeval hashȂBtrueȂ2ڈȍ~eval hashɓB
+uint64_t time_evaluate_full(const Position* pos, int repetitions, bool use_hash);
+
+// countǖʂbatch_sizeǖʂevaluate_batch()ŕ]邱ƂrepetitionsJԂA[ns]ԂB
+uint64_t time_evaluate_batch(const Position* const* positions, int count, int batch_size, int repetitions);
+
+// ǂݍ񂾃p[^oA]֐t@CƓeɂȂ邩m߂B
+bool verify_parameters();
+
+// ǂݍ񂾕]֐͓̓ʕϊ̏d݂8bitɗʎqA]֐t@CƂfile_nameɏoB
+// ʎq̑OŊeǖʂSvZ]lbefore, afterɏށBʎqłgݍłȂfalseԂB
+bool quantize_eval(const char* file_name, const Position* const* positions, int count, Value* before, Value* after);
+
+// ]֐t@Č`Ƃ́A傫Ɠǂݍ݂ɂ鎞[ns]̓
+struct LoadTimes {
+  uint64_t bytes;      // t@C̑傫
+  uint64_t read_ns;    // t@Cɓǂݍނ̎
+  uint64_t decode_ns;  // k`𕜍ԁBSXbh̍v
+  uint64_t parse_ns;   // ̃t@Cp[^ǂݍގԁB܂
+  uint64_t load_ns;    // ]֐ǂݍނƂƓAt@C璼ړǂݍގ
+};
+
+// ǂݍ񂾕]֐k`file_nameɁAׂ邽߂Ɍ̌`raw_file_nameɏoB
+bool compress_eval(const char* file_name, const char* raw_file_name);
+
+// file_name̕]֐ǂݍނ̂ɂ鎞Ԃ̓Arepetitionŝł̂ŋ߂B
+// k`threads̃XbhŕBǂݍ񂾂̂̕]֐ƈႦfalseԂB
+bool time_load_eval(const char* file_name, int threads, int repetitions, LoadTimes* times);
+
+// ]֐̌Ăяo񐔂̓v
+struct EvalStats {
+  uint64_t evaluate_calls; // evaluate()̌Ăяo
+  uint64_t compute_calls;  // lbg[NۂɌvZ
+  uint64_t hash_probes;    // eval hash
+  uint64_t hash_hits;      // eval hashɂ
+  uint64_t update_calls;   // vZŗݐϒl߂
+  uint64_t update_plies;   // vZők萔̍v
+  uint64_t refresh_calls;  // ݐϒlSvZ
+};
+
+// vZbg
+void reset_eval_stats();
+
+// ĂяoXbh̓vŜɉBTXbh̏IɌĂяoB
+void collect_eval_stats();
+
+// SXbh̓v擾BsmallȂ珬ȕ]֐̕擾
+EvalStats eval_stats(bool small = false);
+
 // --- �]���֐��Ŏg���萔 KPP(�ʂƔC��2��)��P�ɑ�������enum
 
 // (�]���֐��̎����̂Ƃ��ɂ́ABonaPiece�͎��R�ɒ�`�������̂ł����ł͒�`���Ȃ��B)
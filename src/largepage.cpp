@@ -0,0 +1,169 @@
+/*
+  Weiss is a UCI compliant chess engine.
+  Copyright (C) 2020  Terje Kirstihagen
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <linux/mman.h>
+#else
+    #include <mm_malloc.h>
+#endif
+
+#include "largepage.h"
+#include "types.h"
+
+
+#define FOUR_KB (4ULL * 1024)
+#define TWO_MB  (2ULL * 1024 * 1024)
+#define ONE_GB  (1024ULL * 1024 * 1024)
+
+#define RoundUp(size, align) (((size) + (align) - 1) & ~((align) - 1))
+
+
+#if defined(__linux__)
+// Maps memory backed by explicitly reserved huge pages
+static void *MapHugeTLB(size_t size, int flags) {
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | flags, -1, 0);
+
+    return mem == MAP_FAILED ? NULL : mem;
+}
+#endif
+
+// Allocates 2MB aligned memory, trying 1GB and 2MB huge pages from the
+// reserved pool first, then transparent huge pages, then normal pages.
+// Less than a huge page only gets page aligned normal pages, rounding
+// it up would waste most of a huge page that could back something else.
+void *LargePageAlloc(size_t size, int *kind) {
+
+    void *mem = NULL;
+
+    if (size < TWO_MB) {
+#if defined(__linux__)
+        mem = aligned_alloc(FOUR_KB, RoundUp(size, FOUR_KB));
+#else
+        mem = _mm_malloc(RoundUp(size, FOUR_KB), FOUR_KB);
+#endif
+        return *kind = mem ? PAGES_NORMAL : PAGES_NONE, mem;
+    }
+
+#if defined(__linux__)
+    if (size >= ONE_GB && (mem = MapHugeTLB(RoundUp(size, ONE_GB), MAP_HUGE_1GB)))
+        return *kind = PAGES_HUGETLB_1GB, mem;
+
+    if ((mem = MapHugeTLB(RoundUp(size, TWO_MB), MAP_HUGE_2MB)))
+        return *kind = PAGES_HUGETLB_2MB, mem;
+
+    if (!(mem = aligned_alloc(TWO_MB, RoundUp(size, TWO_MB))))
+        return *kind = PAGES_NONE, mem;
+
+    // Only a hint, whether it was granted is seen after the memory is touched
+    *kind = madvise(mem, RoundUp(size, TWO_MB), MADV_HUGEPAGE) ? PAGES_NORMAL
+                                                               : PAGES_TRANSPARENT;
+#else
+    mem = _mm_malloc(RoundUp(size, TWO_MB), TWO_MB);
+    *kind = mem ? PAGES_NORMAL : PAGES_NONE;
+#endif
+
+    return mem;
+}
+
+// Frees memory allocated by LargePageAlloc
+void LargePageFree(void *mem, size_t size, int kind) {
+
+    if (!mem) return;
+
+#if defined(__linux__)
+    switch (kind) {
+        case PAGES_HUGETLB_1GB: munmap(mem, RoundUp(size, ONE_GB)); break;
+        case PAGES_HUGETLB_2MB: munmap(mem, RoundUp(size, TWO_MB)); break;
+        case PAGES_MAPPED     : munmap(mem, size);                  break;
+        default               : free(mem);                          break;
+    }
+#else
+    (void)size, (void)kind;
+    _mm_free(mem);
+#endif
+}
+
+// Counts how much of the memory is backed by transparent huge pages
+static size_t TransparentHugePages(const void *mem) {
+
+    size_t granted = 0;
+
+#if defined(__linux__)
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (!smaps) return 0;
+
+    char line[256];
+    bool inside = false;
+    uintptr_t begin, end, addr = (uintptr_t)mem;
+
+    while (fgets(line, sizeof(line), smaps)) {
+
+        // Mapping headers start with the address range
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR, &begin, &end) == 2)
+            inside = begin <= addr && addr < end;
+
+        else if (inside && sscanf(line, "AnonHugePages: %zu kB", &granted) == 1)
+            break;
+    }
+
+    fclose(smaps);
+#else
+    (void)mem;
+#endif
+
+    return granted * 1024;
+}
+
+// Prints what kind of pages ended up backing the memory,
+// should be called after the memory has been touched
+void ReportLargePages(const char *name, const void *mem, size_t size, int kind) {
+
+    // Small allocations are reported in KB
+    char amount[32];
+    size < TWO_MB / 2 ? sprintf(amount, "%zuKB", size / 1024)
+                      : sprintf(amount, "%zuMB", size / (1024 * 1024));
+
+    switch (kind) {
+        case PAGES_HUGETLB_1GB:
+            printf("info string %s %s allocated with 1GB huge pages\n", name, amount);
+            break;
+        case PAGES_HUGETLB_2MB:
+            printf("info string %s %s allocated with 2MB huge pages\n", name, amount);
+            break;
+        case PAGES_TRANSPARENT:
+            printf("info string %s %s allocated with transparent huge pages, %zuMB granted\n",
+                   name, amount, MIN(size, TransparentHugePages(mem)) / (1024 * 1024));
+            break;
+        case PAGES_MAPPED:
+            printf("info string %s %s mapped read-only from file\n", name, amount);
+            break;
+        default:
+            printf("info string %s %s allocated with normal pages\n", name, amount);
+            break;
+    }
+
+    fflush(stdout);
+}
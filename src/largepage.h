@@ -0,0 +1,37 @@
+/*
+  Weiss is a UCI compliant chess engine.
+  Copyright (C) 2020  Terje Kirstihagen
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+
+// How an allocation ended up being backed, from best to worst
+enum PageKind {
+    PAGES_NONE,
+    PAGES_HUGETLB_1GB,
+    PAGES_HUGETLB_2MB,
+    PAGES_TRANSPARENT,
+    PAGES_NORMAL,
+    PAGES_MAPPED  // Read-only file mapping, shared with other processes
+};
+
+
+void *LargePageAlloc(size_t size, int *kind);
+void LargePageFree(void *mem, size_t size, int kind);
+void ReportLargePages(const char *name, const void *mem, size_t size, int kind);
@@ -132,6 +132,12 @@ static void MovePiece(Position *pos, const Square from, const Square to, const b
 // Take back the previous move
 void TakeMove(Position *pos) {
 
+#ifdef EVAL_NNUE
+    // The state being taken back knows which pieces the move changed
+    StateInfo *st = pos->st;
+    pos->st = st->previous;
+#endif
+
     // Decrement histPly, ply
     pos->histPly--;
     pos->ply--;
@@ -146,8 +152,6 @@ void TakeMove(Position *pos) {
     const Square to = toSq(move);
 #ifdef EVAL_NNUE
     Piece pc = pieceOn(to);
-
-    StateInfo *st = pos->state();
 #endif
 
     if (promotion(move)) {
@@ -243,22 +247,6 @@ void TakeMove(Position *pos) {
 // Make a move - take it back and return false if move was illegal
 bool MakeMove(Position *pos, const Move move) {
 
-#if defined(EVAL_NNUE)
-
-    StateInfo *st = pos->state();
-
-    st->accumulator.computed_accumulation = false;
-    st->accumulator.computed_score = false;
-
-    PieceNumber piece_no0 = PIECE_NUMBER_NB;
-    PieceNumber piece_no1 = PIECE_NUMBER_NB;
-
-    auto& dp = st->dirtyPiece;
-    dp.dirty_num = 1;
-
-    Square capsq = SQUARE_NB;
-#endif  // defined(EVAL_NNUE)
-
     // Save position
     history(0).posKey         = pos->key;
     history(0).move           = move;
@@ -271,6 +259,28 @@ bool MakeMove(Position *pos, const Move move) {
     pos->ply++;
     pos->rule50++;
 
+#if defined(EVAL_NNUE)
+    // The new state records the pieces the move changes, and
+    // its accumulators are computed from the previous ones later
+    assert(pos->st + 1 < pos->states + STATE_STACK_SIZE);
+    StateInfo *st = pos->st + 1;
+    st->previous = pos->st;
+    pos->st = st;
+
+    for (int i = 0; i < Eval::NNUE::kNetworkSlots; ++i) {
+        st->accumulators[i].computed_accumulation = false;
+        st->accumulators[i].computed_score = false;
+    }
+
+    PieceNumber piece_no0 = PIECE_NUMBER_NB;
+    PieceNumber piece_no1 = PIECE_NUMBER_NB;
+
+    auto& dp = st->dirtyPiece;
+    dp.dirty_num = 1;
+
+    Square capsq = SQUARE_NB;
+#endif  // defined(EVAL_NNUE)
+
     // Hash out en passant if there was one, and unset it
     HASH_EP;
     pos->epSquare = 0;
@@ -285,6 +295,9 @@ bool MakeMove(Position *pos, const Move move) {
     HASH_CA;
     pos->castlingRights &= CastlePerm[from] & CastlePerm[to];
     HASH_CA;
+#if defined(EVAL_NNUE)
+    st->castlingRights = pos->castlingRights;
+#endif
 
     // Remove captured piece if any
     Piece capt = capturing(move);
@@ -411,6 +424,11 @@ bool MakeMove(Position *pos, const Move move) {
     sideToMove = ~sideToMove;
     HASH_SIDE;
 
+#if defined(EVAL_NNUE)
+    // Start fetching what evaluating the new position needs
+    Eval::prefetch_evaluation(pos);
+#endif
+
     // If own king is attacked after the move, take it back immediately
     if (KingAttacked(pos, ~sideToMove))
         return TakeMove(pos), false;
@@ -440,12 +458,22 @@ void MakeNullMove(Position *pos) {
     pos->rule50 = 0;
 
 #if defined(EVAL_NNUE)
-    StateInfo *st = pos->state();
-
-    st->accumulator = st->previous->accumulator;
-    st->accumulator.computed_score = false;
-
-    st->dirtyPiece = st->previous->dirtyPiece;
+    // No pieces change, so the null move shares the accumulators of the
+    // parent, only its score is from the other side's perspective. Features
+    // of a cleared en passant square need a state of their own though
+    if (pos->epSquare) {
+        assert(pos->st + 1 < pos->states + STATE_STACK_SIZE);
+        StateInfo *st = pos->st + 1;
+        st->previous = pos->st;
+        pos->st = st;
+
+        for (int i = 0; i < Eval::NNUE::kNetworkSlots; ++i)
+            st->accumulators[i].computed_accumulation = false;
+        st->dirtyPiece.dirty_num = 0;
+        st->castlingRights = pos->castlingRights;
+    }
+    for (int i = 0; i < Eval::NNUE::kNetworkSlots; ++i)
+        pos->st->accumulators[i].computed_score = false;
 #endif
 
     // Change side to play
@@ -475,6 +503,15 @@ void TakeNullMove(Position *pos) {
     pos->rule50         = history(0).rule50;
     pos->castlingRights = history(0).castlingRights;
 
+#if defined(EVAL_NNUE)
+    // Leave the state taken for a cleared en passant square, and
+    // forget any score computed from the other side's perspective
+    if (pos->epSquare)
+        pos->st = pos->st->previous;
+    for (int i = 0; i < Eval::NNUE::kNetworkSlots; ++i)
+        pos->st->accumulators[i].computed_score = false;
+#endif
+
     assert(PositionOk(pos));
 }
 
@@ -150,13 +150,13 @@ void InitNormalMP(MovePicker *mp, MoveList *list, Thread *thread, Move ttMove, M
 }
 
 // Init noisy movepicker
-void InitNoisyMP(MovePicker *mp, MoveList *list, Thread *thread) {
+void InitNoisyMP(MovePicker *mp, MoveList *list, Thread *thread, Move ttMove) {
     list->count   = list->next = 0;
     mp->list      = list;
     mp->thread    = thread;
-    mp->ttMove    = NOMOVE;
+    mp->ttMove    = moveIsNoisy(ttMove) && MoveIsPseudoLegal(&thread->pos, ttMove) ? ttMove : NOMOVE;
     mp->kill1     = NOMOVE;
     mp->kill2     = NOMOVE;
-    mp->stage     = GEN_NOISY;
+    mp->stage     = mp->ttMove ? TTMOVE : GEN_NOISY;
     mp->onlyNoisy = true;
 }
@@ -35,4 +35,4 @@ typedef struct MovePicker {
 
 Move NextMove(MovePicker *mp);
 void InitNormalMP(MovePicker *mp, MoveList *list, Thread *thread, Move ttMove, Move kill1, Move kill2);
-void InitNoisyMP(MovePicker *mp, MoveList *list, Thread *thread);
+void InitNoisyMP(MovePicker *mp, MoveList *list, Thread *thread, Move ttMove);
@@ -0,0 +1,108 @@
+/*
+  Weiss is a UCI compliant chess engine.
+  Copyright (C) 2020  Terje Kirstihagen
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#if defined(__linux__)
+    #include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numa.h"
+
+
+bool NumaEnabled = false;
+
+static int nodeCount = 1;
+
+#if defined(__linux__)
+static cpu_set_t nodeCPUs[MAX_NUMA_NODES];
+
+// Parses a cpulist like "0-15,32-47" into a cpu set
+static void ParseCPUList(char *str, cpu_set_t *set) {
+
+    CPU_ZERO(set);
+
+    for (char *range = strtok(str, ","); range; range = strtok(NULL, ",")) {
+
+        int first, last;
+        if (sscanf(range, "%d-%d", &first, &last) != 2)
+            last = first = atoi(range);
+
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+    }
+}
+#endif
+
+// Reads the NUMA topology from sysfs, only counting
+// nodes that have cpus this process is allowed to use
+void InitNuma() {
+
+    nodeCount = 1;
+
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return;
+
+    int found = 0;
+
+    for (int node = 0; node < 1024 && found < MAX_NUMA_NODES; ++node) {
+
+        char path[64], list[4096] = { 0 };
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+
+        FILE *file = fopen(path, "r");
+        if (!file) continue;
+        bool read = fgets(list, sizeof(list), file);
+        fclose(file);
+        if (!read) continue;
+
+        list[strcspn(list, "\n")] = '\0';
+        ParseCPUList(list, &nodeCPUs[found]);
+        CPU_AND(&nodeCPUs[found], &nodeCPUs[found], &allowed);
+
+        if (CPU_COUNT(&nodeCPUs[found]))
+            found++;
+    }
+
+    nodeCount = MAX(1, found);
+#endif
+}
+
+int NumaNodes() {
+    return nodeCount;
+}
+
+// Threads are spread round-robin over the nodes, so any
+// contiguous range of thread indexes is split evenly
+int NumaNodeOf(const int threadIndex) {
+    return NumaEnabled ? threadIndex % nodeCount : 0;
+}
+
+// Pins the calling thread to the cpus of a node
+void BindToNode(const int node) {
+
+#if defined(__linux__)
+    if (NumaEnabled && nodeCount > 1)
+        sched_setaffinity(0, sizeof(cpu_set_t), &nodeCPUs[node]);
+#else
+    (void)node;
+#endif
+}
@@ -114,11 +114,42 @@ static int Quiescence(Thread *thread, int alpha, const int beta) {
     if (pos->ply >= MAXDEPTH)
         return Eval::evaluate(pos);
 
+    const bool pvNode = alpha != beta - 1;
+
+    // Probe transposition table
+    bool ttHit;
+    Key posKey = pos->key;
+    TTEntry tte;
+    TTEntry *ttSlot = ProbeTT(posKey, &tte, &ttHit);
+
+    Move ttMove = ttHit ? tte.move : NOMOVE;
+    int ttScore = ttHit ? ScoreFromTT(tte.score, pos->ply) : NOSCORE;
+
+    // Any entry is deep enough to be trusted in quiescence
+    if (   !pvNode && ttHit && tte.score != NOSCORE
+        && (ttScore >= beta ? Bound(&tte) & BOUND_LOWER
+                            : Bound(&tte) & BOUND_UPPER))
+        return ttScore;
+
     // Standing Pat -- If the stand-pat beats beta there is most likely also a move that beats beta
     // so we assume we have a beta cutoff. If the stand-pat beats alpha we use it as alpha.
-    int score = Eval::evaluate(pos);
-    if (score >= beta)
+    // Outside the PV the small network, if one is loaded, is good enough for this, but its evals
+    // are kept out of the TT so PV nodes never pick them up
+    bool smallEval = !pvNode && !(ttHit && tte.eval != NOSCORE) && Eval::small_network_loaded();
+    int eval = ttHit && tte.eval != NOSCORE ? tte.eval
+             : pvNode                       ? (int)Eval::evaluate(pos)
+                                            : (int)Eval::evaluate_fast(pos);
+    int ttEval = smallEval ? NOSCORE : eval;
+    int score = eval;
+
+    // Taken before the stand-pat can raise alpha, so a score inside the window is stored as exact
+    const int oldAlpha = alpha;
+
+    if (score >= beta) {
+        if (!ttHit)
+            StoreTTEntry(ttSlot, posKey, NOMOVE, ScoreToTT(score, pos->ply), ttEval, 0, BOUND_LOWER);
         return score;
+    }
     if (score + QuiescenceDeltaMargin(pos) < alpha)
         return alpha;
     if (score > alpha)
@@ -126,9 +157,10 @@ static int Quiescence(Thread *thread, int alpha, const int beta) {
 
     int futility = score + P_EG;
 
-    InitNoisyMP(&mp, &list, thread);
+    InitNoisyMP(&mp, &list, thread, ttMove);
 
     int bestScore = score;
+    Move bestMove = NOMOVE;
 
     // Move loop
     Move move;
@@ -152,6 +184,7 @@ static int Quiescence(Thread *thread, int alpha, const int beta) {
             // If score beats alpha we update alpha
             if (score > alpha) {
                 alpha = score;
+                bestMove = move;
 
                 // If score beats beta we have a cutoff
                 if (score >= beta)
@@ -160,6 +193,13 @@ static int Quiescence(Thread *thread, int alpha, const int beta) {
         }
     }
 
+    // Store in TT
+    const int flag = bestScore >= beta ? BOUND_LOWER
+                   : alpha != oldAlpha ? BOUND_EXACT
+                                       : BOUND_UPPER;
+
+    StoreTTEntry(ttSlot, posKey, bestMove, ScoreToTT(bestScore, pos->ply), ttEval, 0, flag);
+
     return bestScore;
 }
 
@@ -214,21 +254,22 @@ static int AlphaBeta(Thread *thread, int alpha, int beta, Depth depth, PV *pv) {
     // Probe transposition table
     bool ttHit;
     Key posKey = pos->key;
-    TTEntry *tte = ProbeTT(posKey, &ttHit);
+    TTEntry tte;
+    TTEntry *ttSlot = ProbeTT(posKey, &tte, &ttHit);
 
-    Move ttMove = ttHit ? tte->move : NOMOVE;
-    int ttScore = ttHit ? ScoreFromTT(tte->score, pos->ply) : NOSCORE;
+    Move ttMove = ttHit ? tte.move : NOMOVE;
+    int ttScore = ttHit ? ScoreFromTT(tte.score, pos->ply) : NOSCORE;
 
     // Trust the ttScore in non-pvNodes as long as the entry depth is equal or higher
-    if (!pvNode && ttHit && tte->depth >= depth) {
+    if (!pvNode && ttHit && tte.depth >= depth) {
 
-        assert(ValidBound(tte->bound));
-        assert(ValidDepth(tte->depth));
+        assert(ValidBound(Bound(&tte)));
+        assert(ValidDepth(tte.depth));
         assert(ValidScore(ttScore));
 
         // Check if ttScore causes a cutoff
-        if (ttScore >= beta ? tte->bound & BOUND_LOWER
-                            : tte->bound & BOUND_UPPER)
+        if (ttScore >= beta ? Bound(&tte) & BOUND_LOWER
+                            : Bound(&tte) & BOUND_UPPER)
 
             return ttScore;
     }
@@ -244,7 +285,7 @@ static int AlphaBeta(Thread *thread, int alpha, int beta, Depth depth, PV *pv) {
         if (    bound == BOUND_EXACT
             || (bound == BOUND_LOWER ? score >= beta : score <= alpha)) {
 
-            StoreTTEntry(tte, posKey, NOMOVE, ScoreToTT(score, pos->ply), MAXDEPTH-1, bound);
+            StoreTTEntry(ttSlot, posKey, NOMOVE, ScoreToTT(score, pos->ply), NOSCORE, MAXDEPTH-1, bound);
             return score;
         }
 
@@ -254,14 +295,22 @@ static int AlphaBeta(Thread *thread, int alpha, int beta, Depth depth, PV *pv) {
         }
     }
 
-    // Do a static evaluation for pruning considerations
+    // Do a static evaluation for pruning considerations, reusing the one stored in the TT if possible.
+    // Outside the PV it is only used for pruning, so the small network, if one is loaded, will do.
+    // Small network evals are not stored in the TT, where PV nodes would pick them up
 #ifdef EVAL_NNUE
-    int eval = history(0).eval = Eval::evaluate(pos);
-    eval = history(0).eval = inCheck ? NOSCORE : eval;
+    bool smallEval = !inCheck && !pvNode && !(ttHit && tte.eval != NOSCORE) && Eval::small_network_loaded();
+    int eval = history(0).eval = inCheck                      ? NOSCORE
+                               : ttHit && tte.eval != NOSCORE ? tte.eval
+                               : pvNode                       ? (int)Eval::evaluate(pos)
+                                                              : (int)Eval::evaluate_fast(pos);
+    int ttEval = smallEval ? NOSCORE : eval;
 #else
-    int eval = history(0).eval = inCheck          ? NOSCORE
-                               : lastMoveNullMove ? -history(-1).eval + 2 * Tempo
-                                                  : (Score)Eval::evaluate(pos);
+    int eval = history(0).eval = inCheck                      ? NOSCORE
+                               : ttHit && tte.eval != NOSCORE ? tte.eval
+                               : lastMoveNullMove             ? -history(-1).eval + 2 * Tempo
+                                                              : (Score)Eval::evaluate(pos);
+    int ttEval = eval;
 #endif
 
     // Improving if not in check, and current eval is higher than 2 plies ago
@@ -285,7 +334,7 @@ static int AlphaBeta(Thread *thread, int alpha, int beta, Depth depth, PV *pv) {
         && eval >= beta
         && pos->nonPawnCount[sideToMove] > 0
         && depth >= 3
-        && (!ttHit || !(tte->bound & BOUND_UPPER) || ttScore >= beta)) {
+        && (!ttHit || !(Bound(&tte) & BOUND_UPPER) || ttScore >= beta)) {
 
         int R = 3 + depth / 5 + MIN(3, (eval - beta) / 256);
 
@@ -304,13 +353,13 @@ static int AlphaBeta(Thread *thread, int alpha, int beta, Depth depth, PV *pv) {
     if (  !pvNode
         && depth >= 5
         && abs(beta) < TBWIN_IN_MAX
-        && (!ttHit || !(tte->bound & BOUND_UPPER) || ttScore >= beta)) {
+        && (!ttHit || !(Bound(&tte) & BOUND_UPPER) || ttScore >= beta)) {
 
         int pbBeta = beta + 200;
 
         MovePicker pbMP;
         MoveList pbList;
-        InitNoisyMP(&pbMP, &pbList, thread);
+        InitNoisyMP(&pbMP, &pbList, thread, NOMOVE);
 
         Move pbMove;
         while ((pbMove = NextMove(&pbMP))) {
@@ -334,9 +383,9 @@ static int AlphaBeta(Thread *thread, int alpha, int beta, Depth depth, PV *pv) {
 
         AlphaBeta(thread, alpha, beta, CLAMP(depth-4, 1, depth/2), pv);
 
-        tte = ProbeTT(posKey, &ttHit);
+        ttSlot = ProbeTT(posKey, &tte, &ttHit);
 
-        ttMove = ttHit ? tte->move : NOMOVE;
+        ttMove = ttHit ? tte.move : NOMOVE;
     }
 
 move_loop:
@@ -360,7 +409,7 @@ move_loop:
         if (!pvNode && !inCheck && quietCount > (3 + 2 * depth * depth) / (2 - improving))
             break;
 
-        __builtin_prefetch(GetEntry(KeyAfter(pos, move)));
+        __builtin_prefetch(GetBucket(KeyAfter(pos, move)));
 
         // Make the move, skipping to the next if illegal
         if (!MakeMove(pos, move)) continue;
@@ -455,7 +504,7 @@ move_loop:
                    : alpha != oldAlpha ? BOUND_EXACT
                                        : BOUND_UPPER;
 
-    StoreTTEntry(tte, posKey, bestMove, ScoreToTT(bestScore, pos->ply), depth, flag);
+    StoreTTEntry(ttSlot, posKey, bestMove, ScoreToTT(bestScore, pos->ply), ttEval, depth, flag);
 
     assert(alpha >= oldAlpha);
     assert(ValidScore(alpha));
@@ -517,6 +566,8 @@ static void *IterativeDeepening(void *voidThread) {
     Thread *thread = (Thread *)voidThread;
     bool mainThread = thread->index == 0;
 
+    BindThread(thread);
+
     // Iterative deepening
     for (thread->depth = 1; thread->depth <= Limits.depth; ++thread->depth) {
 
@@ -542,6 +593,10 @@ static void *IterativeDeepening(void *voidThread) {
         thread->seldepth = 0;
     }
 
+#ifdef EVAL_NNUE
+    Eval::collect_eval_stats();
+#endif
+
     return NULL;
 }
 
@@ -552,15 +607,28 @@ static void PrepareSearch(Position *pos, Thread *threads) {
     for (int i = 0; i < threads->count; ++i) {
         memset(&threads[i], 0, offsetof(Thread, pos));
         memcpy(&threads[i].pos, pos, sizeof(Position));
+
+#ifdef EVAL_NNUE
+        // Only the root state is copied, the thread's own stack holds the rest
+        threads[i].states[0] = *pos->st;
+        threads[i].states[0].previous = NULL;
+        threads[i].pos.st = threads[i].pos.states = threads[i].states;
+#endif
     }
 
-    // Mark TT as used
+    // Mark TT as used and age previous entries
     TT.dirty = true;
+    NewSearchTT();
 }
 
 // Root of search
 void SearchPosition(Position *pos, Thread *threads) {
 
+#ifdef EVAL_NNUE
+    // The network can't be swapped until all threads have left the search
+    Eval::enter_search();
+#endif
+
     InitTimeManagement();
 
     PrepareSearch(pos, threads);
@@ -591,6 +659,10 @@ conclusion:
         for (int i = 1; i < threads->count; ++i)
             pthread_join(threads->pthreads[i], NULL);
 
+#ifdef EVAL_NNUE
+    Eval::leave_search();
+#endif
+
     // Print conclusion
     PrintConclusion(threads);
 }
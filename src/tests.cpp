@@ -16,11 +16,13 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "board.h"
+#include "cpu.h"
 #include "evaluate.h"
 #include "makemove.h"
 #include "move.h"
@@ -30,6 +32,7 @@
 #include "threads.h"
 #include "time.h"
 #include "transposition.h"
+#include "uci.h"
 
 
 #define PERFT_FEN "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"
@@ -57,13 +60,20 @@ void Benchmark(int argc, char **argv) {
     Limits.depth     = argc > 2 ? atoi(argv[2]) : 15;
     int threadCount  = argc > 3 ? atoi(argv[3]) : 1;
     TT.requestedMB   = argc > 4 ? atoi(argv[4]) : DEFAULTHASH;
+    EvalSmallNet     = argc > 5 && !strcmp(argv[5], "small");
 
     Position pos;
     Thread *threads = InitThreads(threadCount);
+#ifdef EVAL_NNUE
+    static StateInfo states[STATE_STACK_SIZE];
+    pos.states = states;
+#endif
     InitTT(threads);
 
 #ifdef EVAL_NNUE
+    Eval::resize_eval_hash(EvalHashMB);
     Eval::load_eval();
+    Eval::reset_eval_stats();
 #endif
 
     int FENCount = sizeof(BenchmarkFENs) / sizeof(char *);
@@ -92,6 +102,9 @@ void Benchmark(int argc, char **argv) {
         totalNodes   += r->nodes;
 
         ClearTT(threads);
+#ifdef EVAL_NNUE
+        Eval::clear_eval_hash();
+#endif
     }
 
     puts("======================================================");
@@ -107,6 +120,31 @@ void Benchmark(int argc, char **argv) {
 
     printf("OVERALL: %7" PRIi64 " ms %13" PRIu64 " nodes %10d nps\n",
            totalElapsed, totalNodes, (int)(1000.0 * totalNodes / totalElapsed));
+
+#ifdef EVAL_NNUE
+    // Separately for the small network, if one was used
+    for (int small = 0; small <= 1; ++small) {
+
+        Eval::EvalStats stats = Eval::eval_stats(small);
+        if (small && !stats.evaluate_calls) continue;
+
+        // How many nodes were evaluated with the network, and how often it had to be run,
+        // rather than the score being found in the TT, the eval hash or the accumulator
+        printf("%s\n", small ? "Small network:" : "Main network:");
+        printf("NNUE:    %10" PRIu64 " evals %10" PRIu64 " computed %10.3f computed/node\n",
+               stats.evaluate_calls, stats.compute_calls, (double)stats.compute_calls / totalNodes);
+        printf("Share:   %9.1f%% of nodes %9d evals/s %8d computed/s\n",
+               100.0 * stats.evaluate_calls / totalNodes,
+               (int)(1000.0 * stats.evaluate_calls / totalElapsed),
+               (int)(1000.0 * stats.compute_calls / totalElapsed));
+        printf("EvalHash: %9" PRIu64 " probes %9" PRIu64 " hits %11.1f%% hit rate\n",
+               stats.hash_probes, stats.hash_hits, 100.0 * stats.hash_hits / MAX(1, stats.hash_probes));
+
+        // How the accumulators of the computed positions were found
+        printf("Accum:   %10" PRIu64 " updates %8" PRIu64 " refreshes %9.2f plies/update\n",
+               stats.update_calls, stats.refresh_calls, (double)stats.update_plies / MAX(1, stats.update_calls));
+    }
+#endif
 }
 
 #ifdef DEV
@@ -148,6 +186,10 @@ void Perft(char *line) {
     Position pos[1];
     Depth depth = 5;
     sscanf(line, "perft %d", &depth);
+#ifdef EVAL_NNUE
+    static StateInfo states[STATE_STACK_SIZE];
+    pos->states = states;
+#endif
 
     char *perftFen = line + 8;
     !*perftFen ? ParseFen(PERFT_FEN, pos)
@@ -191,6 +233,154 @@ void Perft(char *line) {
     fflush(stdout);
 }
 
+/* TT stress test */
+
+#define STRESS_BUCKETS 4
+#define STRESS_KEYS (4 * STRESS_BUCKETS * BUCKET_SIZE)
+
+typedef struct StressResult {
+
+    uint64_t probes;
+    uint64_t hits;
+    uint64_t detected;
+    uint64_t upperHalf;
+    uint64_t undetected;
+
+} StressResult;
+
+static Key StressKeys[STRESS_KEYS];
+static uint64_t StressIterations;
+
+// The data written for a key is derived from the key itself,
+// so any mismatch on reading must come from a torn entry.
+// A quarter of the keys share the lower halves of both data
+// words, so tears between them only show in the upper halves.
+static TTEntry StressEntry(const Key key) {
+
+    const bool shared = !(key & 3);
+
+    TTEntry tte;
+    tte.key      = KeyVerify(key);
+    tte.depth    = 1 + (key >> 16) % 64;
+    tte.genBound = TT.generation | (BOUND_UPPER + (key >> 24) % 3);
+    tte.score    = shared ? 0 : (int16_t)(key >> 32) % 3000;
+    tte.eval     = (int16_t)(key >> 40) % 3000;
+    tte.move     = (shared ? 0 : (key >> 8) & 0xFFFF) | ((key >> 48) & 0x7F) << 16;
+    return tte;
+}
+
+static void *ThreadStressTT(void *voidResult) {
+
+    StressResult *result = (StressResult *)voidResult;
+    uint64_t seed = (uintptr_t)voidResult | 1;
+
+    for (uint64_t i = 0; i < StressIterations; ++i) {
+
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+
+        const Key key = StressKeys[(seed >> 32) % STRESS_KEYS];
+        const TTEntry expected = StressEntry(key);
+
+        bool ttHit;
+        TTEntry tte;
+        TTEntry *slot = ProbeTT(key, &tte, &ttHit);
+
+        // Half the iterations write
+        if (seed & 1) {
+            StoreTTEntry(slot, key, expected.move, expected.score, expected.eval,
+                         expected.depth, expected.genBound & TT_BOUND_MASK);
+            continue;
+        }
+
+        result->probes++;
+        result->hits += ttHit;
+
+        // Verification passed but the data belongs to another key
+        if (ttHit && (   tte.words[1] != expected.words[1]
+                      || tte.words[2] != expected.words[2]))
+            result->undetected++;
+
+        // Look for slots where the key word was written for this key
+        // but the data words were not, which verification rejects
+        const TTEntry *first = GetBucket(key)->entry;
+        for (int j = 0; j < BUCKET_SIZE; ++j) {
+            const uint32_t w0 = __atomic_load_n(&first[j].words[0], __ATOMIC_RELAXED);
+            const uint32_t w1 = __atomic_load_n(&first[j].words[1], __ATOMIC_RELAXED);
+            const uint32_t w2 = __atomic_load_n(&first[j].words[2], __ATOMIC_RELAXED);
+            if (   (uint16_t)(w0 ^ DataCheck(expected.words[1], expected.words[2])) == expected.key
+                && (w1 != expected.words[1] || w2 != expected.words[2])) {
+                result->detected++;
+
+                // Torn only in the upper halves of the data words, which
+                // a check over the lower halves alone would let through
+                if ((uint16_t)(w1 ^ w2) == (uint16_t)(expected.words[1] ^ expected.words[2]))
+                    result->upperHalf++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Hammers a few TT buckets from all threads and counts torn entries
+void StressTT(Thread *threads, char *line) {
+
+    int millions = 10;
+    sscanf(line, "ttstress %d", &millions);
+
+    StressIterations = millions * 1000000ULL;
+
+    InitTT(threads);
+    TT.dirty = true;
+    ClearTT(threads);
+
+    // Pick keys that all map to a few buckets
+    const uint64_t span = UINT64_MAX / TT.count;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < STRESS_KEYS; ++i) {
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        StressKeys[i] = (i % STRESS_BUCKETS) * span + seed % span;
+    }
+
+    StressResult results[threads->count];
+    memset(results, 0, sizeof(results));
+
+    const TimePoint start = Now();
+
+    for (int i = 0; i < threads->count; ++i)
+        pthread_create(&threads->pthreads[i], NULL, &ThreadStressTT, &results[i]);
+    for (int i = 0; i < threads->count; ++i)
+        pthread_join(threads->pthreads[i], NULL);
+
+    threads->pthreads[0] = 0;
+
+    StressResult total = {};
+    for (int i = 0; i < threads->count; ++i)
+        total.probes     += results[i].probes,
+        total.hits       += results[i].hits,
+        total.detected   += results[i].detected,
+        total.upperHalf  += results[i].upperHalf,
+        total.undetected += results[i].undetected;
+
+    const double perMillion = 1000000.0 / MAX(total.probes, 1);
+
+    printf("\nTT stress complete:"
+           "\nThreads   : %d"
+           "\nTime      : %" PRId64 "ms"
+           "\nProbes    : %" PRIu64
+           "\nHits      : %" PRIu64
+           "\nDetected  : %.2f per million probes"
+           "\nUpper half: %.2f per million probes"
+           "\nUndetected: %.2f per million probes\n",
+           threads->count, TimeSince(start) + 1, total.probes, total.hits,
+           total.detected * perMillion, total.upperHalf * perMillion,
+           total.undetected * perMillion);
+    fflush(stdout);
+
+    TT.dirty = true;
+    ClearTT(threads);
+}
+
 extern int PieceSqValue[7][64];
 
 void PrintEval(Position *pos) {
@@ -254,4 +444,485 @@ void MirrorEvalTest(Position *pos) {
     fflush(stdout);
     fclose(file);
 }
+
+#ifdef EVAL_NNUE
+// Positions evaluated together in the batch test, each with a stack of its own
+#define BATCH_POSITIONS 64
+static Position BatchPositions[BATCH_POSITIONS];
+static StateInfo BatchStates[BATCH_POSITIONS][2];
+
+// Sets up the bench positions, filling the batch up with positions
+// one move from them so some accumulators are updated rather than refreshed
+static void SetupBatch(const Position *batch[]) {
+
+    int FENCount = sizeof(BenchmarkFENs) / sizeof(char *);
+
+    for (int i = 0; i < BATCH_POSITIONS; ++i) {
+
+        Position *pos = &BatchPositions[i];
+        pos->states = BatchStates[i];
+        ParseFen(BenchmarkFENs[i % FENCount], pos);
+
+        if (i >= FENCount) {
+            MoveList list[1];
+            GenAllMoves(pos, list);
+            for (int j = 0; j < list->count; ++j)
+                if (MakeMove(pos, list->moves[j].move))
+                    break;
+        }
+
+        batch[i] = pos;
+    }
+}
+
+// Checks evaluating the batch together gives every position the score it gets alone
+static bool VerifyBatch(const Position *batch[]) {
+
+    Value alone[BATCH_POSITIONS], together[BATCH_POSITIONS];
+
+    Eval::clear_eval_hash();
+    for (int i = 0; i < BATCH_POSITIONS; ++i) {
+        batch[i]->st->accumulators[Eval::NNUE::kMainNetwork].computed_score = false;
+        alone[i] = Eval::evaluate(batch[i]);
+    }
+
+    Eval::evaluate_batch(batch, BATCH_POSITIONS, together);
+
+    return !memcmp(alone, together, sizeof(alone));
+}
+
+// Longest line the catch-up is checked over. Past about half the piece
+// count in plies, catching up costs more than a refresh, and the walk
+// stops at kMaxUpdatePlies (32) regardless, so this goes past both
+#define CHAIN_PLIES 40
+
+// Picks a quiet move that is not a king move or castling, so the accumulators
+// are updated along the line rather than refreshed, or any legal move otherwise
+static Move ChainMove(Position *pos, int ply) {
+
+    MoveList list[1];
+    GenAllMoves(pos, list);
+
+    Move quiet[MAXPOSITIONMOVES], legal[MAXPOSITIONMOVES];
+    int quiets = 0, count = 0;
+    for (int i = 0; i < list->count; ++i) {
+        Move move = list->moves[i].move;
+        if (!MakeMove(pos, move)) continue;
+        TakeMove(pos);
+        legal[count++] = move;
+        if (   moveIsQuiet(move) && !moveIsCastle(move)
+            && PieceTypeOf(pieceOn(fromSq(move))) != KING)
+            quiet[quiets++] = move;
+    }
+
+    return quiets ? quiet[(ply * 7 + 3) % quiets]
+         : count  ? legal[(ply * 7 + 3) % count]
+                  : NOMOVE;
+}
+
+// Plays lines of every length up to CHAIN_PLIES from the position, the third
+// ply a null move, and checks the accumulators caught up at the end of each
+// from the root, the only position evaluated on the way. Returns the mismatches
+static int VerifyChains(Position *pos, const char *fen, int *positions) {
+
+    int failures = 0;
+
+    for (int length = 1; length <= CHAIN_PLIES; ++length) {
+
+        // Computes the root accumulators, the root itself is checked by the caller
+        ParseFen(fen, pos);
+        Eval::verify_simd(pos);
+
+        int ply = 0;
+        for (; ply < length; ++ply) {
+
+            if (ply == 2 && !KingAttacked(pos, sideToMove)) {
+                MakeNullMove(pos);
+                continue;
+            }
+
+            Move move = ChainMove(pos, ply);
+            if (!move) break;
+            MakeMove(pos, move);
+        }
+
+        (*positions)++;
+        if (!Eval::verify_simd(pos))
+            failures++, printf("NNUETest Fail: %s line of %d plies\n", fen, ply);
+    }
+
+    return failures;
+}
+#endif
+
+// Checks the SIMD NNUE code gives exactly the same accumulators, features and output
+// as the scalar code, in the bench positions and all positions one move from them
+void NNUETest(Position *pos) {
+
+#ifdef EVAL_NNUE
+    int FENCount = sizeof(BenchmarkFENs) / sizeof(char *);
+    const int selected = Simd;
+
+    // The first layer skips zero input chunks only for networks sparse enough to gain from it
+    bool sparse;
+    double density = Eval::input_density(&sparse);
+    printf("NNUETest input density %.1f%%, %s first layer\n", 100 * density, sparse ? "sparse" : "dense");
+
+    // Check every kernel level this CPU can run
+    for (Simd = SIMD_NONE; Simd <= CPU.simd; ++Simd) {
+
+        int positions = 0, failures = 0, updates = 0, evals = 0;
+        uint64_t updateNs = 0, evalNs = 0;
+
+        for (int i = 0; i < FENCount; ++i) {
+
+            ParseFen(BenchmarkFENs[i], pos);
+
+            // Full refresh
+            positions++;
+            if (!Eval::verify_simd(pos))
+                failures++, printf("NNUETest Fail: %s\n", BenchmarkFENs[i]);
+
+            MoveList list[1];
+            GenAllMoves(pos, list);
+
+            // Incremental update from the now computed parent accumulator
+            for (int j = 0; j < list->count; ++j) {
+
+                Move move = list->moves[j].move;
+                if (!MakeMove(pos, move)) continue;
+
+                // Catch-up over two plies for every reply, as the child is not evaluated yet
+                MoveList replies[1];
+                GenAllMoves(pos, replies);
+                for (int k = 0; k < replies->count; ++k) {
+
+                    Move reply = replies->moves[k].move;
+                    if (!MakeMove(pos, reply)) continue;
+
+                    positions++;
+                    if (!Eval::verify_simd(pos))
+                        failures++, printf("NNUETest Fail: %s moves %s", BenchmarkFENs[i], MoveToStr(move)),
+                                    printf(" %s\n", MoveToStr(reply));
+
+                    TakeMove(pos);
+                }
+
+                positions++;
+                if (!Eval::verify_simd(pos))
+                    failures++, printf("NNUETest Fail: %s moves %s\n", BenchmarkFENs[i], MoveToStr(move));
+
+                // Time the update from the parent
+                updateNs += Eval::time_update(pos, 100);
+                updates += 100;
+
+                // Time the network on the computed accumulator
+                evalNs += Eval::time_evaluate(pos, 100);
+                evals += 100;
+
+                TakeMove(pos);
+            }
+
+            // Catch-up over longer lines, until it gives up for a refresh
+            failures += VerifyChains(pos, BenchmarkFENs[i], &positions);
+        }
+
+        printf("NNUETest %s %s: %d positions, %d mismatches, %.1f ns/update, %.1f ns/eval\n",
+               SimdName(Simd), failures ? "Failed" : "Successful", positions, failures,
+               (double)updateNs / updates, (double)evalNs / evals);
+
+        const Position *batch[BATCH_POSITIONS];
+        SetupBatch(batch);
+        printf("NNUETest %s batch %s\n", SimdName(Simd), VerifyBatch(batch) ? "Successful" : "Failed");
+    }
+
+    Simd = selected;
+
+    // Network throughput by batch size, on positions with computed accumulators
+    const Position *batch[BATCH_POSITIONS];
+    Value values[BATCH_POSITIONS];
+    SetupBatch(batch);
+    Eval::evaluate_batch(batch, BATCH_POSITIONS, values);
+    printf("NNUETest batch throughput %s:", SimdName(Simd));
+    for (int size = 1; size <= BATCH_POSITIONS; size *= 2) {
+        const int repetitions = 2000;
+        uint64_t ns = Eval::time_evaluate_batch(batch, BATCH_POSITIONS, size, repetitions);
+        printf(" %d: %.1f ns/eval", size, (double)ns / (BATCH_POSITIONS * repetitions));
+    }
+    printf("\n");
+
+    // The weights are kept permuted for the kernels, writing them
+    // back out must reproduce the network file byte for byte
+    printf("NNUETest parameters %s\n", Eval::verify_parameters() ? "Successful" : "Failed");
+#else
+    (void)pos;
+    printf("NNUETest: not an NNUE build\n");
+#endif
+    fflush(stdout);
+}
+
+// Quantizes the loaded network's feature transformer weights to int8, writes
+// the result to the given file and reports how far evals drift over the bench
+void QuantizeNet(char *line) {
+
+#ifdef EVAL_NNUE
+    char fileName[INPUT_SIZE];
+    if (sscanf(line, "quantize %s", fileName) != 1)
+        snprintf(fileName, sizeof(fileName), "%s/nn-int8.bin", EvalDir);
+
+    int FENCount = sizeof(BenchmarkFENs) / sizeof(char *);
+    const Position *batch[BATCH_POSITIONS];
+    Value before[BATCH_POSITIONS], after[BATCH_POSITIONS];
+    SetupBatch(batch);
+
+    if (!Eval::quantize_eval(fileName, batch, FENCount, before, after)) {
+        printf("QuantizeNet: failed, the loaded network has no int8 version or %s can't be written\n", fileName);
+        fflush(stdout);
+        return;
+    }
+
+    int changed = 0, maxDrift = 0, totalDrift = 0;
+    for (int i = 0; i < FENCount; ++i) {
+        int drift = abs(after[i] - before[i]);
+        changed += drift != 0;
+        maxDrift = MAX(maxDrift, drift);
+        totalDrift += drift;
+    }
+
+    printf("QuantizeNet: wrote %s\n", fileName);
+    printf("QuantizeNet: eval drift over %d bench positions: mean %.2f, max %d, %d changed\n",
+           FENCount, (double)totalDrift / FENCount, maxDrift, changed);
+#else
+    (void)line;
+    printf("QuantizeNet: not an NNUE build\n");
+#endif
+    fflush(stdout);
+}
+
+// Writes the loaded network in the compressed format to the given file and
+// compares its size and load time to the raw format. The decoding threads
+// default to one per core, the single-threaded decode is always shown too
+void CompressNet(char *line) {
+
+#ifdef EVAL_NNUE
+    char fileName[INPUT_SIZE], rawName[INPUT_SIZE + 8];
+    int threads = 0;
+    if (sscanf(line, "compressnet %s %d", fileName, &threads) < 1)
+        snprintf(fileName, sizeof(fileName), "%s/nn-compressed.bin", EvalDir);
+    snprintf(rawName, sizeof(rawName), "%s.raw", fileName);
+
+    if (!Eval::compress_eval(fileName, rawName)) {
+        printf("CompressNet: failed, %s can't be written\n", fileName);
+        fflush(stdout);
+        return;
+    }
+
+    const struct { const char *name; const char *file; int threads; } formats[] = {
+        { "raw",        rawName,  1       },
+        { "compressed", fileName, 1       },
+        { "compressed", fileName, threads },
+    };
+
+    printf("CompressNet: %-10s %7s %9s %9s %9s %9s %9s\n",
+           "format", "threads", "size", "read", "decode", "parse", "load");
+
+    Eval::LoadTimes times[3] = {};
+    for (int i = 0; i < 3; ++i) {
+        Eval::LoadTimes *t = &times[i];
+        if (!Eval::time_load_eval(formats[i].file, formats[i].threads, 5, t)) {
+            printf("CompressNet: %-10s failed to load back the same network\n", formats[i].name);
+            continue;
+        }
+
+        char threadsStr[16], decodeStr[16];
+        formats[i].threads ? snprintf(threadsStr, sizeof(threadsStr), "%d", formats[i].threads)
+                           : snprintf(threadsStr, sizeof(threadsStr), "all");
+        i ? snprintf(decodeStr, sizeof(decodeStr), "%.2fms", t->decode_ns / 1e6)
+          : snprintf(decodeStr, sizeof(decodeStr), "-");
+
+        printf("CompressNet: %-10s %7s %7.2fMB %7.2fms %9s %7.2fms %7.2fms\n",
+               formats[i].name, threadsStr, t->bytes / (1024.0 * 1024.0),
+               t->read_ns / 1e6, decodeStr, t->parse_ns / 1e6, t->load_ns / 1e6);
+    }
+    remove(rawName);
+
+    printf("CompressNet: wrote %s, %.1f%% of the raw size\n",
+           fileName, 100.0 * times[1].bytes / MAX(times[0].bytes, 1));
+#else
+    (void)line;
+    printf("CompressNet: not an NNUE build\n");
+#endif
+    fflush(stdout);
+}
+
+#ifdef EVAL_NNUE
+// Operations timed by nnuebench
+enum {
+    NB_REFRESH, NB_UPDATE_QUIET, NB_UPDATE_CAPTURE, NB_UPDATE_CASTLE, NB_UPDATE_PROMOTION, NB_UPDATE_KING,
+    NB_TRANSFORM, NB_PROPAGATE, NB_EVAL_NOHASH, NB_EVAL_HASH_MISS, NB_EVAL_HASH_HIT, NB_OPS
+};
+
+static const char *NBOpNames[NB_OPS] = {
+    "refresh", "update_quiet", "update_capture", "update_castle", "update_promotion", "update_king",
+    "transform", "propagate", "evaluate_nohash", "evaluate_hash_miss", "evaluate_hash_hit"
+};
+
+// Length of the line replayed from each bench position
+#define NB_PLIES 16
+
+typedef struct NBSamples {
+
+    int64_t *ns;
+    int count;
+    int capacity;
+
+} NBSamples;
+
+static void AddSample(NBSamples *samples, int64_t ns) {
+
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? 2 * samples->capacity : 1024;
+        samples->ns = (int64_t *)realloc(samples->ns, samples->capacity * sizeof(int64_t));
+    }
+
+    samples->ns[samples->count++] = MAX(ns, 0);
+}
+
+static int CompareSamples(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the given percentile of sorted samples
+static int64_t Percentile(const NBSamples *samples, int percent) {
+    return samples->ns[(samples->count - 1) * percent / 100];
+}
+
+// Which kind of accumulator update a move needs, checked before it is made
+static int UpdateKind(const Position *pos, Move move) {
+    return moveIsCastle(move)                          ? NB_UPDATE_CASTLE
+         : promotion(move)                             ? NB_UPDATE_PROMOTION
+         : PieceTypeOf(pieceOn(fromSq(move))) == KING  ? NB_UPDATE_KING
+         : moveIsCapture(move) || moveIsEnPas(move)    ? NB_UPDATE_CAPTURE
+                                                       : NB_UPDATE_QUIET;
+}
+
+// Picks the line's next move, deterministically among the legal ones
+static Move LineMove(Position *pos, int ply) {
+
+    MoveList list[1];
+    GenAllMoves(pos, list);
+
+    Move legal[MAXPOSITIONMOVES];
+    int count = 0;
+    for (int i = 0; i < list->count; ++i)
+        if (MakeMove(pos, list->moves[i].move))
+            legal[count++] = list->moves[i].move, TakeMove(pos);
+
+    return count ? legal[(ply * 7 + 3) % count] : NOMOVE;
+}
+#endif
+
+// Times the NNUE operations one at a time along a fixed line from each bench
+// position, at every kernel level this CPU can run, and reports latency
+// percentiles per operation. 'nnuebench csv' prints the results as CSV
+void NNUEBench(Position *pos, char *line) {
+
+#ifdef EVAL_NNUE
+    const bool csv = strstr(line, "csv") != NULL;
+    int FENCount = sizeof(BenchmarkFENs) / sizeof(char *);
+    const int selected = Simd;
+
+    if (csv)
+        printf("simd,op,samples,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+
+    for (Simd = SIMD_NONE; Simd <= CPU.simd; ++Simd) {
+
+        NBSamples samples[NB_OPS] = {};
+
+        // Every sample is a single operation, so subtract what reading the clock costs
+        ParseFen(BenchmarkFENs[0], pos);
+        Eval::time_refresh(pos, 1);
+        int64_t overhead = INT64_MAX;
+        for (int i = 0; i < 256; ++i)
+            overhead = MIN(overhead, (int64_t)Eval::time_transform(pos, 0));
+
+        // Start cold so the first evaluation of each position misses
+        Eval::clear_eval_hash();
+
+        for (int i = 0; i < FENCount; ++i) {
+
+            ParseFen(BenchmarkFENs[i], pos);
+
+            for (int ply = 0; ply <= NB_PLIES; ++ply) {
+
+                AddSample(&samples[NB_REFRESH],   Eval::time_refresh(pos, 1) - overhead);
+                AddSample(&samples[NB_TRANSFORM], Eval::time_transform(pos, 1) - overhead);
+                AddSample(&samples[NB_PROPAGATE], Eval::time_propagate(pos, 1) - overhead);
+
+                // Update every child from this now computed accumulator
+                MoveList list[1];
+                GenAllMoves(pos, list);
+                for (int j = 0; j < list->count; ++j) {
+
+                    Move move = list->moves[j].move;
+                    int kind = UpdateKind(pos, move);
+                    if (!MakeMove(pos, move)) continue;
+
+                    AddSample(&samples[kind], Eval::time_update(pos, 1) - overhead);
+
+                    TakeMove(pos);
+                }
+
+                Move move = ply < NB_PLIES ? LineMove(pos, ply) : NOMOVE;
+                if (!move) break;
+
+                // The whole evaluation of the next line position, including the update.
+                // Alternate which goes first, as the first one finds the caches colder
+                MakeMove(pos, move);
+                if (ply & 1)
+                    AddSample(&samples[NB_EVAL_NOHASH], Eval::time_evaluate_full(pos, 1, false) - overhead);
+                AddSample(&samples[NB_EVAL_HASH_MISS], Eval::time_evaluate_full(pos, 1, true) - overhead);
+                AddSample(&samples[NB_EVAL_HASH_HIT],  Eval::time_evaluate_full(pos, 1, true) - overhead);
+                if (!(ply & 1))
+                    AddSample(&samples[NB_EVAL_NOHASH], Eval::time_evaluate_full(pos, 1, false) - overhead);
+            }
+        }
+
+        if (!csv)
+            printf("NNUEBench %s (%" PRId64 " ns clock overhead subtracted)\n"
+                   "%-20s %8s %10s %8s %8s %8s %8s\n",
+                   SimdName(Simd), overhead, "op", "samples", "mean ns", "p50", "p90", "p99", "max");
+
+        for (int op = 0; op < NB_OPS; ++op) {
+
+            NBSamples *s = &samples[op];
+            if (!s->count) continue;
+
+            int64_t total = 0;
+            for (int i = 0; i < s->count; ++i)
+                total += s->ns[i];
+            qsort(s->ns, s->count, sizeof(int64_t), CompareSamples);
+
+            const double mean = (double)total / s->count;
+            if (csv)
+                printf("%s,%s,%d,%.1f,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 "\n",
+                       SimdName(Simd), NBOpNames[op], s->count, mean,
+                       Percentile(s, 50), Percentile(s, 90), Percentile(s, 99), s->ns[s->count - 1]);
+            else
+                printf("%-20s %8d %10.1f %8" PRId64 " %8" PRId64 " %8" PRId64 " %8" PRId64 "\n",
+                       NBOpNames[op], s->count, mean,
+                       Percentile(s, 50), Percentile(s, 90), Percentile(s, 99), s->ns[s->count - 1]);
+
+            free(s->ns);
+        }
+    }
+
+    Simd = selected;
+#else
+    (void)pos, (void)line;
+    printf("NNUEBench: not an NNUE build\n");
+#endif
+    fflush(stdout);
+}
 #endif
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "threads.h"
 #include "types.h"
 
 
@@ -27,4 +28,9 @@ void Benchmark(int argc, char **argv);
 void Perft(char *line);
 void PrintEval(Position *pos);
 void MirrorEvalTest(Position *pos);
+void NNUETest(Position *pos);
+void QuantizeNet(char *line);
+void CompressNet(char *line);
+void NNUEBench(Position *pos, char *line);
+void StressTT(Thread *threads, char *line);
 #endif
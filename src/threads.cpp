@@ -16,9 +16,12 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "evaluate.h"
+#include "numa.h"
 #include "threads.h"
 #include "types.h"
 
@@ -26,12 +29,16 @@
 // Allocates memory for thread structs
 Thread *InitThreads(int count) {
 
-    Thread *threads = (Thread *)calloc(count, sizeof(Thread));
+    // Threads hold accumulators that need to be aligned for SIMD
+    size_t size = (count * sizeof(Thread) + alignof(Thread) - 1) / alignof(Thread) * alignof(Thread);
+    Thread *threads = (Thread *)aligned_alloc(alignof(Thread), size);
+    memset((void *)threads, 0, size);
 
-    // Each thread knows its own index and total thread count
+    // Each thread knows its own index, total thread count and NUMA node
     for (int i = 0; i < count; ++i)
         threads[i].index = i,
-        threads[i].count = count;
+        threads[i].count = count,
+        threads[i].node  = NumaNodeOf(i);
 
     // Used for letting the main thread sleep
     pthread_mutex_init(&threads->mutex, NULL);
@@ -43,6 +50,33 @@ Thread *InitThreads(int count) {
     return threads;
 }
 
+// Pins a thread to its NUMA node, and lets it use that node's copy of the network
+void BindThread(const Thread *thread) {
+
+    if (!NumaEnabled) return;
+
+    BindToNode(thread->node);
+#ifdef EVAL_NNUE
+    Eval::bind_replica(thread->node);
+#endif
+}
+
+// Prints how many threads are bound to each NUMA node
+void PrintNumaThreads(const Thread *threads) {
+
+    if (!NumaEnabled) return;
+
+    int count[MAX_NUMA_NODES] = { 0 };
+    for (int i = 0; i < threads->count; ++i)
+        count[threads[i].node]++;
+
+    printf("info string NUMA");
+    for (int node = 0; node < NumaNodes(); ++node)
+        printf(" node %d: %d threads%s", node, count[node], node < NumaNodes() - 1 ? "," : "");
+    printf("\n");
+    fflush(stdout);
+}
+
 // Tallies the nodes searched by all threads
 uint64_t TotalNodes(const Thread *threads) {
 
@@ -42,9 +42,13 @@ typedef struct Thread {
 
     // Anything below here is not zeroed out between searches
     Position pos;
+#ifdef EVAL_NNUE
+    StateInfo states[STATE_STACK_SIZE];
+#endif
 
     int index;
     int count;
+    int node;
 
     pthread_mutex_t mutex;
     pthread_cond_t sleepCondition;
@@ -54,6 +58,8 @@ typedef struct Thread {
 
 
 Thread *InitThreads(int threadCount);
+void BindThread(const Thread *thread);
+void PrintNumaThreads(const Thread *threads);
 uint64_t TotalNodes(const Thread *threads);
 uint64_t TotalTBHits(const Thread *threads);
 void Wait(Thread *thread, volatile bool *condition);
@@ -21,9 +21,14 @@
 #include <string.h>
 
 #if defined(__linux__)
+    #include <fcntl.h>
     #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
 #endif
 
+#include "evaluate.h"
+#include "largepage.h"
 #include "makemove.h"
 #include "move.h"
 #include "movegen.h"
@@ -33,64 +38,124 @@
 TranspositionTable TT = {
     .mem = NULL,
     .table = NULL,
+    .pageKind = PAGES_NONE,
     .count = 0,
     .currentMB = 0,
     .requestedMB = DEFAULTHASH,
+    .generation = 0,
     .dirty = false,
 };
 
 
-// Probe the transposition table
-TTEntry* ProbeTT(const Key posKey, bool *ttHit) {
+// Entries that are deep and recent are the most valuable to keep
+INLINE int EntryValue(const TTEntry *tte) {
+    return tte->depth - Age(tte);
+}
+
+// Probe the transposition table, returning the slot for the position
+// if found, otherwise the slot best suited for replacement. The decoded
+// entry is copied to tte, as the slot may be overwritten by other threads.
+TTEntry* ProbeTT(const Key posKey, TTEntry *tte, bool *ttHit) {
+
+    TTEntry *first = GetBucket(posKey)->entry;
+    const uint16_t key16 = KeyVerify(posKey);
+
+    TTEntry entries[BUCKET_SIZE];
+
+    for (int i = 0; i < BUCKET_SIZE; ++i) {
 
-    TTEntry* tte = GetEntry(posKey);
+        entries[i] = LoadEntry(&first[i]);
+
+        if (entries[i].key == key16 && Bound(&entries[i]) != BOUND_NONE) {
+
+            // Refresh the generation so the entry survives longer
+            if (Age(&entries[i])) {
+                entries[i].genBound = TT.generation | Bound(&entries[i]);
+                SaveEntry(&first[i], &entries[i]);
+            }
+
+            *tte = entries[i];
+            return *ttHit = true, &first[i];
+        }
+    }
 
-    *ttHit = tte->posKey == posKey;
+    // Replace the least valuable entry in the bucket
+    int replace = 0;
+    for (int i = 1; i < BUCKET_SIZE; ++i)
+        if (EntryValue(&entries[i]) < EntryValue(&entries[replace]))
+            replace = i;
 
-    return tte;
+    *tte = entries[replace];
+    return *ttHit = false, &first[replace];
 }
 
 // Store an entry in the transposition table
-void StoreTTEntry(TTEntry *tte, const Key posKey,
-                                const Move move,
-                                const int score,
-                                const Depth depth,
-                                const int bound) {
+void StoreTTEntry(TTEntry *slot, const Key posKey,
+                                 const Move move,
+                                 const int score,
+                                 const int eval,
+                                 const Depth depth,
+                                 const int bound) {
 
     assert(ValidBound(bound));
-    assert(ValidDepth(depth));
+    assert(ValidStoreDepth(depth));
     assert(ValidScore(score));
 
+    const TTEntry old = LoadEntry(slot);
+    const uint16_t key16 = KeyVerify(posKey);
+
     // Store new data unless it would overwrite data about the same
-    // position searched to a higher depth.
-    if (posKey != tte->posKey || depth >= tte->depth || bound == BOUND_EXACT)
-        tte->posKey = posKey,
-        tte->move   = move,
-        tte->score  = score,
-        tte->depth  = depth,
-        tte->bound  = bound;
+    // position searched to a higher depth in the current search.
+    if (   key16 == old.key
+        && depth < old.depth
+        && bound != BOUND_EXACT
+        && !Age(&old))
+        return;
+
+    TTEntry tte;
+    tte.key      = key16;
+    tte.depth    = depth;
+    tte.genBound = TT.generation | bound;
+    tte.score    = score;
+    tte.eval     = eval;
+    tte.move     = move || key16 != old.key ? move : old.move; // Keep the old move if there's no new one
+
+    SaveEntry(slot, &tte);
 }
 
-// Estimates the load factor of the transposition table (1 = 0.1%)
+// Estimates the load factor of the transposition table (1 = 0.1%),
+// only counting entries written to during the current search
 int HashFull() {
 
     int used = 0;
-    const int samples = 1000;
+    const int samples = 1000 / BUCKET_SIZE;
 
     for (int i = 0; i < samples; ++i)
-        if (TT.table[i].move != NOMOVE)
-            used++;
+        for (int j = 0; j < BUCKET_SIZE; ++j) {
+            const TTEntry tte = LoadEntry(&TT.table[i].entry[j]);
+            if (Bound(&tte) != BOUND_NONE && !Age(&tte))
+                used++;
+        }
 
-    return used / (samples / 1000);
+    return used;
+}
+
+// Ages all entries by advancing to the next generation
+void NewSearchTT() {
+    TT.generation += TT_GEN_STEP;
 }
 
 static void *ThreadClearTT(void *voidThread) {
 
     Thread *thread = (Thread *)voidThread;
 
+    // Clearing first touches the memory, placing each
+    // slice on the NUMA node of the thread clearing it
+    BindThread(thread);
+
     // Logic for dividing the work taken from CFish
     size_t twoMB  = 2 * 1024 * 1024;
-    size_t total  = TT.count * sizeof(TTEntry);
+    size_t total  = TT.count * sizeof(TTBucket);
     size_t slice  = (total + thread->count - 1) / thread->count;
     size_t blocks = (slice + twoMB - 1) / twoMB;
     size_t begin  = thread->index * blocks * twoMB;
@@ -98,7 +163,7 @@ static void *ThreadClearTT(void *voidThread) {
     begin = MIN(begin, total);
     end   = MIN(end, total);
 
-    memset(TT.table + begin / sizeof(TTEntry), 0, end - begin);
+    memset((char *)TT.table + begin, 0, end - begin);
 
     return NULL;
 }
@@ -118,9 +183,21 @@ void ClearTT(Thread *threads) {
 
     threads->pthreads[0] = 0;
 
+    TT.generation = 0;
     TT.dirty = false;
 }
 
+// Frees the transposition table, it is allocated again on the next InitTT
+void FreeTT() {
+
+    LargePageFree(TT.mem, TT.currentMB * 1024 * 1024, TT.pageKind);
+
+    TT.mem = NULL;
+    TT.table = NULL;
+    TT.count = 0;
+    TT.currentMB = 0;
+}
+
 // Allocates memory for the transposition table
 void InitTT(Thread *threads) {
 
@@ -128,25 +205,17 @@ void InitTT(Thread *threads) {
     if (TT.currentMB == TT.requestedMB)
         return;
 
+    // Free memory if already allocated
+    FreeTT();
+
     size_t MB = TT.requestedMB;
 
     size_t size = MB * 1024 * 1024;
-    TT.count = size / sizeof(TTEntry);
-
-    // Free memory if already allocated
-    if (TT.mem)
-        free(TT.mem);
+    TT.count = size / sizeof(TTBucket);
 
-#if defined(__linux__)
-    // Align on 2MB boundaries and request Huge Pages
-    TT.mem = aligned_alloc(2 * 1024 * 1024, size);
-    TT.table = (TTEntry *)TT.mem;
-    madvise(TT.table, size, MADV_HUGEPAGE);
-#else
-    // Align on cache line
-    TT.mem = malloc(size + 64 - 1);
-    TT.table = (TTEntry *)(((uintptr_t)TT.mem + 64 - 1) & ~(64 - 1));
-#endif
+    // Align on 2MB boundaries and request huge pages
+    TT.mem = LargePageAlloc(size, &TT.pageKind);
+    TT.table = (TTBucket *)TT.mem;
 
     // Allocation failed
     if (!TT.mem) {
@@ -160,6 +229,131 @@ void InitTT(Thread *threads) {
     TT.dirty = true;
     ClearTT(threads);
 
-    std::cout << "HashTable init complete with " << TT.count << " entries, using " << MB << "MB.\n";
-    fflush(stdout);
+    std::cout << "HashTable init complete with " << TT.count * BUCKET_SIZE << " entries, using " << MB << "MB.\n";
+    ReportLargePages("Hash", TT.mem, size, TT.pageKind);
+}
+
+// Removes the static evals from all entries, leaving the rest intact
+static void StripEvals() {
+
+    for (size_t i = 0; i < TT.count; ++i)
+        for (int j = 0; j < BUCKET_SIZE; ++j) {
+
+            TTEntry tte = LoadEntry(&TT.table[i].entry[j]);
+            if (Bound(&tte) == BOUND_NONE) continue;
+
+            tte.eval = NOSCORE;
+            SaveEntry(&TT.table[i].entry[j], &tte);
+        }
+}
+
+// Writes the transposition table to a file
+bool SaveTT(const char *path) {
+
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+
+    TTFileHeader header = {};
+    memcpy(header.magic, TT_FILE_MAGIC, sizeof(header.magic));
+    header.version    = TT_FILE_VERSION;
+    header.bucketSize = sizeof(TTBucket);
+    header.entries    = BUCKET_SIZE;
+    header.generation = TT.generation;
+    header.MB         = TT.currentMB;
+    header.count      = TT.count;
+    header.network    = Eval::network_id();
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Stream the table out in the same 2MB blocks it was allocated in
+    const size_t twoMB = 2 * 1024 * 1024;
+    const size_t total = TT.count * sizeof(TTBucket);
+    for (size_t done = 0; success && done < total; done += twoMB) {
+        size_t block = MIN(twoMB, total - done);
+        success = fwrite((char *)TT.table + done, 1, block, file) == block;
+    }
+
+    return fclose(file) == 0 && success;
+}
+
+// Reads a transposition table saved by SaveTT, resizing the table to match
+bool LoadTT(const char *path, Thread *threads) {
+
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(TTFileHeader))
+        return close(fd), false;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    TTFileHeader header;
+    memcpy(&header, map, sizeof(header));
+    const size_t fileSize = st.st_size;
+#else
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+
+    TTFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+        return fclose(file), false;
+
+    fseek(file, 0, SEEK_END);
+    const size_t fileSize = ftell(file);
+#endif
+
+    // Only accept tables with the same entry format and a consistent size
+    bool valid =  !memcmp(header.magic, TT_FILE_MAGIC, sizeof(header.magic))
+               && header.version    == TT_FILE_VERSION
+               && header.bucketSize == sizeof(TTBucket)
+               && header.entries    == BUCKET_SIZE
+               && header.MB >= MINHASH && header.MB <= MAXHASH
+               && header.count == header.MB * 1024 * 1024 / sizeof(TTBucket)
+               && fileSize == sizeof(header) + header.count * sizeof(TTBucket);
+
+    if (valid) {
+
+        TT.requestedMB = header.MB;
+        InitTT(threads);
+
+#if defined(__linux__)
+        memcpy(TT.table, (char *)map + sizeof(header), TT.count * sizeof(TTBucket));
+#else
+        fseek(file, sizeof(header), SEEK_SET);
+        valid = fread(TT.table, sizeof(TTBucket), TT.count, file) == TT.count;
+
+        // Don't leave a partly read table behind
+        if (!valid) {
+            TT.dirty = true;
+            ClearTT(threads);
+        }
+#endif
+    }
+
+    if (valid) {
+
+        // Static evals from another network are wrong for this one,
+        // keep the search results but have the evals recomputed
+        if (header.network != Eval::network_id()) {
+            printf("info string Hash was saved with another network, dropping its static evals\n");
+            StripEvals();
+        }
+
+        TT.generation = header.generation;
+        TT.dirty = true;
+    }
+
+#if defined(__linux__)
+    munmap(map, st.st_size);
+#else
+    fclose(file);
+#endif
+
+    return valid;
 }
@@ -24,36 +24,85 @@
 
 // 2MB hash is a reasonable expectation.
 #define MINHASH 2
-// 65536MB = 2^32 * 16B / (1024 * 1024)
-// is the limit current indexing is able
-// to use given the 16B size of entries
-#define MAXHASH 65536
+// Indexing is done with a 64bit multiply-high,
+// 32TB is more than any machine will offer
+#define MAXHASH 33554432
 #define DEFAULTHASH 32
 
+#define BUCKET_SIZE 5
+
+#define TT_BOUND_MASK 0x3
+#define TT_GEN_STEP   0x4
+#define TT_GEN_MASK   0xFC
+#define TT_GEN_CYCLE  (0xFF + TT_GEN_STEP)
+
+#define TT_FILE_MAGIC   "WeissTT"
+#define TT_FILE_VERSION 3
+
 #define ValidBound(bound) (bound >= BOUND_UPPER && bound <= BOUND_EXACT)
 #define ValidScore(score) (score >= -MATE && score <= MATE)
 #define ValidDepth(depth) (depth >= 1 && depth < MAXDEPTH)
 
+// Quiescence stores entries at depth 0
+#define ValidStoreDepth(depth) (depth >= 0 && depth < MAXDEPTH)
+
 
 enum { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT };
 
+// Entries are read and written as three 32bit words, with the key
+// stored xor'd with the two data words folded down to 16 bits. An entry
+// torn by concurrent writers then fails key verification instead of
+// returning mixed data.
+typedef union {
+
+    struct {
+        uint16_t key;
+        uint8_t depth;
+        uint8_t genBound;
+        int16_t score;
+        int16_t eval;
+        Move move;
+    };
+    uint32_t words[3];
+
+} TTEntry;
+
 typedef struct {
 
-    Key posKey;
-    Move move;
-    int16_t score;
-    uint8_t depth;
-    uint8_t bound;
+    TTEntry entry[BUCKET_SIZE];
+    uint8_t padding[4];
 
-} TTEntry;
+} TTBucket;
+
+static_assert(sizeof(TTBucket) == 64, "TTBucket should fill one cache line");
+
+// Header of a saved transposition table, the
+// buckets follow directly after in the file
+typedef struct {
+
+    char magic[8];
+    uint32_t version;
+    uint32_t bucketSize;
+    uint32_t entries;
+    uint32_t generation;
+    uint64_t MB;
+    uint64_t count;
+    uint64_t network; // Eval::network_id() of the network that computed the evals
+    uint8_t padding[16];
+
+} TTFileHeader;
+
+static_assert(sizeof(TTFileHeader) == 64, "TTFileHeader should keep buckets cache aligned");
 
 typedef struct {
 
     void *mem;
-    TTEntry *table;
+    TTBucket *table;
+    int pageKind;
     size_t count;
     size_t currentMB;
     size_t requestedMB;
+    uint8_t generation;
     bool dirty;
 
 } TranspositionTable;
@@ -78,14 +127,59 @@ INLINE int ScoreFromTT (const int score, const uint8_t ply) {
                                   : score;
 }
 
-INLINE TTEntry *GetEntry(Key posKey) {
+INLINE int Bound(const TTEntry *tte) {
+    return tte->genBound & TT_BOUND_MASK;
+}
+
+// Number of generations since the entry was last written to
+INLINE int Age(const TTEntry *tte) {
+    return (TT_GEN_CYCLE + TT.generation - tte->genBound) & TT_GEN_MASK;
+}
+
+INLINE TTBucket *GetBucket(Key posKey) {
 
     // https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
-    return &TT.table[((uint32_t)posKey * (uint64_t)TT.count) >> 32];
+    return &TT.table[((__uint128_t)posKey * (__uint128_t)TT.count) >> 64];
+}
+
+// The bucket index is taken from the upper bits, so
+// the lower bits are stored to verify the position
+INLINE uint16_t KeyVerify(Key posKey) {
+    return (uint16_t)posKey;
+}
+
+// Folds all 64 bits of data into the 16 bits checked along with the key,
+// so a change anywhere in the data words fails verification
+INLINE uint16_t DataCheck(const uint32_t word1, const uint32_t word2) {
+    const uint32_t data = word1 ^ word2;
+    return (uint16_t)(data ^ data >> 16);
+}
+
+// Reads and decodes an entry from the table
+INLINE TTEntry LoadEntry(const TTEntry *slot) {
+
+    TTEntry tte;
+    tte.words[1] = __atomic_load_n(&slot->words[1], __ATOMIC_RELAXED);
+    tte.words[2] = __atomic_load_n(&slot->words[2], __ATOMIC_RELAXED);
+    tte.words[0] = __atomic_load_n(&slot->words[0], __ATOMIC_RELAXED)
+                 ^ DataCheck(tte.words[1], tte.words[2]);
+    return tte;
+}
+
+// Encodes and writes an entry to the table
+INLINE void SaveEntry(TTEntry *slot, const TTEntry *tte) {
+
+    __atomic_store_n(&slot->words[0], tte->words[0] ^ DataCheck(tte->words[1], tte->words[2]), __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->words[1], tte->words[1], __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->words[2], tte->words[2], __ATOMIC_RELAXED);
 }
 
-TTEntry* ProbeTT(Key posKey, bool *ttHit);
-void StoreTTEntry(TTEntry *tte, Key posKey, Move move, int score, Depth depth, int bound);
+TTEntry* ProbeTT(Key posKey, TTEntry *tte, bool *ttHit);
+void StoreTTEntry(TTEntry *slot, Key posKey, Move move, int score, int eval, Depth depth, int bound);
 int HashFull();
 void ClearTT(Thread *threads);
+void FreeTT();
 void InitTT(Thread *threads);
+void NewSearchTT();
+bool SaveTT(const char *path);
+bool LoadTT(const char *path, Thread *threads);
@@ -23,8 +23,10 @@
 #include "fathom/tbprobe.h"
 #include "noobprobe/noobprobe.h"
 #include "board.h"
+#include "cpu.h"
 #include "makemove.h"
 #include "move.h"
+#include "numa.h"
 #include "search.h"
 #include "tests.h"
 #include "threads.h"
@@ -35,8 +37,12 @@
 
 
 bool SkipLoadingEval;
+bool EvalMap;
+bool EvalSmallNet;
 bool evalLoaded;
 char EvalDir[INPUT_SIZE] = "eval";
+size_t EvalHashMB = DEFAULTEVALHASH;
+char HashFile[INPUT_SIZE] = "weiss.hash";
 
 
 // Parses the time controls
@@ -77,6 +83,18 @@ INLINE void UCIGo(Engine *engine, char *str) {
 
     ABORT_SIGNAL = false;
     ParseTimeControl(str, engine->pos.stm);
+
+#ifdef EVAL_NNUE
+    // Switch to a network loaded in the background, dropping anything
+    // the root state and the TT computed with the old one, as static
+    // evals stored in the TT are reused in place of new evaluations
+    if (Eval::swap_eval()) {
+        ResetStates(&engine->pos);
+        TT.dirty = true;
+        ClearTT(engine->threads);
+    }
+#endif
+
     pthread_create(&engine->threads->pthreads[0], NULL, &BeginSearch, engine);
 }
 
@@ -101,6 +119,9 @@ static void UCIPosition(Position *pos, char *str) {
 
         // Reset ply to avoid triggering asserts in debug mode in long games
         pos->ply = 0;
+#ifdef EVAL_NNUE
+        ResetStates(pos);
+#endif
 
         // Keep track of how many moves have been played so far for TM
         pos->gameMoves += sideToMove == WHITE;
@@ -114,13 +135,34 @@ static void UCIPosition(Position *pos, char *str) {
 // Parses a 'setoption' and updates settings
 static void UCISetOption(Engine *engine, char *str) {
 
+    // Sets the file the transposition table is saved to and loaded from
+    if (OptionName(str, "HashFile")) {
+
+        strncpy(HashFile, OptionValue(str), INPUT_SIZE);
+
     // Sets the size of the transposition table
-    if (OptionName(str, "Hash")) {
+    } else if (OptionName(str, "Hash")) {
 
         TT.requestedMB = atoi(OptionValue(str));
 
         std::cout << "Hash will use " << TT.requestedMB << "MB after next 'isready'.\n";
 
+    // Writes the transposition table to HashFile
+    } else if (OptionName(str, "SaveHash")) {
+
+        if (SaveTT(HashFile))
+            printf("info string Saved %" PRIu64 "MB hash to %s\n", (uint64_t)TT.currentMB, HashFile);
+        else
+            printf("info string Failed to save hash to %s\n", HashFile);
+
+    // Replaces the transposition table with the one saved in HashFile
+    } else if (OptionName(str, "LoadHash")) {
+
+        if (LoadTT(HashFile, engine->threads))
+            printf("info string Loaded %" PRIu64 "MB hash from %s\n", (uint64_t)TT.currentMB, HashFile);
+        else
+            printf("info string Failed to load hash from %s\n", HashFile);
+
     // Sets number of threads to use for searching
     } else if (OptionName(str, "Threads")) {
 
@@ -129,6 +171,31 @@ static void UCISetOption(Engine *engine, char *str) {
         engine->threads = InitThreads(atoi(OptionValue(str)));
 
         printf("Search will use %d threads.\n", engine->threads->count);
+        PrintNumaThreads(engine->threads);
+
+    // Binds threads to NUMA nodes and gives each node its own copy of the network
+    } else if (OptionName(str, "NUMA")) {
+
+        NumaEnabled = !strncmp(OptionValue(str), "true", 4);
+        InitNuma();
+
+        // Reassign threads to nodes
+        int count = engine->threads->count;
+        free(engine->threads->pthreads);
+        free(engine->threads);
+        engine->threads = InitThreads(count);
+
+        // Reallocate the TT so it is first touched by the bound threads
+        FreeTT();
+        InitTT(engine->threads);
+
+#ifdef EVAL_NNUE
+        if (evalLoaded)
+            Eval::create_replicas();
+#endif
+
+        printf("info string NUMA %s with %d nodes\n", NumaEnabled ? "enabled" : "disabled", NumaNodes());
+        PrintNumaThreads(engine->threads);
 
     // Sets the syzygy tablebase path
     } else if (OptionName(str, "SyzygyPath")) {
@@ -145,12 +212,41 @@ static void UCISetOption(Engine *engine, char *str) {
 
         SkipLoadingEval = !strncmp(OptionValue(str), "true", 4);
 
+    // Sets the size of the NNUE eval hash, rounded down to a power of two, 0 disables it
+    } else if (OptionName(str, "EvalHash")) {
+
+        EvalHashMB = atoi(OptionValue(str));
+
+        std::cout << "EvalHash will use " << EvalHashMB << "MB after next 'isready'.\n";
+
     // Toggles probing of Chess Cloud Database
     } else if (OptionName(str, "EvalDir")) {
 
         strncpy(EvalDir, OptionValue(str), INPUT_SIZE);
         evalLoaded = false;
 
+    // Maps the network image in EvalDir read-only instead of reading nn.bin
+    } else if (OptionName(str, "EvalMap")) {
+
+        EvalMap = !strncmp(OptionValue(str), "true", 4);
+        evalLoaded = false;
+
+    // Loads a small network from EvalDir for quiescence and pruning evals
+    } else if (OptionName(str, "EvalSmallNet")) {
+
+        EvalSmallNet = !strncmp(OptionValue(str), "true", 4);
+        evalLoaded = false;
+
+#ifdef EVAL_NNUE
+    // Writes the loaded network to EvalDir in the layout EvalMap maps
+    } else if (OptionName(str, "SaveEvalMap")) {
+
+        if (evalLoaded && Eval::save_eval_map())
+            printf("info string Saved network image to %s\n", EvalDir);
+        else
+            printf("info string Failed to save network image to %s\n", EvalDir);
+#endif
+
     // Sets evaluation parameters (dev mode)
     } else
         TuneParseAll(strstr(str, "name") + 5, atoi(OptionValue(str)));
@@ -161,11 +257,20 @@ static void UCISetOption(Engine *engine, char *str) {
 static void UCIInfo() {
     printf("id name %s\n", NAME);
     printf("id author Terje Kirstihagen\n");
+    PrintCPU();
     printf("option name Hash type spin default %d min %d max %d\n", DEFAULTHASH, MINHASH, MAXHASH);
     printf("option name Threads type spin default %d min %d max %d\n", 1, 1, 2048);
+    printf("option name NUMA type check default false\n");
+    printf("option name HashFile type string default weiss.hash\n");
+    printf("option name SaveHash type button\n");
+    printf("option name LoadHash type button\n");
     printf("option name SyzygyPath type string default <empty>\n");
     printf("option name NoobBook type check default false\n");
     printf("option name EvalDir type string default eval\n");
+    printf("option name EvalHash type spin default %d min %d max %d\n", DEFAULTEVALHASH, 0, MAXEVALHASH);
+    printf("option name EvalMap type check default false\n");
+    printf("option name EvalSmallNet type check default false\n");
+    printf("option name SaveEvalMap type button\n");
     printf("option name Ponder type check default false\n"); // Turn on ponder stats in cutechess gui
     TuneDeclareAll(); // Declares all evaluation parameters as options (dev mode)
     printf("uciok\n"); fflush(stdout);
@@ -184,8 +289,11 @@ static void UCIIsReady(Engine *engine) {
     InitTT(engine->threads);
 
 #ifdef EVAL_NNUE
+    Eval::resize_eval_hash(EvalHashMB);
+
+    // Later networks load in the background and are used from the next 'go'
     if (!evalLoaded)
-        Eval::load_eval(), evalLoaded = true;
+        Eval::load_eval_async(), evalLoaded = true;
 #endif
 
     printf("readyok\n");
@@ -195,6 +303,9 @@ static void UCIIsReady(Engine *engine) {
 // Reset for a new game
 static void UCINewGame(Engine *engine) {
     ClearTT(engine->threads);
+#ifdef EVAL_NNUE
+    Eval::clear_eval_hash();
+#endif
     failedQueries = 0;
 }
 
@@ -215,8 +326,12 @@ int main(int argc, char **argv) {
         return Benchmark(argc, argv), 0;
 
     // Init engine
-    Engine engine = { {}, InitThreads(1) };
+    Engine engine = {};
+    engine.threads = InitThreads(1);
     Position *pos = &engine.pos;
+#ifdef EVAL_NNUE
+    pos->states = engine.states;
+#endif
 
     // Setup the default position
     ParseFen(START_FEN, pos);
@@ -239,6 +354,11 @@ int main(int argc, char **argv) {
             case PRINT      : PrintBoard(pos);     break;
             case PERFT      : Perft(str);          break;
             case MIRRORTEST : MirrorEvalTest(pos); break;
+            case NNUETEST   : NNUETest(pos);       break;
+            case QUANTIZE   : QuantizeNet(str);    break;
+            case NNUEBENCH  : NNUEBench(pos, str); break;
+            case COMPRESSNET: CompressNet(str);    break;
+            case TTSTRESS   : StressTT(engine.threads, str); break;
 #endif
         }
     }
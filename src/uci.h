@@ -28,15 +28,25 @@
 #define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
 #define INPUT_SIZE 4096
 
+#define DEFAULTEVALHASH 64
+#define MAXEVALHASH 65536
+
 
 extern bool SkipLoadingEval;
+extern bool EvalMap;
+extern bool EvalSmallNet;
 extern char EvalDir[INPUT_SIZE];
+extern size_t EvalHashMB;
+extern char HashFile[INPUT_SIZE];
 
 
 typedef struct {
 
     Position pos;
     Thread *threads;
+#ifdef EVAL_NNUE
+    StateInfo states[STATE_STACK_SIZE];
+#endif
 
 } Engine;
 
@@ -55,7 +65,12 @@ enum InputCommands {
     EVAL        = 26,
     PRINT       = 112,
     PERFT       = 116,
-    MIRRORTEST  = 4
+    MIRRORTEST  = 4,
+    NNUETEST    = 14,
+    QUANTIZE    = 1,
+    NNUEBENCH   = 115,
+    COMPRESSNET = 121,
+    TTSTRESS    = 24
 };
 
 